@@ -3,6 +3,9 @@
 #include <pthread.h>
 #include <limits.h>
 #include <stdatomic.h>
+
+#include "Bst2Client/nodeArena.h"
+#include "Bst2Client/waitTable.h"
 /*
 The above lines are preprocessor directives that include necessary header files for input/output operations, dynamic memory allocation, thread creation and management, and atomic operations.
 */
@@ -20,20 +23,38 @@ typedef struct Node {
 
 /*
 Another structure ThreadArgs is defined to hold the arguments passed to the search thread. 
-It contains an integer data representing the value to be searched and a pointer to the root node of the binary search tree.
+It contains an integer data representing the value to wait for and how long to wait for it, in milliseconds (negative: no limit).
 */
 
 typedef struct ThreadArgs {
     int data;
-    Node* root;
+    long long timeoutMs;
 } ThreadArgs;
 
 /*
-The createNode function dynamically allocates memory for a new Node and initializes its data with the given value. 
+The tree is shared by main, which keeps inserting, and the search threads, which read it. The read-write lock keeps a search from walking a half-linked node.
+*/
+Node* root = NULL;
+pthread_rwlock_t treeLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+Search threads sleep in a wait table (waitTable.h) until the key they want is inserted, instead of re-walking the tree in a loop. Every insert wakes the threads waiting for its key, and nothing else.
+Shutdown is a separate cancellation token: firing it wakes every waiter, so no key in the tree has to double as a stop signal.
+*/
+WaitTable keyWaits;
+CancelToken shutdownToken;
+
+/*
+Nodes come from a slab allocator (nodeArena.h) rather than one malloc each, so nodes created one after another sit next to each other in memory.
+*/
+NodeArena nodeArena;
+
+/*
+The createNode function takes memory for a new Node from the arena and initializes its data with the given value. 
 It sets the left and right child pointers to NULL and returns the newly created node.
 */
 Node* createNode(int data) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
+    Node* newNode = (Node*)arenaAlloc(&nodeArena);
     newNode->data = data;
     newNode->left = newNode->right = NULL;
     return newNode;
@@ -73,41 +94,44 @@ Node* searchNode(Node* root, int data) {
     }
 }
 
+/*
+The treeContains function is how the wait table checks whether a key is already in the tree. It runs under the read side of the tree lock.
+*/
+int treeContains(void* ctx, int data) {
+    (void)ctx;
+    pthread_rwlock_rdlock(&treeLock);
+    int found = searchNode(root, data) != NULL;
+    pthread_rwlock_unlock(&treeLock);
+    return found;
+}
+
+/*
+The treeInsert function inserts under the write side of the tree lock, then wakes whoever waits for the key. The wake comes after the lock is released: the wait table calls treeContains with its own lock held, so notifying under the tree lock could deadlock.
+*/
+void treeInsert(int data) {
+    pthread_rwlock_wrlock(&treeLock);
+    insertNode(&root, data);
+    pthread_rwlock_unlock(&treeLock);
+    waitTableNotify(&keyWaits, data);
+}
+
 /*
 The searchThread function is the entry point for the search threads. 
 It takes a void pointer as an argument, which is then cast to a ThreadArgs pointer.
-It extracts the search data and the root node from the ThreadArgs structure. 
-Then, it starts a loop that repeatedly searches for the given data in the binary search tree until the result is found or the atomic data value of the root becomes INT_MIN. The atomic_load function is used to safely access the atomic data value. 
-If the result is found, it prints the value, otherwise, it prints that the value was not found.
+It blocks in waitForKey, using no CPU, until the value is inserted, the timeout passes or the shutdown token fires. 
+If the value showed up, it prints it, otherwise, it prints that the value was not found.
 */
 void* searchThread(void* arg) {
     ThreadArgs* threadArgs = (ThreadArgs*)arg;
     int data = threadArgs->data;
-    Node* root = threadArgs->root;
-    Node* result = NULL;
-
-    while (1) {
-        Node* curr = root;
-        while (curr != NULL) {
-            if (data == curr->data) {
-                result = curr;
-                break;
-            } else if (data < curr->data) {
-                curr = curr->left;
-            } else {
-                curr = curr->right;
-            }
-        }
-
-        if (result != NULL)
-            break;
-
-        if (atomic_load(&root->data) == INT_MIN)
-            break;
-    }
+    long long timeoutNanos = threadArgs->timeoutMs < 0 ? -1 : threadArgs->timeoutMs * 1000000LL;
+
+    int result = waitForKey(&keyWaits, data, waitDeadline(timeoutNanos), &shutdownToken);
 
-    if (result != NULL) {
-        printf("Found %d\n", result->data);
+    if (result == WAIT_PRESENT) {
+        printf("Found %d\n", data);
+    } else if (result == WAIT_TIMED_OUT) {
+        printf("%d not found (timed out)\n", data);
     } else {
         printf("%d not found\n", data);
     }
@@ -115,46 +139,49 @@ void* searchThread(void* arg) {
 }
 
 //The main function is the entry point of the program. 
-//It initializes the root node as NULL and inserts several nodes into the binary search tree using the insertNode function.
+//It initializes the wait table and inserts the first few nodes into the binary search tree; the rest are inserted while the search threads wait.
 int main() {
-    Node* root = NULL;
-
-    insertNode(&root, 50);
-    insertNode(&root, 35);
-    insertNode(&root, 20);
-    insertNode(&root, 40);
-    insertNode(&root, 70);
-    insertNode(&root, 60);
-    insertNode(&root, 90);
-    insertNode(&root, 45);
-    insertNode(&root, 21);
-    insertNode(&root, 56);
-    insertNode(&root, 30);
+    arenaInit(&nodeArena, sizeof(Node));
+    waitTableInit(&keyWaits, treeContains, NULL);
+
+    int keys[] = {50, 35, 20, 40, 70, 60, 90, 45, 21, 56, 30};
+    int keyCount = sizeof(keys) / sizeof(keys[0]);
+    for (int i = 0; i < 7; i++) {
+        treeInsert(keys[i]);
+    }
 
     /*
-    In this section, an array threads of size 3 is created to hold thread identifiers.
-    An array threadArgs of size 3 is also created to hold the arguments for each thread, consisting of the search data and the root node. 
-    Three threads are created using pthread_create, and the searchThread function is used as the thread routine. Each thread is passed the address of the corresponding threadArgs element as an argument.
+    In this section, an array threads of size 5 is created to hold thread identifiers.
+    An array threadArgs of size 5 is also created to hold the arguments for each thread, consisting of the value to wait for and a timeout. 
+    Five threads are created using pthread_create, and the searchThread function is used as the thread routine. Each thread is passed the address of the corresponding threadArgs element as an argument.
+    30 is only inserted after the threads start and 3 never is; 5 has a timeout short enough to run out first.
     */
-    pthread_t threads[4];
-    ThreadArgs threadArgs[4] = {
-        {30, root},
-        {60, root},
-        {90, root},
-        {3, root}
+    pthread_t threads[5];
+    ThreadArgs threadArgs[5] = {
+        {30, -1},
+        {60, -1},
+        {90, -1},
+        {3, -1},
+        {5, 100}
     };
 
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < 5; i++) {
         pthread_create(&threads[i], NULL, searchThread, &threadArgs[i]);
     }
+
+    for (int i = 7; i < keyCount; i++) {
+        treeInsert(keys[i]);
+    }
 /*
-In this part, the atomic store operation is used to set the data value of the root node to INT_MIN. 
-This serves as a signal to the search threads to stop searching. 
+In this part, after a short pause that lets the 100 ms timeout run out, the shutdown token is fired. 
+This wakes the search threads still waiting, for values that were never inserted, and they report them as not found. 
 Then, pthread_join is called to wait for each thread to finish execution.
 */
-    atomic_store(&root->data, INT_MIN);
+    struct timespec pause = {0, 200 * 1000000L};
+    nanosleep(&pause, NULL);
+    cancelTokenFire(&keyWaits, &shutdownToken);
 
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < 5; i++) {
         pthread_join(threads[i], NULL);
     }
 
@@ -7,6 +7,10 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+
+#include "../Bst2Client/snapshot.h"
+#include "../Bst2Client/nodeArena.h"
 
 typedef struct Node {
     _Atomic int data;
@@ -14,13 +18,11 @@ typedef struct Node {
     struct Node* right;
 } Node;
 
-typedef struct ThreadArgs {
-    int data;
-    Node* root;
-} ThreadArgs;
+// Nodes are carved from slabs, so a tree built in one go is contiguous
+NodeArena nodeArena;
 
 Node* createNode(int data) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
+    Node* newNode = (Node*)arenaAlloc(&nodeArena);
     newNode->data = data;
     newNode->left = newNode->right = NULL;
     return newNode;
@@ -68,11 +70,11 @@ Node* removeNode(Node* root, int data) {
     } else {
         if (root->left == NULL) {
             Node* temp = root->right;
-            free(root);
+            arenaFree(&nodeArena, root);
             return temp;
         } else if (root->right == NULL) {
             Node* temp = root->left;
-            free(root);
+            arenaFree(&nodeArena, root);
             return temp;
         }
         Node* minRight = findMinNode(root->right);
@@ -82,42 +84,24 @@ Node* removeNode(Node* root, int data) {
     return root;
 }
 
-void* searchThread(void* arg) {
-    ThreadArgs* threadArgs = (ThreadArgs*)arg;
-    int data = threadArgs->data;
-    Node* root = threadArgs->root;
-    Node* result = NULL;
-
-    while (1) {
-        Node* curr = root;
-        while (curr != NULL) {
-            if (data == curr->data) {
-                result = curr;
-                break;
-            } else if (data < curr->data) {
-                curr = curr->left;
-            } else {
-                curr = curr->right;
-            }
-        }
-
-        if (result != NULL)
-            break;
-
-        if (atomic_load(&root->data) == INT_MIN)
-            break;
-    }
-
-    if (result != NULL) {
-        printf("Found %d\n", result->data);
-    } else {
-        printf("%d not found\n", data);
+// Builds a balanced tree from the sorted keys [lo, hi) of a checkpoint in
+// one linear pass, with no per-key descents
+Node* buildBalancedTree(const Snapshot* snapshot, uint64_t lo, uint64_t hi) {
+    if (lo >= hi) {
+        return NULL;
     }
-    return NULL;
+    uint64_t mid = lo + (hi - lo) / 2;
+    Node* node = createNode(snapshotKey(snapshot, mid));
+    node->left = buildBalancedTree(snapshot, lo, mid);
+    node->right = buildBalancedTree(snapshot, mid + 1, hi);
+    return node;
 }
 
+// Tree shared read-only by every client, built once at startup
+Node* sharedRoot = NULL;
+
 void* clientHandler(void* arg) {
-    int clientSocket = *((int*)arg);
+    int clientSocket = (int)(intptr_t)arg;
     char buffer[256];
 
     if (read(clientSocket, buffer, sizeof(buffer)) < 0) {
@@ -128,16 +112,7 @@ void* clientHandler(void* arg) {
 
     int data = atoi(buffer);
 
-    Node* root = NULL;
-    insertNode(&root, 50);
-    insertNode(&root, 35);
-    insertNode(&root, 20);
-    insertNode(&root, 40);
-    insertNode(&root, 70);
-    insertNode(&root, 60);
-    insertNode(&root, 90);
-
-    Node* result = searchNode(root, data);
+    Node* result = searchNode(sharedRoot, data);
 
     memset(buffer, 0, sizeof(buffer));
     if (result != NULL) {
@@ -154,12 +129,34 @@ void* clientHandler(void* arg) {
     return NULL;
 }
 
-int main() {
+// Usage: ./ServerBST [checkpoint-file]
+// With a checkpoint written by Server.c --snapshot, the tree is built from
+// it; otherwise from the built-in keys.
+int main(int argc, char* argv[]) {
     int serverSocket, clientSocket;
     struct sockaddr_in serverAddress, clientAddress;
     int addrlen = sizeof(serverAddress);
     pthread_t threadId;
 
+    arenaInit(&nodeArena, sizeof(Node));
+
+    Snapshot snapshot;
+    int loaded = argc > 1 ? snapshotOpen(argv[1], &snapshot) : 1;
+    if (loaded < 0) {
+        perror("Checkpoint load failed");
+        exit(EXIT_FAILURE);
+    }
+    if (loaded == 0) {
+        sharedRoot = buildBalancedTree(&snapshot, 0, snapshot.count);
+        printf("Loaded %llu keys from %s.\n", (unsigned long long)snapshot.count, argv[1]);
+        snapshotClose(&snapshot);
+    } else {
+        int initialKeys[] = {50, 35, 20, 40, 70, 60, 90};
+        for (size_t i = 0; i < sizeof(initialKeys) / sizeof(initialKeys[0]); i++) {
+            insertNode(&sharedRoot, initialKeys[i]);
+        }
+    }
+
     if ((serverSocket = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
         perror("Socket creation failed");
         exit(EXIT_FAILURE);
@@ -180,7 +177,7 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(serverSocket, 3) < 0) {
+    if (listen(serverSocket, SOMAXCONN) < 0) {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
@@ -193,10 +190,12 @@ int main() {
             exit(EXIT_FAILURE);
         }
 
-        if (pthread_create(&threadId, NULL, clientHandler, &clientSocket) < 0) {
+        // Pass the descriptor by value; the next accept() reuses clientSocket
+        if (pthread_create(&threadId, NULL, clientHandler, (void*)(intptr_t)clientSocket) < 0) {
             perror("Thread creation failed");
             exit(EXIT_FAILURE);
         }
+        pthread_detach(threadId);
     }
 
     return 0;
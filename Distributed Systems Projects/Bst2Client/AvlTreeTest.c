@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "avlTree.h"
+
+// Regression checks for the AVL tree behind Server.c in relaxed-balance
+// mode: single writes that skip rotations, mixed with INSERT and REMOVE
+// frames large enough for insertBatch and removeBatch, the way the server
+// issues them (a frame the batch path turns down goes key by key). After
+// every step the tree must hold exactly the keys a plain array says it
+// should, with correct sizes and heights and every imbalance flagged.
+//
+// Usage: ./avlTreeTest [rounds]
+
+#define TEST_KEYS 65536    // Keys are drawn from [0, TEST_KEYS)
+#define TEST_FRAME 512     // Keys per batch frame, above FRAME_BATCH_MIN
+#define TEST_SINGLES 200   // Single writes between frames
+
+unsigned char present[TEST_KEYS];
+int presentCount = 0;
+int batchesTaken = 0;
+int batchesTurnedDown = 0;
+
+uint32_t nextRandom(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Recomputes node's subtree and compares it with what the nodes record;
+// returns the number of problems found
+int checkSubtree(Node* node, long lo, long hi, int* height, int* size) {
+    if (node == NULL) {
+        *height = -1;
+        *size = 0;
+        return 0;
+    }
+    int leftHeight, leftSize, rightHeight, rightSize;
+    int problems = checkSubtree(node->left, lo, (long)node->data - 1, &leftHeight, &leftSize);
+    problems += checkSubtree(node->right, (long)node->data + 1, hi, &rightHeight, &rightSize);
+    *height = max(leftHeight, rightHeight) + 1;
+    *size = leftSize + rightSize + 1;
+    int unbalanced = leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1;
+    int flagged = unbalanced || isPending(node->left) || isPending(node->right);
+    problems += node->data < lo || node->data > hi;
+    problems += node->height != *height || node->size != *size;
+    problems += flagged && !node->pending; // A stale flag is allowed, a missing one is not
+    return problems;
+}
+
+int checkTree(const char* step, int round) {
+    int height, size;
+    int problems = checkSubtree(sharedRoot, INT_MIN, INT_MAX, &height, &size);
+    if (size != presentCount) {
+        problems++;
+    }
+    for (int key = 0; key < TEST_KEYS && problems == 0; key++) {
+        problems += (searchNode(sharedRoot, key) != NULL) != present[key];
+    }
+    if (problems > 0) {
+        printf("FAIL: round %d, after %s: %d problem(s), %d key(s) for %d expected\n", round, step, problems,
+               size, presentCount);
+    }
+    return problems;
+}
+
+void writeSingles(uint32_t* state) {
+    int run = (int)(nextRandom(state) % TEST_KEYS);
+    for (int i = 0; i < TEST_SINGLES; i++) {
+        // Runs of ascending keys lean the tree; random removals thin it out
+        int key = i % 2 == 0 ? (run + i) % TEST_KEYS : (int)(nextRandom(state) % TEST_KEYS);
+        pthread_rwlock_wrlock(&treeLock);
+        if (i % 2 == 0 && !present[key]) {
+            lockedAvlAdd(key);
+            present[key] = 1;
+            presentCount++;
+        } else if (i % 2 == 1 && present[key]) {
+            lockedAvlDelete(key);
+            present[key] = 0;
+            presentCount--;
+        }
+        pthread_rwlock_unlock(&treeLock);
+    }
+}
+
+// An INSERT or REMOVE frame as treeInsertMany and treeRemoveMany run it
+void writeFrame(uint32_t* state, int insert) {
+    int keys[TEST_FRAME];
+    unsigned char results[TEST_FRAME];
+    for (int i = 0; i < TEST_FRAME; i++) {
+        keys[i] = (int)(nextRandom(state) % TEST_KEYS);
+    }
+    pthread_rwlock_wrlock(&treeLock);
+    int batched = insert ? insertBatch(keys, TEST_FRAME, results) : removeBatch(keys, TEST_FRAME, results);
+    if (batched == 0) {
+        batchesTaken++;
+        for (int i = 0; i < TEST_FRAME; i++) {
+            if (results[i]) {
+                present[keys[i]] = insert;
+                presentCount += insert ? 1 : -1;
+            }
+        }
+    } else {
+        batchesTurnedDown++;
+        for (int i = 0; i < TEST_FRAME; i++) {
+            if (present[keys[i]] != insert) {
+                if (insert) {
+                    lockedAvlAdd(keys[i]);
+                } else {
+                    lockedAvlDelete(keys[i]);
+                }
+                present[keys[i]] = insert;
+                presentCount += insert ? 1 : -1;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    if (rounds < 1) {
+        fprintf(stderr, "Usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    avlTreeInit();
+    relaxedBalance = 1;
+    uint32_t state = 2463534242u;
+    int problems = 0;
+    for (int round = 0; round < rounds && problems == 0; round++) {
+        writeSingles(&state);
+        problems += checkTree("single writes", round);
+        if (round % 4 == 3) {
+            // Do the rebalancer's work now and then, so frames meet a tree
+            // in AVL balance as well as one with imbalances left in it
+            pthread_rwlock_wrlock(&treeLock);
+            while (isPending(sharedRoot)) {
+                int budget = RELAXED_BATCH;
+                sharedRoot = rebalancePending(sharedRoot, &budget);
+            }
+            pthread_rwlock_unlock(&treeLock);
+            problems += checkTree("rebalancing", round);
+        }
+        writeFrame(&state, 1);
+        problems += checkTree("an INSERT frame", round);
+        writeFrame(&state, 0);
+        problems += checkTree("a REMOVE frame", round);
+    }
+    if (problems == 0 && (batchesTaken == 0 || batchesTurnedDown == 0)) {
+        printf("FAIL: %d frame(s) batched, %d key by key; both paths should run\n", batchesTaken,
+               batchesTurnedDown);
+        problems++;
+    }
+    if (problems > 0) {
+        return 1;
+    }
+    printf("ok: %d round(s), %d frame(s) batched, %d key by key, %d key(s) left\n", rounds, batchesTaken,
+           batchesTurnedDown, presentCount);
+    return 0;
+}
@@ -1,271 +1,159 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <stdatomic.h>
 #include <pthread.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <time.h>
 
-typedef struct Node {
-    _Atomic int data;
-    int height;
-    struct Node* left;
-    struct Node* right;
-    pthread_mutex_t lock;
-} Node;
-
-Node* newNode(int data) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
-    newNode->data = data;
-    newNode->height = 1;
-    newNode->left = NULL;
-    newNode->right = NULL;
-    pthread_mutex_init(&newNode->lock, NULL); // Initialize the mutex lock
-    return newNode;
-}
+#include <unistd.h>
 
-int getHeight(Node* root) {
-    if (root == NULL) {
-        return 0;
-    }
-    return root->height;
-}
+#include "lockFreeBst.h"
+#include "taskPool.h"
 
-int getBalance(Node* root) {
-    if (root == NULL) {
-        return 0;
-    }
-    return getHeight(root->left) - getHeight(root->right);
-}
+// The tree itself is the lock-free BST in lockFreeBst.h; these wrappers
+// keep the menu's original operation names.
+typedef LfTree Tree;
 
-Node* rightRotate(Node* y) {
-    Node* x = y->left;
-    Node* T2 = x->right;
-
-    // Perform rotation
-    x->right = y;
-    y->left = T2;
-
-    // Update heights
-    y->height = fmax(getHeight(y->left), getHeight(y->right)) + 1;
-    x->height = fmax(getHeight(x->left), getHeight(x->right)) + 1;
-
-    return x;
+bool insertNode(Tree* tree, int data) {
+    return lfInsert(tree, data);
 }
 
-Node* leftRotate(Node* x) {
-    Node* y = x->right;
-    Node* T2 = y->left;
-
-    // Perform rotation
-    y->left = x;
-    x->right = T2;
-
-    // Update heights
-    x->height = fmax(getHeight(x->left), getHeight(x->right)) + 1;
-    y->height = fmax(getHeight(y->left), getHeight(y->right)) + 1;
-
-    return y;
+bool removeNode(Tree* tree, int data) {
+    return lfRemove(tree, data);
 }
 
-Node* insertNode(Node* root, int data) {
-    if (root == NULL) {
-        return newNode(data);
-    }
-
-    pthread_mutex_lock(&root->lock); // Lock the current node
-
-    if (data < root->data) {
-        root->left = insertNode(root->left, data);
-    } else if (data > root->data) {
-        root->right = insertNode(root->right, data);
-    } else {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return root; // Duplicate keys are not allowed
-    }
-
-    root->height = fmax(getHeight(root->left), getHeight(root->right)) + 1;
-
-    int balance = getBalance(root);
-
-    // Left Left Case
-    if (balance > 1 && data < root->left->data) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return rightRotate(root);
-    }
-
-    // Right Right Case
-    if (balance < -1 && data > root->right->data) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return leftRotate(root);
-    }
-
-    // Left Right Case
-    if (balance > 1 && data > root->left->data) {
-        root->left = leftRotate(root->left);
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return rightRotate(root);
-    }
-
-    // Right Left Case
-    if (balance < -1 && data < root->right->data) {
-        root->right = rightRotate(root->right);
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return leftRotate(root);
-    }
-
-    pthread_mutex_unlock(&root->lock); // Unlock the current node
-    return root;
+bool search(Tree* tree, int data) {
+    return lfSearch(tree, data);
 }
 
-Node* removeNode(Node* root, int data) {
-    if (root == NULL) {
-        return root;
-    }
-
-    pthread_mutex_lock(&root->lock); // Lock the current node
-
-    if (data < root->data) {
-        root->left = removeNode(root->left, data);
-    } else if (data > root->data) {
-        root->right = removeNode(root->right, data);
-    } else {
-        if (root->left == NULL || root->right == NULL) {
-            Node* temp = root->left ? root->left : root->right;
-            if (temp == NULL) {
-                temp = root;
-                root = NULL;
-            } else {
-                *root = *temp;
-            }
-            free(temp);
-        } else {
-            Node* temp = root->right;
-            while (temp->left != NULL) {
-                temp = temp->left;
-            }
-            root->data = temp->data;
-            root->right = removeNode(root->right, temp->data);
-        }
-    }
-
-    if (root == NULL) {
-        return root;
-    }
+// Helper threads for large batches of lookups; started in main
+TaskPool searchPool;
+#define SEARCH_CHUNK 4096 // Keys per helper task
 
-    root->height = fmax(getHeight(root->left), getHeight(root->right)) + 1;
+typedef struct SearchBatch {
+    Tree* tree;
+    const int* keys;
+    bool* results;
+} SearchBatch;
 
-    int balance = getBalance(root);
-
-    // Left Left Case
-    if (balance > 1 && getBalance(root->left) >= 0) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return rightRotate(root);
-    }
-
-    // Right Right Case
-    if (balance < -1 && getBalance(root->right) <= 0) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return leftRotate(root);
-    }
-
-    // Left Right Case
-    if (balance > 1 && getBalance(root->left) < 0) {
-        root->left = leftRotate(root->left);
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return rightRotate(root);
-    }
-
-    // Right Left Case
-    if (balance < -1 && getBalance(root->right) > 0) {
-        root->right = rightRotate(root->right);
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return leftRotate(root);
-    }
-
-    pthread_mutex_unlock(&root->lock); // Unlock the current node
-    return root;
+void searchChunk(void* ctx, size_t from, size_t to) {
+    SearchBatch* batch = (SearchBatch*)ctx;
+    lfSearchMany(batch->tree, batch->keys + from, (int)(to - from), batch->results + from);
 }
 
-bool search(Node* root, int data) {
-    if (root == NULL) {
-        return false;
-    }
-
-    pthread_mutex_lock(&root->lock); // Lock the current node
-
-    if (data == root->data) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return true;
-    } else if (data < root->data) {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return search(root->left, data);
-    } else {
-        pthread_mutex_unlock(&root->lock); // Unlock the current node
-        return search(root->right, data);
-    }
+// Looks up keys[0 .. n) at once: each thread interleaves its share of the
+// descents so their cache misses overlap, and batches larger than one chunk
+// are split across the helper threads. results[i] is true if keys[i] is in
+// the tree.
+void searchMany(Tree* tree, const int* keys, int n, bool* results) {
+    SearchBatch batch = {tree, keys, results};
+    taskPoolFor(&searchPool, n, SEARCH_CHUNK, searchChunk, &batch);
 }
 
-typedef struct SearchThreadArgs {
-    int data;
-    Node* root;
-    bool* found;
-    pthread_mutex_t* foundLock;
-} SearchThreadArgs;
-
-void* searchThread(void* arg) {
-    SearchThreadArgs* args = (SearchThreadArgs*)arg;
-    int data = args->data;
-    Node* root = args->root;
-
-    bool found = search(root, data);
-
-    pthread_mutex_lock(args->foundLock);
-    *(args->found) = *(args->found) || found;
-    pthread_mutex_unlock(args->foundLock);
-
-    pthread_exit(NULL);
+void printKey(int key) {
+    printf("%d ", key);
 }
 
-void parallelSearch(Node* root, int data) {
-    bool found = false;
-    pthread_mutex_t foundLock;
-    pthread_mutex_init(&foundLock, NULL);
-
-    pthread_t threads[4];
-    SearchThreadArgs threadArgs[4];
-
-    for (int i = 0; i < 4; i++) {
-        threadArgs[i].data = data;
-        threadArgs[i].root = root;
-        threadArgs[i].found = &found;
-        threadArgs[i].foundLock = &foundLock;
-        pthread_create(&threads[i], NULL, searchThread, (void*)&threadArgs[i]);
-    }
+void inOrderTraversal(Tree* root) {
+    lfInOrder(root->root, false, printKey);
+}
 
-    for (int i = 0; i < 4; i++) {
-        pthread_join(threads[i], NULL);
+typedef struct BenchArgs {
+    Tree* root;
+    int searchPercent; // The rest is split evenly between inserts and removes
+    int keyRange;
+    long operations;
+    unsigned int seed;
+} BenchArgs;
+
+void* benchThread(void* arg) {
+    BenchArgs* args = (BenchArgs*)arg;
+    for (long i = 0; i < args->operations; i++) {
+        int key = rand_r(&args->seed) % args->keyRange;
+        int dice = rand_r(&args->seed) % 100;
+        if (dice < args->searchPercent) {
+            search(args->root, key);
+        } else if (dice % 2 == 0) {
+            insertNode(args->root, key);
+        } else {
+            removeNode(args->root, key);
+        }
     }
+    return NULL;
+}
 
-    pthread_mutex_destroy(&foundLock);
-
-    if (found) {
-        printf("Node with value %d found in the tree.\n", data);
-    } else {
-        printf("Node with value %d not found in the tree.\n", data);
+// Runs the same total work on 1, 2, 4 and 8 threads for a read-heavy and a
+// mixed workload and prints the throughput of each
+void benchmark(Tree* root) {
+    const int keyRange = 100000;
+    const long totalOperations = 4000000;
+    int mixes[] = {90, 50};
+
+    // Start half full so inserts and removes both hit. The tree doesn't
+    // rebalance, so fill it in random order rather than sorted.
+    unsigned int seed = 42;
+    for (int i = 0; i < keyRange / 2; i++) {
+        insertNode(root, rand_r(&seed) % keyRange);
+    }
+
+    for (int m = 0; m < 2; m++) {
+        for (int threads = 1; threads <= 8; threads *= 2) {
+            pthread_t ids[8];
+            BenchArgs args[8];
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int t = 0; t < threads; t++) {
+                args[t] = (BenchArgs){root, mixes[m], keyRange, totalOperations / threads, (unsigned int)t + 1};
+                pthread_create(&ids[t], NULL, benchThread, &args[t]);
+            }
+            for (int t = 0; t < threads; t++) {
+                pthread_join(ids[t], NULL);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            printf("%d%% searches, %d thread(s): %.0f ops/sec\n", mixes[m], threads, totalOperations / seconds);
+
+            // Removed nodes should be freed steadily, not pile up
+            EbrStats ebr;
+            ebrGetStats(&ebr);
+            printf("    reclamation: %llu node(s) (%llu bytes) waiting, lag %llu epoch(s), %llu freed\n",
+                   (unsigned long long)ebr.pendingNodes, (unsigned long long)ebr.pendingBytes,
+                   (unsigned long long)ebr.lag, (unsigned long long)ebr.freedNodes);
+        }
     }
-}
 
-void inOrderTraversal(Node* root) {
-    if (root != NULL) {
-        inOrderTraversal(root->left);
-        printf("%d ", root->data);
-        inOrderTraversal(root->right);
+    // The same lookups one at a time and as batches
+    const int lookups = 1000000;
+    int* keys = (int*)malloc(lookups * sizeof(int));
+    bool* results = (bool*)malloc(lookups * sizeof(bool));
+    for (int i = 0; i < lookups; i++) {
+        keys[i] = rand_r(&seed) % keyRange;
+    }
+    int sizes[] = {1, 64, lookups};
+    for (int s = 0; s < 3; s++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < lookups; i += sizes[s]) {
+            if (sizes[s] == 1) {
+                results[i] = search(root, keys[i]);
+            } else {
+                searchMany(root, keys + i, lookups - i < sizes[s] ? lookups - i : sizes[s], results + i);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("Lookups in batches of %d: %.0f lookups/sec\n", sizes[s], lookups / seconds);
     }
+    free(keys);
+    free(results);
 }
 
 int main() {
-    Node* root = NULL;
+    Tree tree;
+    lfTreeInit(&tree);
+    Tree* root = &tree;
+    taskPoolInit(&searchPool, (int)sysconf(_SC_NPROCESSORS_ONLN) - 1);
 
     int option, target;
     printf("Binary Search Tree Operations:\n");
@@ -274,7 +162,7 @@ int main() {
     printf("3. Search for a node\n");
     printf("4. Print the tree (in-order traversal)\n");
     printf("5. Exit\n");
-
+    printf("6. Benchmark concurrent operations\n");
 
     while (1) {
         printf("Enter your option: ");
@@ -284,17 +172,21 @@ int main() {
             case 1:
                 printf("Enter the value to insert: ");
                 scanf("%d", &target);
-                root = insertNode(root, target);
+                insertNode(root, target);
                 break;
             case 2:
                 printf("Enter the value to remove: ");
                 scanf("%d", &target);
-                root = removeNode(root, target);
+                removeNode(root, target);
                 break;
             case 3:
                 printf("Enter the value to search: ");
                 scanf("%d", &target);
-                parallelSearch(root, target);
+                if (search(root, target)) {
+                    printf("Node with value %d found in the tree.\n", target);
+                } else {
+                    printf("Node with value %d not found in the tree.\n", target);
+                }
                 break;
             case 4:
                 printf("In-order traversal: ");
@@ -303,6 +195,9 @@ int main() {
                 break;
             case 5:
                 exit(0);
+            case 6:
+                benchmark(root);
+                break;
         }
     }
 
@@ -310,47 +205,40 @@ int main() {
 }
 
 /*
-This code is an implementation of a Binary Search Tree (BST) with thread-safe operations using mutex locks. The BST supports basic operations such as insertion, removal, searching for nodes, and printing the tree using in-order traversal. Let's break down the code step-by-step:
-
-1. `Node` struct:
-The `Node` struct represents a single node in the BST. It contains the following fields:
-- `_Atomic int data`: An atomic integer that stores the data value of the node.
-- `int height`: The height of the node (used for balancing).
-- `struct Node* left`: A pointer to the left child of the node.
-- `struct Node* right`: A pointer to the right child of the node.
-- `pthread_mutex_t lock`: A mutex lock associated with the node. This lock is used to ensure thread-safe access to the node during concurrent operations.
-
-2. `newNode` function:
-This function creates a new node and initializes its fields with the provided data value. It also initializes the mutex lock associated with the node.
+This code is an implementation of a Binary Search Tree (BST) that many threads can use at once without any locks. The tree itself is the lock-free external BST in `lockFreeBst.h` (Natarajan and Mittal's edge-marking design); this file wraps it in the interactive menu. Let's break down the code step-by-step:
 
-3. Rotations functions (`rightRotate` and `leftRotate`):
-These functions perform right and left rotations, respectively, to balance the BST after an insertion or removal operation. These rotations are essential to maintain the BST's properties.
+1. `LfNode` struct (in `lockFreeBst.h`):
+The tree is "external": keys live only in the leaves, and internal nodes only route searches left or right. A node holds the key, a sentinel marker, and two child pointers. The two low bits of each child pointer are used as marks on that edge:
+- FLAG: the leaf at the end of this edge is being removed.
+- TAG: this edge is frozen because its sibling is being removed.
+Compared with the previous version, which embedded a `pthread_mutex_t` in every node, a node is now 24 bytes, which the node arena (`nodeArena.h`) rounds up to a 32-byte slot.
 
-4. `getHeight` and `getBalance` functions:
-These functions calculate the height and balance factor of a node, respectively. The balance factor is the difference between the heights of the left and right subtrees of a node.
+2. Sentinels:
+Three sentinel keys that compare larger than any int sit at the top of the tree, so every real key always has a parent, a grandparent and an ancestor above them.
 
-5. `insertNode` function:
-This function inserts a new node with the given data value into the BST while maintaining the BST's properties. It uses recursion to find the appropriate position for insertion. Before modifying a node, it acquires a lock to ensure exclusive access during the modification.
+3. `search` function:
+It walks from the root to a leaf using plain atomic loads and then compares the leaf's key. It takes no locks and performs no atomic read-modify-write, so readers never slow each other down.
 
-6. `removeNode` function:
-This function removes a node with the given data value from the BST while maintaining the BST's properties. Similar to `insertNode`, it also uses recursion and acquires locks before modifying any node.
+4. `insertNode` function:
+It finds the leaf where the key belongs and, with one compare-and-swap (CAS) on the parent's child pointer, replaces that leaf with a new internal node holding the old leaf and a new leaf for the key. If the CAS fails because the edge is marked, the thread first helps finish the removal in progress and then retries.
 
-7. `search` function:
-This function searches for a node with the given data value in the BST using recursion. It acquires a lock on each node visited during the search.
+5. `removeNode` function:
+It works in two steps. First it flags the edge to the leaf, which claims the removal. Then it tags the edge to the leaf's sibling and, with one CAS at the nearest unmarked ancestor edge, hangs the sibling there, splicing out the leaf and its parent. Any thread that runs into these marks performs the second step itself, so no thread ever waits for another one.
 
-8. `SearchThreadArgs` struct and `searchThread` function:
-The `SearchThreadArgs` struct is used to pass arguments to the `searchThread` function. It contains the data value to be searched, the root of the tree, a flag to indicate if the value is found, and a mutex lock associated with the flag.
+6. `searchMany` function:
+It looks up a whole array of keys at once. Up to 16 descents take turns inside one thread: each one prefetches the next node it needs and yields to the others, so their cache misses overlap instead of happening one after another. Batches larger than a chunk are split across a pool of helper threads (`taskPool.h`). The menu's single search calls `search` directly; the previous version started four threads that all looked up the same key.
 
-The `searchThread` function is executed by multiple threads when performing parallel search. It searches for the given data value in the BST and sets the `found` flag accordingly. The `found` flag is protected by a mutex lock to ensure synchronized access.
+7. `searchChunk` function:
+This is the piece of a batch that one thread of the pool works on.
 
-9. `parallelSearch` function:
-This function performs parallel search on the BST by creating four threads that simultaneously search for the given data value. Each thread runs the `searchThread` function, and upon completion, the results are combined using the `found` flag.
+8. `inOrderTraversal` function:
+This function prints the keys of the leaves in sorted order, skipping sentinels and leaves that are being removed.
 
-10. `inOrderTraversal` function:
-This function performs an in-order traversal of the BST and prints the data values of the nodes in sorted order.
+9. `benchmark` function:
+This function runs a read-heavy workload (90% searches) and a mixed workload (50% searches) on 1, 2, 4 and 8 threads, and prints the throughput of each run to show how the tree scales. It then times a million lookups one at a time, in batches of 64, and as one large batch.
 
-11. `main` function:
-The `main` function acts as a user interface to interact with the BST. It provides options to insert, remove, search, and print the tree. Users can choose their desired operation by inputting the corresponding option.
+10. `main` function:
+The `main` function acts as a user interface to interact with the BST. It provides options to insert, remove, search, print the tree, and run the benchmark.
 
-Overall, this code demonstrates a thread-safe implementation of a Binary Search Tree, allowing multiple threads to concurrently access and modify the tree while ensuring data integrity and avoiding race conditions.
+Removed nodes are retired through `epoch.h` instead of being freed at once: another thread may still be reading them, so each one goes back to the arena only after every thread has left the epoch in which it was removed.
 */
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "bstProtocol.h"
+
+// Client request codes (must match Server.c)
+#define SEARCH_TARGET 1
+#define ADD_NODE 2
+#define REMOVE_NODE 3
+
+// Load generator for Server.c. Every thread looks up random keys and reports
+// throughput plus syscalls and bytes per lookup for three client styles:
+//   reuse      legacy protocol, one request per round trip on one connection
+//   reconnect  legacy protocol, a fresh connection per request
+//   binary     binary frames of --batch keys, --pipeline frames in flight
+//
+// With --connect-rate it instead opens and immediately resets connections to
+// measure how many the server accepts per second. Comparing runs against
+// `bstServer --loops N --reuseport` for growing N shows how accept throughput
+// scales with cores.
+//
+// Usage: ./benchClient [server-ip] [port] [threads] [requests-per-thread]
+//                      [--batch N] [--pipeline N] [--connect-rate]
+
+typedef struct BenchArgs {
+    struct sockaddr_in server_addr;
+    int requests;     // Lookups to perform
+    int mode;
+    int batch;
+    int pipeline;
+    int id;
+    long completed;
+    long syscalls;
+    long bytes;
+} BenchArgs;
+
+#define MODE_REUSE 0
+#define MODE_RECONNECT 1
+#define MODE_BINARY 2
+#define MODE_CONNECT 3
+
+double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int connectToServer(struct sockaddr_in* server_addr) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(sock, (struct sockaddr*)server_addr, sizeof(*server_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Sends one legacy request and reads the NUL-terminated reply
+int roundTrip(BenchArgs* args, int sock, int option, int target) {
+    int request[2] = {option, target};
+    args->syscalls++;
+    if (send(sock, request, sizeof(request), 0) != sizeof(request)) {
+        return 0;
+    }
+    args->bytes += sizeof(request);
+
+    char buffer[256];
+    while (1) {
+        args->syscalls++;
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return 0;
+        }
+        args->bytes += n;
+        if (buffer[n - 1] == '\0') {
+            return 1;
+        }
+    }
+}
+
+void runLegacy(BenchArgs* args) {
+    unsigned int seed = args->id + 1;
+    int sock = -1;
+
+    for (int i = 0; i < args->requests; i++) {
+        if (sock < 0) {
+            args->syscalls += 2;
+            if ((sock = connectToServer(&args->server_addr)) < 0) {
+                perror("Connection error");
+                break;
+            }
+        }
+
+        if (!roundTrip(args, sock, SEARCH_TARGET, rand_r(&seed) % 100)) {
+            fprintf(stderr, "Request failed\n");
+            break;
+        }
+        args->completed++;
+
+        if (args->mode == MODE_RECONNECT) {
+            args->syscalls++;
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+// Keeps up to `pipeline` frames of `batch` keys outstanding and parses the
+// responses as they stream back
+void runBinary(BenchArgs* args) {
+    unsigned int seed = args->id + 1;
+    int sock = connectToServer(&args->server_addr);
+    if (sock < 0) {
+        perror("Connection error");
+        return;
+    }
+
+    size_t frameSize = FRAME_HEADER_SIZE + args->batch * sizeof(int32_t);
+    unsigned char* frames = malloc(frameSize * args->pipeline);
+    size_t responseSize = FRAME_HEADER_SIZE + args->batch;
+    size_t bufferSize = responseSize * args->pipeline;
+    unsigned char* buffer = malloc(bufferSize);
+    size_t buffered = 0;
+
+    long frameCount = (args->requests + args->batch - 1) / args->batch;
+    long sent = 0, received = 0;
+    uint32_t nextId = 0, expectedId = 0;
+
+    while (received < frameCount) {
+        // Top the pipeline up with one send() covering every new frame
+        int toSend = 0;
+        while (sent + toSend < frameCount && sent + toSend - received < args->pipeline) {
+            unsigned char* frame = frames + toSend * frameSize;
+            encodeFrameHeader(frame, OP_SEARCH, 0, nextId++, args->batch * sizeof(int32_t));
+            for (int k = 0; k < args->batch; k++) {
+                putInt32(frame + FRAME_HEADER_SIZE + k * sizeof(int32_t), rand_r(&seed) % 100);
+            }
+            toSend++;
+        }
+        if (toSend > 0) {
+            size_t len = toSend * frameSize, pos = 0;
+            while (pos < len) {
+                args->syscalls++;
+                ssize_t n = send(sock, frames + pos, len - pos, 0);
+                if (n <= 0) {
+                    perror("Send error");
+                    goto done;
+                }
+                pos += n;
+            }
+            args->bytes += len;
+            sent += toSend;
+        }
+
+        args->syscalls++;
+        ssize_t n = recv(sock, buffer + buffered, bufferSize - buffered, 0);
+        if (n <= 0) {
+            fprintf(stderr, "Server closed the connection\n");
+            break;
+        }
+        args->bytes += n;
+        buffered += n;
+
+        size_t pos = 0;
+        while (buffered - pos >= FRAME_HEADER_SIZE) {
+            FrameHeader header;
+            decodeFrameHeader(buffer + pos, &header);
+            if (buffered - pos < FRAME_HEADER_SIZE + header.length) {
+                break;
+            }
+            if (header.opcode != STATUS_OK || header.requestId != expectedId++) {
+                fprintf(stderr, "Unexpected response (status %d, id %u)\n", header.opcode, header.requestId);
+                goto done;
+            }
+            pos += FRAME_HEADER_SIZE + header.length;
+            args->completed += header.length;
+            received++;
+        }
+        memmove(buffer, buffer + pos, buffered - pos);
+        buffered -= pos;
+    }
+
+done:
+    free(frames);
+    free(buffer);
+    close(sock);
+}
+
+// Opens connections back to back. SO_LINGER with a zero timeout makes close()
+// send a RST, so the client doesn't run out of ports to TIME_WAIT.
+void runConnect(BenchArgs* args) {
+    struct linger reset = {1, 0};
+
+    for (int i = 0; i < args->requests; i++) {
+        args->syscalls += 4;
+        int sock = connectToServer(&args->server_addr);
+        if (sock < 0) {
+            perror("Connection error");
+            break;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(sock);
+        args->completed++;
+    }
+}
+
+void* benchThread(void* arg) {
+    BenchArgs* args = (BenchArgs*)arg;
+    if (args->mode == MODE_CONNECT) {
+        runConnect(args);
+    } else if (args->mode == MODE_BINARY) {
+        runBinary(args);
+    } else {
+        runLegacy(args);
+    }
+    return NULL;
+}
+
+double runBench(BenchArgs* settings, int threads, const char* label) {
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+    BenchArgs* args = calloc(threads, sizeof(BenchArgs));
+
+    double start = nowSeconds();
+    for (int i = 0; i < threads; i++) {
+        args[i] = *settings;
+        args[i].id = i;
+        pthread_create(&ids[i], NULL, benchThread, &args[i]);
+    }
+
+    long completed = 0, syscalls = 0, bytes = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        completed += args[i].completed;
+        syscalls += args[i].syscalls;
+        bytes += args[i].bytes;
+    }
+    double elapsed = nowSeconds() - start;
+
+    double rate = completed / elapsed;
+    if (settings->mode == MODE_CONNECT) {
+        printf("%-24s %12.0f connections/sec\n", label, rate);
+    } else {
+        printf("%-24s %12.0f lookups/sec %8.3f syscalls/lookup %8.2f bytes/lookup\n", label, rate,
+               completed ? (double)syscalls / completed : 0.0, completed ? (double)bytes / completed : 0.0);
+    }
+
+    free(ids);
+    free(args);
+    return rate;
+}
+
+int main(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"batch", required_argument, NULL, 'b'},
+        {"pipeline", required_argument, NULL, 'd'},
+        {"connect-rate", no_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+
+    BenchArgs settings;
+    int connectRate = 0;
+    memset(&settings, 0, sizeof(settings));
+    settings.batch = 64;
+    settings.pipeline = 16;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:d:c", options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                settings.batch = atoi(optarg);
+                break;
+            case 'd':
+                settings.pipeline = atoi(optarg);
+                break;
+            case 'c':
+                connectRate = 1;
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    const char* server_ip = optind < argc ? argv[optind] : "127.0.0.1";
+    int port = optind + 1 < argc ? atoi(argv[optind + 1]) : 1234;
+    int threads = optind + 2 < argc ? atoi(argv[optind + 2]) : 4;
+    settings.requests = optind + 3 < argc ? atoi(argv[optind + 3]) : 5000;
+    if (settings.batch < 1 || settings.pipeline < 1 || settings.batch * sizeof(int32_t) > MAX_FRAME_PAYLOAD) {
+        fprintf(stderr, "Invalid --batch or --pipeline\n");
+        return 1;
+    }
+
+    settings.server_addr.sin_family = AF_INET;
+    settings.server_addr.sin_addr.s_addr = inet_addr(server_ip);
+    settings.server_addr.sin_port = htons(port);
+
+    if (connectRate) {
+        printf("%d threads x %d connections against %s:%d\n", threads, settings.requests, server_ip, port);
+        settings.mode = MODE_CONNECT;
+        runBench(&settings, threads, "Connection rate:");
+        return 0;
+    }
+
+    printf("%d threads x %d lookups against %s:%d\n", threads, settings.requests, server_ip, port);
+
+    settings.mode = MODE_REUSE;
+    double reuse = runBench(&settings, threads, "Connection reuse:");
+
+    settings.mode = MODE_RECONNECT;
+    double reconnect = runBench(&settings, threads, "Reconnect per request:");
+
+    char label[64];
+    snprintf(label, sizeof(label), "Binary %dx%d pipelined:", settings.batch, settings.pipeline);
+    settings.mode = MODE_BINARY;
+    settings.requests *= 10; // Fast enough that the legacy count would finish instantly
+    double binary = runBench(&settings, threads, label);
+
+    if (reconnect > 0 && reuse > 0) {
+        printf("Speedup from reuse: %.1fx, from binary batching: %.1fx\n", reuse / reconnect, binary / reuse);
+    }
+    return 0;
+}
@@ -1,14 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "nodeArena.h"
+
 typedef struct Node {
     int data;
     struct Node* left;
     struct Node* right;
 } Node;
 
+NodeArena nodeArena;
+
 Node* createNode(int data) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
+    Node* newNode = (Node*)arenaAlloc(&nodeArena);
     newNode->data = data;
     newNode->left = NULL;
     newNode->right = NULL;
@@ -52,6 +56,7 @@ void inOrderTraversal(Node* root) {
 int main() {
     Node* root = NULL;
     int option, target;
+    arenaInit(&nodeArena, sizeof(Node));
 
     printf("Binary Search Tree Operations:\n");
     printf("1. Insert a node\n");
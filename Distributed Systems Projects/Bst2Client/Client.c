@@ -4,19 +4,41 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#include "bstProtocol.h"
+
 // Client request codes
 #define SEARCH_TARGET 1
 #define ADD_NODE 2
 #define REMOVE_NODE 3
+#define LIST_RANGE 4
+#define RANK_OF_KEY 5
+#define KEY_AT_RANK 6
+#define COUNT_RANGE 7
+#define WAIT_FOR_KEY 8
 
 // Server address and port
 #define SERVER_IP "192.168.237.109"
 #define SERVER_PORT 1234
 
+// Reads exactly len bytes; returns 0 once the server has closed the connection
+int recvAll(int socket, void* buffer, size_t len) {
+    char* p = (char*)buffer;
+    while (len > 0) {
+        ssize_t n = recv(socket, p, len, 0);
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
 int main() {
     int client_socket;
     struct sockaddr_in server_addr;
     int option, target;
+    uint32_t requestId = 0;
 
     // Create socket
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -44,28 +66,195 @@ int main() {
         printf("1. Search for target\n");
         printf("2. Add a node\n");
         printf("3. Remove a node\n");
-        printf("4. Exit\n");
-        printf("Enter your choice (1/2/3/4): ");
+        printf("4. List the keys in a range\n");
+        printf("5. Rank of a key\n");
+        printf("6. Key at a rank\n");
+        printf("7. Count the keys in a range\n");
+        printf("8. Wait until a key is added\n");
+        printf("9. Exit\n");
+        printf("Enter your choice (1-9): ");
         scanf("%d", &option);
 
         if (option == SEARCH_TARGET || option == ADD_NODE || option == REMOVE_NODE) {
             printf("Enter the target value: ");
             scanf("%d", &target);
 
-            // Send the option and target value to the server
-            send(client_socket, &option, sizeof(option), 0);
-            send(client_socket, &target, sizeof(target), 0);
+            // Send the request as one binary frame carrying a single key
+            unsigned char request[FRAME_HEADER_SIZE + sizeof(int32_t)];
+            encodeFrameHeader(request, option, 0, ++requestId, sizeof(int32_t));
+            putInt32(request + FRAME_HEADER_SIZE, target);
+            if (send(client_socket, request, sizeof(request), 0) != sizeof(request)) {
+                perror("Send error");
+                break;
+            }
+
+            // Wait for the server's response: a header plus one status byte
+            unsigned char response[FRAME_HEADER_SIZE + 1];
+            FrameHeader header;
+            if (!recvAll(client_socket, response, FRAME_HEADER_SIZE)) {
+                printf("Server closed the connection.\n");
+                break;
+            }
+            decodeFrameHeader(response, &header);
+            if (header.length > 1 || !recvAll(client_socket, response + FRAME_HEADER_SIZE, header.length)) {
+                printf("Malformed response from server.\n");
+                break;
+            }
+            if (header.opcode != STATUS_OK || header.length != 1) {
+                printf("Server response: error %d\n", header.opcode);
+                continue;
+            }
+
+            int success = response[FRAME_HEADER_SIZE];
+            if (option == SEARCH_TARGET) {
+                printf("Server response: %d %s\n", target, success ? "found" : "not found");
+            } else if (option == ADD_NODE) {
+                printf("Server response: %d %s\n", target, success ? "added" : "already in the tree");
+            } else {
+                printf("Server response: %d %s\n", target, success ? "removed" : "not found");
+            }
+        } else if (option == LIST_RANGE) {
+            int lo, hi;
+            printf("Enter the lowest and highest key: ");
+            scanf("%d %d", &lo, &hi);
+
+            unsigned char request[FRAME_HEADER_SIZE + 3 * sizeof(int32_t)];
+            encodeFrameHeader(request, OP_RANGE, 0, ++requestId, 3 * sizeof(int32_t));
+            putInt32(request + FRAME_HEADER_SIZE, lo);
+            putInt32(request + FRAME_HEADER_SIZE + 4, hi);
+            putUint32(request + FRAME_HEADER_SIZE + 8, 0);
+            if (send(client_socket, request, sizeof(request), 0) != sizeof(request)) {
+                perror("Send error");
+                break;
+            }
+
+            // The keys arrive in order over one or more frames
+            unsigned char keys[RANGE_CHUNK_KEYS * sizeof(int32_t)];
+            FrameHeader header;
+            int total = 0, ok = 1;
+            printf("Server response:");
+            do {
+                unsigned char buffer[FRAME_HEADER_SIZE];
+                if (!recvAll(client_socket, buffer, FRAME_HEADER_SIZE)) {
+                    ok = 0;
+                    break;
+                }
+                decodeFrameHeader(buffer, &header);
+                if (header.length > sizeof(keys) || !recvAll(client_socket, keys, header.length)) {
+                    ok = 0;
+                    break;
+                }
+                if (header.opcode != STATUS_OK) {
+                    printf(" error %d", header.opcode);
+                    break;
+                }
+                for (uint32_t i = 0; i < header.length / sizeof(int32_t); i++) {
+                    printf(" %d", getInt32(keys + i * sizeof(int32_t)));
+                    total++;
+                }
+            } while (header.flags & FLAG_MORE);
+            if (!ok) {
+                printf("\nMalformed response from server.\n");
+                break;
+            }
+            printf("\n%d key(s) in [%d, %d]\n", total, lo, hi);
+        } else if (option == RANK_OF_KEY || option == KEY_AT_RANK || option == COUNT_RANGE) {
+            // One value in (two for a range), one u32 back (SELECT adds the key count first)
+            int values[2];
+            int count = option == COUNT_RANGE ? 2 : 1;
+            if (option == RANK_OF_KEY) {
+                printf("Enter the key: ");
+            } else if (option == KEY_AT_RANK) {
+                printf("Enter the rank (0: the smallest key): ");
+            } else {
+                printf("Enter the lowest and highest key: ");
+            }
+            for (int i = 0; i < count; i++) {
+                scanf("%d", &values[i]);
+            }
+
+            uint8_t opcode = option == RANK_OF_KEY ? OP_RANK : option == KEY_AT_RANK ? OP_SELECT : OP_COUNT_RANGE;
+            unsigned char request[FRAME_HEADER_SIZE + 2 * sizeof(int32_t)];
+            encodeFrameHeader(request, opcode, 0, ++requestId, count * sizeof(int32_t));
+            for (int i = 0; i < count; i++) {
+                putInt32(request + FRAME_HEADER_SIZE + i * sizeof(int32_t), values[i]);
+            }
+            size_t requestLen = FRAME_HEADER_SIZE + count * sizeof(int32_t);
+            if (send(client_socket, request, requestLen, 0) != (ssize_t)requestLen) {
+                perror("Send error");
+                break;
+            }
+
+            unsigned char response[FRAME_HEADER_SIZE + 2 * sizeof(int32_t)];
+            FrameHeader header;
+            if (!recvAll(client_socket, response, FRAME_HEADER_SIZE)) {
+                printf("Server closed the connection.\n");
+                break;
+            }
+            decodeFrameHeader(response, &header);
+            if (header.length > 2 * sizeof(int32_t) ||
+                !recvAll(client_socket, response + FRAME_HEADER_SIZE, header.length)) {
+                printf("Malformed response from server.\n");
+                break;
+            }
+            uint32_t expected = opcode == OP_SELECT ? 2 * sizeof(int32_t) : sizeof(int32_t);
+            if (header.opcode != STATUS_OK || header.length != expected) {
+                printf("Server response: error %d\n", header.opcode);
+                continue;
+            }
+
+            const unsigned char* payload = response + FRAME_HEADER_SIZE;
+            if (option == RANK_OF_KEY) {
+                printf("Server response: %u key(s) below %d\n", getUint32(payload), values[0]);
+            } else if (option == KEY_AT_RANK) {
+                uint32_t total = getUint32(payload);
+                if ((uint32_t)values[0] < total) {
+                    printf("Server response: key %d has rank %d of %u\n", getInt32(payload + 4), values[0], total);
+                } else {
+                    printf("Server response: only %u key(s) in the tree\n", total);
+                }
+            } else {
+                printf("Server response: %u key(s) in [%d, %d]\n", getUint32(payload), values[0], values[1]);
+            }
+        } else if (option == WAIT_FOR_KEY) {
+            int key, seconds;
+            printf("Enter the key and the longest wait in seconds: ");
+            scanf("%d %d", &key, &seconds);
+
+            unsigned char request[FRAME_HEADER_SIZE + 2 * sizeof(int32_t)];
+            encodeFrameHeader(request, OP_WAIT, 0, ++requestId, 2 * sizeof(int32_t));
+            putInt32(request + FRAME_HEADER_SIZE, key);
+            putUint32(request + FRAME_HEADER_SIZE + 4, seconds < 0 ? WAIT_FOREVER : (uint32_t)seconds * 1000);
+            if (send(client_socket, request, sizeof(request), 0) != sizeof(request)) {
+                perror("Send error");
+                break;
+            }
 
-            // Wait for the server's response
-            char buffer[1024];
-            recv(client_socket, buffer, sizeof(buffer), 0);
-            printf("Server response: %s\n", buffer);
-        } else if (option == 4) {
+            // Nothing comes back until the key shows up or the time runs out
+            unsigned char response[FRAME_HEADER_SIZE + 1];
+            FrameHeader header;
+            if (!recvAll(client_socket, response, FRAME_HEADER_SIZE)) {
+                printf("Server closed the connection.\n");
+                break;
+            }
+            decodeFrameHeader(response, &header);
+            if (header.length > 1 || !recvAll(client_socket, response + FRAME_HEADER_SIZE, header.length)) {
+                printf("Malformed response from server.\n");
+                break;
+            }
+            if (header.opcode == STATUS_SHUTTING_DOWN) {
+                printf("Server response: shutting down\n");
+            } else if (header.opcode != STATUS_OK || header.length != 1) {
+                printf("Server response: error %d\n", header.opcode);
+            } else {
+                printf("Server response: %d %s\n", key, response[FRAME_HEADER_SIZE] ? "is in the tree" : "did not show up in time");
+            }
+        } else if (option == 9) {
             // Exit the client
             printf("Exiting...\n");
             break;
         } else {
-            printf("Invalid option. Please enter a valid option (1/2/3/4).\n");
+            printf("Invalid option. Please enter a valid option (1-9).\n");
         }
     }
 
@@ -0,0 +1,696 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "bstProtocol.h"
+#include "avlTree.h"
+#include "optimisticAvl.h"
+#include "bplusTree.h"
+#include "eytzinger.h"
+#include "bloomFilter.h"
+
+// Microbenchmark for the indexes behind Server.c. It runs them in-process,
+// one after the other, on the same random keys, so the numbers compare the
+// structures themselves rather than the network (BenchClient.c measures
+// the server end to end). Each lookup and write takes treeLock the way the
+// server's request paths do, so locking is part of the cost.
+//
+// Usage: ./indexBench [keys] [--helper-threads N]
+
+#define INDEX_AVL 0
+#define INDEX_OAVL 1
+#define INDEX_BTREE 2
+#define INDEX_FROZEN 3 // The AVL tree with lookups served by an Eytzinger array
+
+OAvlTree optimisticTree;
+BPlusTree bplusTree;
+EytzingerSet* frozenKeys = NULL;
+int benchIndex = INDEX_AVL;
+
+long long nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+uint32_t nextRandom(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+int compareInts(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int compareLongLongs(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// The index operations of Server.c for benchIndex, minus the write-ahead
+// log, the Bloom filter and the wait table
+int indexSearch(int key) {
+    if (benchIndex == INDEX_OAVL) {
+        return oavlSearch(&optimisticTree, key);
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    int found;
+    if (benchIndex == INDEX_FROZEN) {
+        found = eytContains(frozenKeys, key);
+    } else if (benchIndex == INDEX_BTREE) {
+        found = bptSearch(&bplusTree, key);
+    } else {
+        found = searchNode(sharedRoot, key) != NULL;
+    }
+    pthread_rwlock_unlock(&treeLock);
+    return found;
+}
+
+void indexSearchMany(const int* keys, int n, unsigned char* results) {
+    if (benchIndex == INDEX_OAVL) {
+        for (int i = 0; i < n; i++) {
+            results[i] = oavlSearch(&optimisticTree, keys[i]);
+        }
+        return;
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    if (benchIndex == INDEX_FROZEN) {
+        eytContainsMany(frozenKeys, keys, n, results);
+    } else if (benchIndex == INDEX_BTREE) {
+        bptSearchMany(&bplusTree, keys, n, results);
+    } else {
+        searchNodeMany(sharedRoot, keys, n, results);
+    }
+    pthread_rwlock_unlock(&treeLock);
+}
+
+// Writes probe under the read lock first, as the server's do
+int indexInsert(int key) {
+    if (benchIndex == INDEX_OAVL) {
+        return oavlInsert(&optimisticTree, key);
+    }
+    if (indexSearch(key)) {
+        return 0;
+    }
+    pthread_rwlock_wrlock(&treeLock);
+    int inserted;
+    if (benchIndex == INDEX_BTREE) {
+        inserted = bptInsert(&bplusTree, key);
+    } else {
+        inserted = searchNode(sharedRoot, key) == NULL;
+        if (inserted) {
+            lockedAvlAdd(key);
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+    return inserted;
+}
+
+int indexRemove(int key) {
+    if (benchIndex == INDEX_OAVL) {
+        return oavlRemove(&optimisticTree, key);
+    }
+    pthread_rwlock_wrlock(&treeLock);
+    int removed;
+    if (benchIndex == INDEX_BTREE) {
+        removed = bptRemove(&bplusTree, key);
+    } else {
+        removed = searchNode(sharedRoot, key) != NULL;
+        if (removed) {
+            lockedAvlDelete(key);
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+    return removed;
+}
+
+// One chunk of a scan, under the read lock for that chunk only
+int indexRange(int lo, int hi, int* keys, int max) {
+    if (benchIndex == INDEX_OAVL) {
+        return oavlRange(&optimisticTree, lo, hi, keys, max);
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    int n;
+    if (benchIndex == INDEX_BTREE) {
+        n = bptRange(&bplusTree, lo, hi, keys, max);
+    } else {
+        n = 0;
+        TreeIterator it;
+        iteratorSeek(&it, sharedRoot, lo);
+        Node* node;
+        while (n < max && (node = iteratorNext(&it)) != NULL && node->data <= hi) {
+            keys[n++] = node->data;
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+    return n;
+}
+
+void storeKey(void* ctx, int key, uint32_t rank) {
+    ((int*)ctx)[rank] = key;
+}
+
+// Freezes the AVL tree's keys into an Eytzinger array, as Server.c's
+// --frozen does after its rebuild threshold
+double freezeKeys() {
+    long long start = nowNanos();
+    size_t count = getSize(sharedRoot);
+    int* sorted = (int*)malloc((count ? count : 1) * sizeof(int));
+    if (sorted == NULL) {
+        return -1;
+    }
+    treeForEachParallel(sharedRoot, storeKey, sorted);
+    frozenKeys = eytBuild(sorted, count);
+    free(sorted);
+    return frozenKeys != NULL ? (nowNanos() - start) / 1e6 : -1;
+}
+
+// Inserts, lookups one by one and in SEARCH-sized batches, a full chunked
+// scan and removes on every index in turn, keys in random order
+void benchOperations(const int* keys, int keyCount) {
+    const char* names[] = {"avl", "oavl", "btree", "frozen"};
+    int chunk[RANGE_CHUNK_KEYS];
+    unsigned char results[RANGE_CHUNK_KEYS];
+
+    printf("%d keys, ns per operation (scan: per key)\n", keyCount);
+    printf("%-6s %10s %10s %10s %10s %10s\n", "index", "insert", "search", "batched", "scan", "remove");
+    double buildMs = 0;
+    for (int index = INDEX_AVL; index <= INDEX_FROZEN; index++) {
+        // The frozen row inserts into the AVL tree and builds the array
+        // after the inserts (the build itself is not timed)
+        benchIndex = index == INDEX_FROZEN ? INDEX_AVL : index;
+        long long start = nowNanos();
+        for (int i = 0; i < keyCount; i++) {
+            indexInsert(keys[i]);
+        }
+        long long inserted = nowNanos();
+        if (index == INDEX_FROZEN) {
+            buildMs = freezeKeys();
+            benchIndex = INDEX_FROZEN;
+            inserted = nowNanos();
+        }
+        long found = 0;
+        for (int i = keyCount - 1; i >= 0; i--) {
+            found += indexSearch(keys[i]);
+        }
+        long long searched = nowNanos();
+        long batchFound = 0;
+        for (int i = 0; i < keyCount; i += RANGE_CHUNK_KEYS) {
+            int n = keyCount - i < RANGE_CHUNK_KEYS ? keyCount - i : RANGE_CHUNK_KEYS;
+            indexSearchMany(keys + i, n, results);
+            for (int j = 0; j < n; j++) {
+                batchFound += results[j];
+            }
+        }
+        long long batched = nowNanos();
+        long scanned = 0;
+        long long from = INT_MIN;
+        int n;
+        while (from <= INT_MAX && (n = indexRange((int)from, INT_MAX, chunk, RANGE_CHUNK_KEYS)) > 0) {
+            scanned += n;
+            from = (long long)chunk[n - 1] + 1;
+        }
+        long long scanEnd = nowNanos();
+        for (int i = 0; i < keyCount; i++) {
+            indexRemove(keys[i]);
+        }
+        long long removed = nowNanos();
+
+        if (found != scanned || batchFound != keyCount) {
+            printf("%s: %ld key(s) found, %ld in batches, %ld scanned\n", names[index], found, batchFound, scanned);
+        }
+        printf("%-6s %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[index], (double)(inserted - start) / keyCount,
+               (double)(searched - inserted) / keyCount, (double)(batched - searched) / keyCount,
+               scanned ? (double)(scanEnd - batched) / scanned : 0.0, (double)(removed - scanEnd) / keyCount);
+    }
+    printf("Frozen lookup array built in %.1f ms.\n", buildMs);
+    eytFree(frozenKeys);
+    frozenKeys = NULL;
+    benchIndex = INDEX_AVL;
+}
+
+// Loading the AVL tree: the keys as INSERT frames of RANGE_CHUNK_KEYS keys,
+// then sorted and built in one go. Leaves the sorted keys in keys and the
+// tree holding them; returns how many there are.
+int benchLoad(int* keys, int keyCount) {
+    unsigned char results[RANGE_CHUNK_KEYS];
+    long long start = nowNanos();
+    for (int i = 0; i < keyCount; i += RANGE_CHUNK_KEYS) {
+        int n = keyCount - i < RANGE_CHUNK_KEYS ? keyCount - i : RANGE_CHUNK_KEYS;
+        pthread_rwlock_wrlock(&treeLock);
+        insertBatch(keys + i, n, results);
+        pthread_rwlock_unlock(&treeLock);
+    }
+    long long framed = nowNanos();
+    pthread_rwlock_wrlock(&treeLock);
+    freeTree(sharedRoot);
+    sharedRoot = NULL;
+    pthread_rwlock_unlock(&treeLock);
+    qsort(keys, keyCount, sizeof(int), compareInts);
+    int unique = 0;
+    for (int i = 0; i < keyCount; i++) {
+        if (unique == 0 || keys[unique - 1] != keys[i]) {
+            keys[unique++] = keys[i];
+        }
+    }
+    long long sorted = nowNanos();
+    sharedRoot = bulkLoad(keys, unique);
+    long long loaded = nowNanos();
+    printf("AVL load: %.1f ns per key in INSERT frames, %.1f ns per key bulk loaded\n",
+           (double)(framed - start) / keyCount, (double)(loaded - sorted) / unique);
+    return unique;
+}
+
+// Lookups of neighbours of the loaded keys, nearly all misses, without and
+// with a Bloom filter in front
+void benchMisses(const int* keys, int unique) {
+    BloomFilter bloom;
+    if (bloomInit(&bloom, unique) < 0) {
+        return;
+    }
+    for (int i = 0; i < unique; i++) {
+        bloomAdd(&bloom, keys[i]);
+    }
+    long hits = 0;
+    long long missStart = nowNanos();
+    for (int i = 0; i < unique; i++) {
+        hits += indexSearch(keys[i] ^ 1);
+    }
+    long long missed = nowNanos();
+    long rejected = 0, falsePositives = 0;
+    for (int i = 0; i < unique; i++) {
+        pthread_rwlock_rdlock(&treeLock);
+        if (!bloomMayContain(&bloom, keys[i] ^ 1)) {
+            rejected++;
+        } else if (searchNode(sharedRoot, keys[i] ^ 1) != NULL) {
+            hits--;
+        } else {
+            falsePositives++;
+        }
+        pthread_rwlock_unlock(&treeLock);
+    }
+    long long filtered = nowNanos();
+    printf("AVL misses: %.1f ns per lookup, %.1f with a %zu KB Bloom filter (%.2f%% false positives, "
+           "%.2f%% expected)%s\n",
+           (double)(missed - missStart) / unique, (double)(filtered - missed) / unique, bloomBytes(&bloom) / 1024,
+           100.0 * falsePositives / (rejected + falsePositives), 100 * bloomExpectedFpr(&bloom),
+           hits != 0 ? ", RESULTS DIFFER" : "");
+    bloomFree(&bloom);
+}
+
+// Set operations between the loaded tree and a delta a fifth its size,
+// half keys it holds and half new ones, against the same changes made key
+// by key
+void benchSetOperations(const int* keys, int unique) {
+    int* delta = (int*)malloc((unique / 5 + 2) * sizeof(int));
+    if (delta == NULL) {
+        return;
+    }
+    int deltaCount = 0;
+    for (int i = 0; i < unique; i += 10) {
+        delta[deltaCount++] = keys[i];
+        if (i + 1 < unique && keys[i] + 1 < keys[i + 1]) {
+            delta[deltaCount++] = keys[i] + 1;
+        }
+    }
+    long long setStart = nowNanos();
+    sharedRoot = unionTrees(sharedRoot, bulkLoad(delta, deltaCount));
+    long long unioned = nowNanos();
+    sharedRoot = differenceTrees(sharedRoot, bulkLoad(delta, deltaCount));
+    long long differenced = nowNanos();
+    for (int i = 0; i < deltaCount; i++) {
+        indexInsert(delta[i]);
+    }
+    long long added = nowNanos();
+    for (int i = 0; i < deltaCount; i++) {
+        indexRemove(delta[i]);
+    }
+    long long subtracted = nowNanos();
+    sharedRoot = intersectTrees(sharedRoot, bulkLoad(keys, unique));
+    long long intersected = nowNanos();
+    printf("AVL with a %d-key delta: union %.1f ms (%.1f key by key), difference %.1f ms (%.1f key by key), "
+           "intersection with the loaded keys %.1f ms\n",
+           deltaCount, (unioned - setStart) / 1e6, (added - differenced) / 1e6, (differenced - unioned) / 1e6,
+           (subtracted - added) / 1e6, (intersected - subtracted) / 1e6);
+    free(delta);
+}
+
+// Insert latency with the rotations on the write path and with them left
+// to the rebalancer thread (--relaxed): fresh random keys, then as many
+// ascending ones, a burst that keeps unbalancing the right spine
+void benchRelaxed(int keyCount, long long* latency, uint32_t* state) {
+    pthread_rwlock_wrlock(&treeLock);
+    freeTree(sharedRoot);
+    sharedRoot = NULL;
+    pthread_rwlock_unlock(&treeLock);
+    for (int relaxed = 0; relaxed <= 1; relaxed++) {
+        relaxedBalance = relaxed;
+        for (int ascending = 0; ascending <= 1; ascending++) {
+            long long burstStart = nowNanos();
+            for (int i = 0; i < keyCount; i++) {
+                int key = ascending ? i : (int)nextRandom(state);
+                long long before = nowNanos();
+                indexInsert(key);
+                latency[i] = nowNanos() - before;
+            }
+            long long burstEnd = nowNanos();
+            qsort(latency, keyCount, sizeof(long long), compareLongLongs);
+            pthread_rwlock_wrlock(&treeLock);
+            printf("AVL %s, %s inserts: %.1f ns per key, p50 %lld ns, p99 %lld ns, max %.1f us, height %d\n",
+                   relaxed ? "relaxed" : "strict ", ascending ? "ascending" : "random   ",
+                   (double)(burstEnd - burstStart) / keyCount, latency[keyCount / 2],
+                   latency[(long)keyCount * 99 / 100], latency[keyCount - 1] / 1000.0, getHeight(sharedRoot));
+            freeTree(sharedRoot);
+            sharedRoot = NULL;
+            pthread_rwlock_unlock(&treeLock);
+        }
+    }
+    relaxedBalance = 0;
+}
+
+#define BURST_WRITERS 4
+#define BURST_KEYS 64         // Inserts per burst
+#define BURST_GAP_MICROS 1000 // Pause between a writer's bursts
+
+typedef struct BenchWriter {
+    uint32_t state;
+    int bursts;
+    long long* latency;
+} BenchWriter;
+
+// Inserts fresh random keys in bursts, resting between them
+void* benchWriterThread(void* arg) {
+    BenchWriter* writer = (BenchWriter*)arg;
+    long done = 0;
+    for (int burst = 0; burst < writer->bursts; burst++) {
+        for (int i = 0; i < BURST_KEYS; i++) {
+            int key = (int)nextRandom(&writer->state);
+            long long before = nowNanos();
+            indexInsert(key);
+            writer->latency[done++] = nowNanos() - before;
+        }
+        usleep(BURST_GAP_MICROS);
+    }
+    return NULL;
+}
+
+// Insert latency, lock waits included, for BURST_WRITERS threads writing
+// in bursts into the loaded tree, strict and then relaxed: the load
+// relaxed balance is meant for, where the rebalancer catches up in the
+// gaps between bursts
+void benchBurstyWriters(const int* keys, int unique, int writes) {
+    int bursts = writes / (BURST_WRITERS * BURST_KEYS) > 0 ? writes / (BURST_WRITERS * BURST_KEYS) : 1;
+    long perWriter = (long)bursts * BURST_KEYS;
+    long total = perWriter * BURST_WRITERS;
+    long long* latency = (long long*)malloc(total * sizeof(long long));
+    if (latency == NULL) {
+        perror("Benchmark allocation error");
+        return;
+    }
+    for (int relaxed = 0; relaxed <= 1; relaxed++) {
+        pthread_rwlock_wrlock(&treeLock);
+        relaxedBalance = relaxed;
+        sharedRoot = bulkLoad(keys, unique);
+        long fixedBefore = relaxedFixed;
+        long forcedBefore = relaxedForced;
+        pthread_rwlock_unlock(&treeLock);
+
+        BenchWriter writers[BURST_WRITERS];
+        pthread_t threads[BURST_WRITERS];
+        int started = 0;
+        long long burstStart = nowNanos();
+        for (; started < BURST_WRITERS; started++) {
+            writers[started].state = 2463534242u + started * 7919u;
+            writers[started].bursts = bursts;
+            writers[started].latency = latency + started * perWriter;
+            if (pthread_create(&threads[started], NULL, benchWriterThread, &writers[started]) != 0) {
+                break;
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        long long burstEnd = nowNanos();
+        long measured = perWriter * started;
+        if (measured == 0) {
+            perror("Thread creation error");
+            break;
+        }
+        int pending = 1;
+        while (pending) {
+            pthread_rwlock_rdlock(&treeLock);
+            pending = isPending(sharedRoot);
+            pthread_rwlock_unlock(&treeLock);
+            if (pending) {
+                usleep(1000);
+            }
+        }
+
+        qsort(latency, measured, sizeof(long long), compareLongLongs);
+        pthread_rwlock_wrlock(&treeLock);
+        printf("AVL %s, %d writers in bursts of %d: %.1f ms, p50 %lld ns, p99 %lld ns, p99.9 %lld ns, "
+               "max %.1f us, %ld node(s) rebalanced, %ld write(s) over the limit, height %d\n",
+               relaxed ? "relaxed" : "strict ", started, BURST_KEYS, (burstEnd - burstStart) / 1e6,
+               latency[measured / 2], latency[measured * 99 / 100], latency[measured * 999 / 1000],
+               latency[measured - 1] / 1000.0, relaxedFixed - fixedBefore, relaxedForced - forcedBefore,
+               getHeight(sharedRoot));
+        freeTree(sharedRoot);
+        sharedRoot = NULL;
+        relaxedBalance = 0;
+        pthread_rwlock_unlock(&treeLock);
+    }
+    free(latency);
+}
+
+typedef struct BenchScan {
+    int snapshots;
+    _Atomic int stop;
+    long passes;
+} BenchScan;
+
+// Walks every key of the AVL tree over and over until told to stop,
+// pausing after each chunk like a scan streamed to a client that reads it
+// as it goes
+void* benchScanThread(void* arg) {
+    BenchScan* scan = (BenchScan*)arg;
+    long long sum = 0;
+    while (!atomic_load(&scan->stop)) {
+        TreeSnapshot* snapshot = NULL;
+        if (scan->snapshots) {
+            snapshot = openTreeSnapshot();
+        } else {
+            pthread_rwlock_rdlock(&treeLock);
+        }
+        TreeIterator it;
+        iteratorSeek(&it, snapshot != NULL ? snapshot->root : sharedRoot, INT_MIN);
+        Node* node;
+        long seen = 0;
+        while ((node = iteratorNext(&it)) != NULL) {
+            sum += node->data;
+            if (++seen % RANGE_CHUNK_KEYS == 0) {
+                usleep(50);
+            }
+        }
+        if (scan->snapshots) {
+            closeTreeSnapshot(snapshot);
+        } else {
+            pthread_rwlock_unlock(&treeLock);
+        }
+        scan->passes++;
+    }
+    return (void*)(intptr_t)sum;
+}
+
+// Write latency while another thread keeps scanning the whole tree, first
+// holding the read lock for each pass (the only way to a consistent scan
+// without snapshots), then from a snapshot per pass
+void benchSnapshots(const int* keys, int unique, int writes, long long* latency, uint32_t* state) {
+    for (int snapshots = 0; snapshots <= 1; snapshots++) {
+        pthread_rwlock_wrlock(&treeLock);
+        sharedRoot = bulkLoad(keys, unique);
+        pthread_rwlock_unlock(&treeLock);
+        BenchScan scan = {snapshots, 0, 0};
+        pthread_t scanner;
+        if (pthread_create(&scanner, NULL, benchScanThread, &scan) != 0) {
+            return;
+        }
+        long long burstStart = nowNanos();
+        for (int i = 0; i < writes; i++) {
+            int key = (int)nextRandom(state);
+            long long before = nowNanos();
+            if (indexInsert(key)) {
+                indexRemove(key);
+            }
+            latency[i] = nowNanos() - before;
+        }
+        long long burstEnd = nowNanos();
+        atomic_store(&scan.stop, 1);
+        pthread_join(scanner, NULL);
+        qsort(latency, writes, sizeof(long long), compareLongLongs);
+        pthread_rwlock_wrlock(&treeLock);
+        printf("AVL writes during %s scans: %.1f ns per write, p50 %lld ns, p99 %lld ns, max %.1f us, "
+               "%ld full scan(s), %ld node(s) copied\n",
+               snapshots ? "snapshot" : "locked  ", (double)(burstEnd - burstStart) / writes, latency[writes / 2],
+               latency[(long)writes * 99 / 100], latency[writes - 1] / 1000.0, scan.passes, versionsCopied);
+        while (retiredCount > 0) {
+            reclaimVersions();
+        }
+        freeTree(sharedRoot);
+        sharedRoot = NULL;
+        pthread_rwlock_unlock(&treeLock);
+    }
+}
+
+// Reductions for the walks: a sum, and a histogram of the top 8 bits
+#define BENCH_BUCKETS 256
+
+void sumInit(void* ctx, void* acc) {
+    (void)ctx;
+    *(long long*)acc = 0;
+}
+
+void sumMap(void* ctx, void* acc, int key) {
+    (void)ctx;
+    *(long long*)acc += key;
+}
+
+void sumCombine(void* ctx, void* into, const void* from) {
+    (void)ctx;
+    *(long long*)into += *(const long long*)from;
+}
+
+void histogramInit(void* ctx, void* acc) {
+    (void)ctx;
+    memset(acc, 0, BENCH_BUCKETS * sizeof(long));
+}
+
+void histogramMap(void* ctx, void* acc, int key) {
+    (void)ctx;
+    ((long*)acc)[(uint32_t)key >> 24]++;
+}
+
+void histogramCombine(void* ctx, void* into, const void* from) {
+    (void)ctx;
+    for (int i = 0; i < BENCH_BUCKETS; i++) {
+        ((long*)into)[i] += ((const long*)from)[i];
+    }
+}
+
+// Whole-tree walks: one thread with an iterator, then cut into pieces for
+// the helper threads
+void benchWalks(const int* keys, int unique) {
+    pthread_rwlock_wrlock(&treeLock);
+    sharedRoot = bulkLoad(keys, unique);
+    pthread_rwlock_unlock(&treeLock);
+    int* exported = (int*)malloc(unique * sizeof(int));
+    long* histogram = (long*)calloc(2 * BENCH_BUCKETS, sizeof(long)); // Parallel, then serial counts
+    if (exported != NULL && histogram != NULL) {
+        TreeReducer sum = {sizeof(long long), sumInit, sumMap, sumCombine, NULL};
+        TreeReducer buckets = {BENCH_BUCKETS * sizeof(long), histogramInit, histogramMap, histogramCombine, NULL};
+        pthread_rwlock_rdlock(&treeLock);
+        long long walkStart = nowNanos();
+        long long serialSum = 0;
+        TreeIterator it;
+        iteratorSeek(&it, sharedRoot, INT_MIN);
+        Node* node;
+        while ((node = iteratorNext(&it)) != NULL) {
+            serialSum += node->data;
+            histogram[BENCH_BUCKETS + ((uint32_t)node->data >> 24)]++;
+        }
+        long long serialEnd = nowNanos();
+        long long parallelSum;
+        treeReduce(sharedRoot, &sum, &parallelSum);
+        long long summed = nowNanos();
+        treeReduce(sharedRoot, &buckets, histogram);
+        long long counted = nowNanos();
+        treeForEachParallel(sharedRoot, storeKey, exported);
+        long long exportEnd = nowNanos();
+        pthread_rwlock_unlock(&treeLock);
+
+        int same = parallelSum == serialSum && memcmp(exported, keys, unique * sizeof(int)) == 0;
+        for (int i = 0; i < BENCH_BUCKETS; i++) {
+            same &= histogram[i] == histogram[BENCH_BUCKETS + i];
+        }
+        printf("AVL walks over %d keys with %d helper thread(s): iterator (sum and histogram) %.1f ms, "
+               "treeReduce sum %.1f ms, histogram %.1f ms, treeForEachParallel export %.1f ms%s\n",
+               unique, helperPool.threads, (serialEnd - walkStart) / 1e6, (summed - serialEnd) / 1e6,
+               (counted - summed) / 1e6, (exportEnd - counted) / 1e6, same ? "" : " (results differ!)");
+    }
+    free(exported);
+    free(histogram);
+}
+
+int main(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"helper-threads", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int helperThreads = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "L:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'L':
+                helperThreads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [keys] [--helper-threads N]\n", argv[0]);
+                return 1;
+        }
+    }
+    int keyCount = optind < argc ? atoi(argv[optind]) : 1000000;
+    if (keyCount < 1) {
+        fprintf(stderr, "Invalid key count\n");
+        return 1;
+    }
+
+    avlTreeInit();
+    oavlTreeInit(&optimisticTree, NULL);
+    bptTreeInit(&bplusTree);
+    if (helperThreads > 0 && taskPoolInit(&helperPool, helperThreads) < 0) {
+        perror("Helper thread pool error");
+        return 1;
+    }
+    pthread_t rebalancer;
+    if (pthread_create(&rebalancer, NULL, rebalanceThread, NULL) != 0) {
+        perror("Thread creation error");
+        return 1;
+    }
+    pthread_detach(rebalancer);
+
+    int* keys = (int*)malloc(keyCount * sizeof(int));
+    long long* latency = (long long*)malloc(keyCount * sizeof(long long));
+    if (keys == NULL || latency == NULL) {
+        perror("Benchmark allocation error");
+        return 1;
+    }
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < keyCount; i++) {
+        keys[i] = (int)nextRandom(&state);
+    }
+
+    benchOperations(keys, keyCount);
+    int unique = benchLoad(keys, keyCount);
+    benchMisses(keys, unique);
+    benchSetOperations(keys, unique);
+    benchRelaxed(keyCount, latency, &state);
+    benchBurstyWriters(keys, unique, keyCount / 10);
+    benchSnapshots(keys, unique, keyCount / 10 > 0 ? keyCount / 10 : 1, latency, &state);
+    benchWalks(keys, unique);
+    free(keys);
+    free(latency);
+    return 0;
+}
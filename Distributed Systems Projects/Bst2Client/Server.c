@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -5,326 +6,2903 @@
 #include <pthread.h>
 #include <limits.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
-typedef struct Node {
-    _Atomic int data;
-    int height;
-    struct Node* left;
-    struct Node* right;
-} Node;
+#include "bstProtocol.h"
+#include "jobQueue.h"
+#include "uring.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "optimisticAvl.h"
+#include "bplusTree.h"
+#include "eytzinger.h"
+#include "taskPool.h"
+#include "bloomFilter.h"
+#include "waitTable.h"
+#include "nodeArena.h"
+#include "avlTree.h"
+
+// Client request codes (must match Client.c)
+#define SEARCH_TARGET 1
+#define ADD_NODE 2
+#define REMOVE_NODE 3
 
 // Function declarations
-int max(int a, int b);
-int getHeight(Node* node);
-Node* createNode(int data);
-Node* rightRotate(Node* y);
-Node* leftRotate(Node* x);
-int getBalance(Node* node);
-Node* insertNode(Node* root, int data);
-Node* findMinNode(Node* node);
-Node* removeNode(Node* root, int data);
-void inOrderTraversal(Node* root);
-
-typedef struct ClientThreadArgs {
-    int data;
-    Node* root;
-} ClientThreadArgs;
-
-void* searchThread(void* arg);
+int treeSearch(int data);
+int treeInsert(int data);
+int treeRemove(int data);
+void processRequest(int option, int target, char* response, size_t size);
 void* handleClient(void* client_socket_ptr);
-int getBSTHeight(Node* node);
+void* eventLoop(void* arg);
+long long nowNanos();
 
-// Function to get the height of the BST
-int getBSTHeight(Node* node) {
-    return (node == NULL) ? -1 : node->height;
+// Key i of a checkpoint, for buildBalanced
+int checkpointKeyAt(const void* source, uint64_t i) {
+    return snapshotKey((const Snapshot*)source, i);
 }
 
-int max(int a, int b) {
-    return (a > b) ? a : b;
+// Builds the optimistic index from checkpoint keys [lo, hi) the way
+// bulkLoad builds the AVL tree; its nodes also point at their parent and
+// count a leaf as height 1
+OAvlNode* buildOptimisticTree(const Snapshot* snapshot, uint64_t lo, uint64_t hi, OAvlNode* parent) {
+    if (lo >= hi) {
+        return NULL;
+    }
+    uint64_t mid = lo + (hi - lo) / 2;
+    OAvlNode* node = oavlNewNode(snapshotKey(snapshot, mid), 1, parent);
+    OAvlNode* left = buildOptimisticTree(snapshot, lo, mid, node);
+    OAvlNode* right = buildOptimisticTree(snapshot, mid + 1, hi, node);
+    atomic_store(&node->left, left);
+    atomic_store(&node->right, right);
+    atomic_store(&node->height, max(oavlHeight(left), oavlHeight(right)) + 1);
+    return node;
 }
 
-int getHeight(Node* node) {
-    return (node == NULL) ? -1 : node->height;
-}
+// Structure that holds the keys (--index): the AVL tree (avlTree.h) or
+// one of the alternatives below
+#define INDEX_AVL 0
+#define INDEX_OAVL 1
+#define INDEX_BTREE 2
 
-Node* createNode(int data) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
-    newNode->data = data;
-    newNode->left = newNode->right = NULL;
-    newNode->height = 0;
-    return newNode;
-}
+int treeIndex = INDEX_AVL;
 
-Node* rightRotate(Node* y) {
-    Node* x = y->left;
-    Node* T2 = x->right;
+// Alternative index (--index btree) kept under the same lock: a B+-tree
+// with cache-line sized nodes, searched a vector of keys at a time
+BPlusTree bplusTree;
 
-    x->right = y;
-    y->left = T2;
+// Alternative index (--index oavl) with no tree-wide lock: readers validate
+// node versions instead of locking, and writers lock only the nodes they
+// restructure. When it is selected sharedRoot and treeLock are unused.
+OAvlTree optimisticTree;
 
-    y->height = max(getHeight(y->left), getHeight(y->right)) + 1;
-    x->height = max(getHeight(x->left), getHeight(x->right)) + 1;
+// Read-optimized copy of the key set (--frozen N) for the indexes under
+// treeLock. Lookups search an immutable Eytzinger array instead of chasing
+// tree pointers, and two small B+-trees hold the keys whose membership has
+// changed since the array was built. Once N keys differ, a background
+// thread rebuilds the array. The tree stays the source of truth for
+// writes, ranges and checkpoints, and all of this is guarded by treeLock.
+EytzingerSet* frozenKeys = NULL;
+BPlusTree frozenAdded;      // In the tree but not in frozenKeys
+BPlusTree frozenRemoved;    // In frozenKeys but no longer in the tree
+long frozenThreshold = 0;   // 0: lookups go to the tree
+int frozenRequested = 0;    // frozenWanted has been posted
+int frozenRebuilding = 0;   // Changed keys are also collected in frozenChanged
+int* frozenChanged = NULL;
+size_t frozenChangedCount = 0;
+size_t frozenChangedCapacity = 0;
+sem_t frozenWanted;
+long frozenRebuilds = 0;
+double frozenLastBuildMs = 0;
 
-    return x;
+// Records that data is now present (or not) in the tree; call with
+// treeLock held for writing, after the tree itself has changed
+void frozenNoteChange(int data, int present) {
+    if (frozenRebuilding) {
+        if (frozenChangedCount == frozenChangedCapacity) {
+            frozenChangedCapacity = frozenChangedCapacity ? frozenChangedCapacity * 2 : 1024;
+            frozenChanged = (int*)realloc(frozenChanged, frozenChangedCapacity * sizeof(int));
+        }
+        frozenChanged[frozenChangedCount++] = data;
+    }
+    if (frozenKeys == NULL) {
+        return;
+    }
+    int frozen = eytContains(frozenKeys, data);
+    if (present) {
+        frozen ? bptRemove(&frozenRemoved, data) : bptInsert(&frozenAdded, data);
+    } else {
+        frozen ? bptInsert(&frozenRemoved, data) : bptRemove(&frozenAdded, data);
+    }
+    if (!frozenRequested && frozenAdded.count + frozenRemoved.count >= (size_t)frozenThreshold) {
+        frozenRequested = 1;
+        sem_post(&frozenWanted);
+    }
 }
 
-Node* leftRotate(Node* x) {
-    Node* y = x->right;
-    Node* T2 = y->left;
+// Whether data is present, given whether the frozen array holds it
+int frozenResolve(int data, int frozen) {
+    if (frozen) {
+        return frozenRemoved.count == 0 || !bptSearch(&frozenRemoved, data);
+    }
+    return frozenAdded.count > 0 && bptSearch(&frozenAdded, data);
+}
 
-    y->left = x;
-    x->right = T2;
+// Call with treeLock held for reading, and only while frozenKeys is set
+int frozenContains(int data) {
+    return frozenResolve(data, eytContains(frozenKeys, data));
+}
 
-    x->height = max(getHeight(x->left), getHeight(x->right)) + 1;
-    y->height = max(getHeight(y->left), getHeight(y->right)) + 1;
+// Filter in front of the indexes under treeLock (--bloom N): lookups it
+// rules out never reach the index. Updated under the write lock like the
+// index itself, so lookups under the read lock see it in step.
+BloomFilter bloom;
+int bloomEnabled = 0;
+_Atomic long bloomRejected = 0;       // Lookups the filter answered
+_Atomic long bloomFalsePositives = 0; // Lookups it let through that missed
 
-    return y;
+// Keeps the filter and the frozen array in step with the index; call with
+// treeLock held for writing, after the index itself has changed
+void lockedNoteChange(int data, int present) {
+    if (bloomEnabled) {
+        present ? bloomAdd(&bloom, data) : bloomRemove(&bloom, data);
+    }
+    frozenNoteChange(data, present);
 }
 
-int getBalance(Node* node) {
-    return (node == NULL) ? 0 : getHeight(node->left) - getHeight(node->right);
+// Lookup in the index itself, past the filter
+int indexContains(int data) {
+    if (frozenKeys != NULL) {
+        return frozenContains(data);
+    }
+    if (treeIndex == INDEX_BTREE) {
+        return bptSearch(&bplusTree, data);
+    }
+    return searchNode(sharedRoot, data) != NULL;
 }
 
-Node* insertNode(Node* root, int data) {
-    if (root == NULL) {
-        return createNode(data);
+// Batch form of indexContains: the lookups run interleaved
+void indexContainsMany(const int* keys, int n, unsigned char* results) {
+    if (frozenKeys != NULL) {
+        eytContainsMany(frozenKeys, keys, n, results);
+        if (frozenAdded.count > 0 || frozenRemoved.count > 0) {
+            for (int i = 0; i < n; i++) {
+                results[i] = frozenResolve(keys[i], results[i]);
+            }
+        }
+    } else if (treeIndex == INDEX_BTREE) {
+        bptSearchMany(&bplusTree, keys, n, results);
+    } else {
+        searchNodeMany(sharedRoot, keys, n, results);
     }
+}
 
-    if (data < root->data) {
-        root->left = insertNode(root->left, data);
-    } else if (data > root->data) {
-        root->right = insertNode(root->right, data);
-    } else {
-        return root; // Avoid duplicate values (assuming no duplicates in BST)
+// Operations on whichever index treeLock guards. Call lockedContains and
+// lockedRange with the lock held for reading, the others for writing.
+int lockedContains(int data) {
+    if (!bloomEnabled) {
+        return indexContains(data);
+    }
+    if (!bloomMayContain(&bloom, data)) {
+        atomic_fetch_add_explicit(&bloomRejected, 1, memory_order_relaxed);
+        return 0;
     }
+    int found = indexContains(data);
+    if (!found) {
+        atomic_fetch_add_explicit(&bloomFalsePositives, 1, memory_order_relaxed);
+    }
+    return found;
+}
 
-    root->height = max(getHeight(root->left), getHeight(root->right)) + 1;
+#define BLOOM_GROUP 256 // Keys lockedContainsMany filters before a batch lookup
+
+// Batch form of lockedContains. The filter's blocks for a group are
+// prefetched together, then the keys it lets through are looked up as one
+// interleaved batch.
+void lockedContainsMany(const int* keys, int n, unsigned char* results) {
+    if (!bloomEnabled) {
+        indexContainsMany(keys, n, results);
+        return;
+    }
+    long rejected = 0, falsePositives = 0;
+    for (int base = 0; base < n; base += BLOOM_GROUP) {
+        int group = n - base < BLOOM_GROUP ? n - base : BLOOM_GROUP;
+        int passed[BLOOM_GROUP];
+        int slot[BLOOM_GROUP];
+        unsigned char found[BLOOM_GROUP];
+        int count = 0;
+        for (int i = 0; i < group; i++) {
+            bloomPrefetch(&bloom, keys[base + i]);
+        }
+        for (int i = 0; i < group; i++) {
+            results[base + i] = 0;
+            if (bloomMayContain(&bloom, keys[base + i])) {
+                passed[count] = keys[base + i];
+                slot[count++] = base + i;
+            }
+        }
+        indexContainsMany(passed, count, found);
+        for (int i = 0; i < count; i++) {
+            results[slot[i]] = found[i];
+            falsePositives += !found[i];
+        }
+        rejected += group - count;
+    }
+    atomic_fetch_add_explicit(&bloomRejected, rejected, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bloomFalsePositives, falsePositives, memory_order_relaxed);
+}
 
-    int balance = getBalance(root);
+void lockedAdd(int data) {
+    if (treeIndex == INDEX_BTREE) {
+        bptInsert(&bplusTree, data);
+    } else {
+        lockedAvlAdd(data);
+    }
+    lockedNoteChange(data, 1);
+}
 
-    // Left Left Case
-    if (balance > 1 && data < root->left->data) {
-        return rightRotate(root);
+void lockedDelete(int data) {
+    if (treeIndex == INDEX_BTREE) {
+        bptRemove(&bplusTree, data);
+    } else {
+        lockedAvlDelete(data);
     }
+    lockedNoteChange(data, 0);
+}
+
+#define FRAME_BATCH_MIN 256   // Smaller INSERT and REMOVE frames go key by key
 
-    // Right Right Case
-    if (balance < -1 && data > root->right->data) {
-        return leftRotate(root);
+// Copies up to max keys in [lo, hi] into keys in ascending order
+int lockedRange(int lo, int hi, int* keys, int max) {
+    if (treeIndex == INDEX_BTREE) {
+        return bptRange(&bplusTree, lo, hi, keys, max);
     }
+    int n = 0;
+    TreeIterator it;
+    iteratorSeek(&it, sharedRoot, lo);
+    Node* node;
+    while (n < max && (node = iteratorNext(&it)) != NULL && node->data <= hi) {
+        keys[n++] = node->data;
+    }
+    return n;
+}
 
-    // Left Right Case
-    if (balance > 1 && data > root->left->data) {
-        root->left = leftRotate(root->left);
-        return rightRotate(root);
+// Sizes the filter for expectedKeys (or the keys already in the index, if
+// more) and fills it from the index. Call before other threads start.
+int bloomBuild(size_t expectedKeys) {
+    size_t count = treeIndex == INDEX_BTREE ? bplusTree.count : (size_t)getSize(sharedRoot);
+    if (bloomInit(&bloom, count > expectedKeys ? count : expectedKeys) < 0) {
+        return -1;
     }
+    int keys[RANGE_CHUNK_KEYS];
+    long long from = INT_MIN;
+    int n;
+    while (from <= INT_MAX && (n = lockedRange((int)from, INT_MAX, keys, RANGE_CHUNK_KEYS)) > 0) {
+        for (int i = 0; i < n; i++) {
+            bloomAdd(&bloom, keys[i]);
+        }
+        from = (long long)keys[n - 1] + 1;
+    }
+    bloomEnabled = 1;
+    return 0;
+}
+
+// Write-ahead log of every insert and removal (only with --wal). Records are
+// appended under the tree's write lock so replay sees the same order, and
+// writers wait for durability only after dropping the lock.
+Wal wal;
+int walEnabled = 0;
+
+// Logs a mutation; call with treeLock held for writing (or, in the
+// optimistic index, with the changed node locked). Returns its LSN.
+uint64_t logMutation(int option, int data) {
+    return walEnabled ? walAppend(&wal, option, data) : 0;
+}
+
+// LSN of the last change this thread made to the optimistic index
+__thread uint64_t optimisticLsn = 0;
 
-    // Right Left Case
-    if (balance < -1 && data < root->right->data) {
-        root->right = rightRotate(root->right);
-        return leftRotate(root);
+// Change hook of the optimistic index; runs with the changed node locked,
+// so the log order for each key matches the order of its changes
+void optimisticChanged(int inserted, int key) {
+    optimisticLsn = logMutation(inserted ? ADD_NODE : REMOVE_NODE, key);
+}
+
+// Waits until the mutation logged at lsn is durable (no-op without a WAL)
+void awaitDurable(uint64_t lsn) {
+    if (walEnabled && lsn > 0) {
+        walCommit(&wal, lsn);
     }
+}
 
-    return root;
+// Applies one logged mutation during startup replay
+void replayMutation(int option, int32_t data) {
+    if (treeIndex == INDEX_OAVL) {
+        if (option == ADD_NODE) {
+            oavlInsert(&optimisticTree, data);
+        } else if (option == REMOVE_NODE) {
+            oavlRemove(&optimisticTree, data);
+        }
+    } else if (option == ADD_NODE && !lockedContains(data)) {
+        lockedAdd(data);
+    } else if (option == REMOVE_NODE && lockedContains(data)) {
+        lockedDelete(data);
+    }
 }
 
-Node* findMinNode(Node* node) {
-    Node* current = node;
-    while (current && current->left != NULL) {
-        current = current->left;
+// Clients blocked in WAIT, woken by the inserts of their keys. Inserts
+// notify once the key is durable and no tree lock is held. shutdownToken
+// fires on SIGINT or SIGTERM and ends every wait.
+WaitTable keyWaits;
+CancelToken shutdownToken;
+
+int treeSearch(int data) {
+    if (treeIndex == INDEX_OAVL) {
+        return oavlSearch(&optimisticTree, data);
     }
-    return current;
+    pthread_rwlock_rdlock(&treeLock);
+    int found = lockedContains(data);
+    pthread_rwlock_unlock(&treeLock);
+    return found;
+}
+
+int keyPresent(void* ctx, int key) {
+    (void)ctx;
+    return treeSearch(key);
 }
 
-Node* removeNode(Node* root, int data) {
-    if (root == NULL) {
-        return root;
+void notifyInserted(const int* keys, int n, const unsigned char* results) {
+    for (int i = 0; i < n; i++) {
+        if (results[i]) {
+            waitTableNotify(&keyWaits, keys[i]);
+        }
     }
+}
 
-    if (data < root->data) {
-        root->left = removeNode(root->left, data);
-    } else if (data > root->data) {
-        root->right = removeNode(root->right, data);
-    } else {
-        if (root->left == NULL || root->right == NULL) {
-            Node* temp = root->left ? root->left : root->right;
-            free(root);
-            return temp;
+int treeInsert(int data) {
+    if (treeIndex == INDEX_OAVL) {
+        optimisticLsn = 0;
+        int inserted = oavlInsert(&optimisticTree, data);
+        awaitDurable(optimisticLsn);
+        if (inserted) {
+            waitTableNotify(&keyWaits, data);
         }
-        Node* minRight = findMinNode(root->right);
-        root->data = minRight->data;
-        root->right = removeNode(root->right, minRight->data);
+        return inserted;
+    }
+    if (treeSearch(data)) {
+        return 0; // Already present, nothing to write
     }
 
-    root->height = max(getHeight(root->left), getHeight(root->right)) + 1;
+    uint64_t lsn = 0;
+    pthread_rwlock_wrlock(&treeLock);
+    int inserted = !lockedContains(data);
+    if (inserted) {
+        lockedAdd(data);
+        lsn = logMutation(ADD_NODE, data);
+    }
+    pthread_rwlock_unlock(&treeLock);
+    awaitDurable(lsn);
+    if (inserted) {
+        waitTableNotify(&keyWaits, data);
+    }
+    return inserted;
+}
 
-    int balance = getBalance(root);
+int treeRemove(int data) {
+    if (treeIndex == INDEX_OAVL) {
+        optimisticLsn = 0;
+        int removed = oavlRemove(&optimisticTree, data);
+        awaitDurable(optimisticLsn);
+        return removed;
+    }
+    if (!treeSearch(data)) {
+        return 0; // Not present, nothing to write
+    }
 
-    // Left Left Case
-    if (balance > 1 && getBalance(root->left) >= 0) {
-        return rightRotate(root);
+    uint64_t lsn = 0;
+    pthread_rwlock_wrlock(&treeLock);
+    int removed = lockedContains(data);
+    if (removed) {
+        lockedDelete(data);
+        lsn = logMutation(REMOVE_NODE, data);
     }
+    pthread_rwlock_unlock(&treeLock);
+    awaitDurable(lsn);
+    return removed;
+}
+
+#define LOOKUP_CHUNK 4096 // Keys per helper task
+
+typedef struct LookupBatch {
+    const int* keys;
+    unsigned char* results;
+} LookupBatch;
 
-    // Left Right Case
-    if (balance > 1 && getBalance(root->left) < 0) {
-        root->left = leftRotate(root->left);
-        return rightRotate(root);
+void lookupChunk(void* ctx, size_t from, size_t to) {
+    LookupBatch* batch = (LookupBatch*)ctx;
+    if (treeIndex == INDEX_OAVL) {
+        // Optimistic descents retry on version changes, so they run one by one
+        for (size_t i = from; i < to; i++) {
+            batch->results[i] = oavlSearch(&optimisticTree, batch->keys[i]);
+        }
+    } else {
+        lockedContainsMany(batch->keys + from, to - from, batch->results + from);
     }
+}
 
-    // Right Right Case
-    if (balance < -1 && getBalance(root->right) <= 0) {
-        return leftRotate(root);
+// Batch versions used by binary frames: one lock acquisition (and at most
+// one durability wait) per frame instead of one per key. results[i] is 1
+// when keys[i] was found, added or removed respectively.
+void treeSearchMany(const int* keys, int n, unsigned char* results) {
+    LookupBatch batch = {keys, results};
+    if (treeIndex == INDEX_OAVL) {
+        taskPoolFor(&helperPool, n, LOOKUP_CHUNK, lookupChunk, &batch);
+        return;
     }
+    // Helpers read under this thread's read lock, which is held throughout
+    pthread_rwlock_rdlock(&treeLock);
+    taskPoolFor(&helperPool, n, LOOKUP_CHUNK, lookupChunk, &batch);
+    pthread_rwlock_unlock(&treeLock);
+}
 
-    // Right Left Case
-    if (balance < -1 && getBalance(root->right) > 0) {
-        root->right = rightRotate(root->right);
-        return leftRotate(root);
+void treeInsertMany(const int* keys, int n, unsigned char* results) {
+    if (treeIndex == INDEX_OAVL) {
+        optimisticLsn = 0;
+        for (int i = 0; i < n; i++) {
+            results[i] = oavlInsert(&optimisticTree, keys[i]);
+        }
+        awaitDurable(optimisticLsn); // LSNs only grow, so the last covers all
+        notifyInserted(keys, n, results);
+        return;
+    }
+    uint64_t lsn = 0;
+    pthread_rwlock_wrlock(&treeLock);
+    // The batch paths rebuild the top of the tree in place, so while a
+    // snapshot is open the keys go one by one, copying their paths. They do
+    // the same when insertBatch turns the frame down, as it does while
+    // relaxed writes have left imbalances behind.
+    if (treeIndex == INDEX_AVL && n >= FRAME_BATCH_MIN && atomic_load(&snapshotsOpen) == 0 &&
+        insertBatch(keys, n, results) == 0) {
+        for (int i = 0; i < n; i++) {
+            if (results[i]) {
+                lockedNoteChange(keys[i], 1);
+                lsn = logMutation(ADD_NODE, keys[i]);
+            }
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            results[i] = !lockedContains(keys[i]);
+            if (results[i]) {
+                lockedAdd(keys[i]);
+                lsn = logMutation(ADD_NODE, keys[i]);
+            }
+        }
     }
+    pthread_rwlock_unlock(&treeLock);
+    awaitDurable(lsn);
+    notifyInserted(keys, n, results);
+}
 
-    return root;
+void treeRemoveMany(const int* keys, int n, unsigned char* results) {
+    if (treeIndex == INDEX_OAVL) {
+        optimisticLsn = 0;
+        for (int i = 0; i < n; i++) {
+            results[i] = oavlRemove(&optimisticTree, keys[i]);
+        }
+        awaitDurable(optimisticLsn);
+        return;
+    }
+    uint64_t lsn = 0;
+    pthread_rwlock_wrlock(&treeLock);
+    if (treeIndex == INDEX_AVL && n >= FRAME_BATCH_MIN && atomic_load(&snapshotsOpen) == 0 &&
+        removeBatch(keys, n, results) == 0) {
+        for (int i = 0; i < n; i++) {
+            if (results[i]) {
+                lockedNoteChange(keys[i], 0);
+                lsn = logMutation(REMOVE_NODE, keys[i]);
+            }
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            results[i] = lockedContains(keys[i]);
+            if (results[i]) {
+                lockedDelete(keys[i]);
+                lsn = logMutation(REMOVE_NODE, keys[i]);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+    awaitDurable(lsn);
 }
 
-void inOrderTraversal(Node* root) {
-    if (root != NULL) {
-        inOrderTraversal(root->left);
-        printf("%d ", root->data);
-        inOrderTraversal(root->right);
+// Copies up to max keys in [lo, hi] into keys in ascending order. Holds the
+// read lock for one chunk only, so long scans never block writers for long.
+int treeRange(int lo, int hi, int* keys, int max) {
+    if (treeIndex == INDEX_OAVL) {
+        return oavlRange(&optimisticTree, lo, hi, keys, max);
     }
+    pthread_rwlock_rdlock(&treeLock);
+    int n = lockedRange(lo, hi, keys, max);
+    pthread_rwlock_unlock(&treeLock);
+    return n;
 }
 
-void* searchThread(void* arg) {
-    ClientThreadArgs* threadArgs = (ClientThreadArgs*)arg;
-    int data = threadArgs->data;
-    Node* root = threadArgs->root;
-    Node* result = NULL;
+// Order statistics. The AVL tree answers them from its subtree sizes in one
+// descent each, all of a frame under one read lock. The other indexes keep
+// no sizes, so they count keys with chunked scans instead, which take time
+// linear in the keys passed over and see concurrent writes between chunks.
 
-    int currentHeight = 0;
-    const int maxAllowedHeight = getBSTHeight(root);
+// Number of keys in [lo, hi], counted with a scan
+uint32_t scanCount(int lo, int hi) {
+    int keys[RANGE_CHUNK_KEYS];
+    uint32_t count = 0;
+    long long from = lo;
+    int n;
+    while (from <= hi && (n = treeRange((int)from, hi, keys, RANGE_CHUNK_KEYS)) > 0) {
+        count += n;
+        from = (long long)keys[n - 1] + 1;
+    }
+    return count;
+}
 
-    while (1) {
-        Node* curr = root;
-        while (curr != NULL) {
-            if (data == curr->data) {
-                result = curr;
+int compareUint64s(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// treeSelectMany with a scan. The ranks are answered in ascending order
+// (each packed above its slot in the frame), so one walk in chunks passes
+// every key at most once for the whole frame. Without memory to sort them
+// they go in frame order, and the walk starts over for a rank behind it.
+uint32_t scanSelectMany(const uint32_t* ranks, int n, int* keys) {
+    uint32_t count = scanCount(INT_MIN, INT_MAX);
+    uint64_t* order = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (order != NULL) {
+        for (int i = 0; i < n; i++) {
+            order[i] = (uint64_t)ranks[i] << 32 | (uint32_t)i;
+        }
+        qsort(order, n, sizeof(uint64_t), compareUint64s);
+    }
+    int chunk[RANGE_CHUNK_KEYS];
+    long long from = INT_MIN;
+    uint32_t passed = 0; // Keys below from
+    for (int j = 0; j < n; j++) {
+        int i = order != NULL ? (int)(uint32_t)order[j] : j;
+        uint32_t rank = ranks[i];
+        keys[i] = 0;
+        if (rank >= count) {
+            continue;
+        }
+        if (rank < passed) {
+            from = INT_MIN;
+            passed = 0;
+        }
+        while (from <= INT_MAX) {
+            uint32_t ahead = rank - passed; // Keys before the one wanted
+            int want = ahead < RANGE_CHUNK_KEYS ? (int)ahead + 1 : RANGE_CHUNK_KEYS;
+            int got = treeRange((int)from, INT_MAX, chunk, want);
+            if (got == 0) {
+                break; // Removed since they were counted
+            }
+            if ((uint32_t)got > ahead) {
+                keys[i] = chunk[ahead];
+                from = chunk[ahead]; // The next rank may be the same
+                passed = rank;
                 break;
-            } else if (data < curr->data) {
-                curr = curr->left;
-            } else {
-                curr = curr->right;
             }
+            passed += got;
+            from = (long long)chunk[got - 1] + 1;
         }
+    }
+    free(order);
+    return count;
+}
 
-        if (result != NULL)
-            break;
+// ranks[i] is the number of keys smaller than keys[i]
+void treeRankMany(const int* keys, int n, uint32_t* ranks) {
+    if (treeIndex != INDEX_AVL) {
+        for (int i = 0; i < n; i++) {
+            ranks[i] = keys[i] == INT_MIN ? 0 : scanCount(INT_MIN, keys[i] - 1);
+        }
+        return;
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    for (int i = 0; i < n; i++) {
+        ranks[i] = rankNode(sharedRoot, keys[i]);
+    }
+    pthread_rwlock_unlock(&treeLock);
+}
+
+// keys[i] is the key of rank ranks[i] (0: the smallest). Returns the number
+// of keys in the tree; ranks at or past it leave keys[i] at 0.
+uint32_t treeSelectMany(const uint32_t* ranks, int n, int* keys) {
+    if (treeIndex != INDEX_AVL) {
+        return scanSelectMany(ranks, n, keys);
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    uint32_t count = getSize(sharedRoot);
+    for (int i = 0; i < n; i++) {
+        Node* node = ranks[i] < count ? selectNode(sharedRoot, (int)ranks[i]) : NULL;
+        keys[i] = node != NULL ? node->data : 0;
+    }
+    pthread_rwlock_unlock(&treeLock);
+    return count;
+}
+
+// counts[i] is the number of keys in [bounds[2i], bounds[2i + 1]]
+void treeCountMany(const int* bounds, int n, uint32_t* counts) {
+    if (treeIndex != INDEX_AVL) {
+        for (int i = 0; i < n; i++) {
+            counts[i] = bounds[2 * i] <= bounds[2 * i + 1] ? scanCount(bounds[2 * i], bounds[2 * i + 1]) : 0;
+        }
+        return;
+    }
+    pthread_rwlock_rdlock(&treeLock);
+    for (int i = 0; i < n; i++) {
+        int lo = bounds[2 * i], hi = bounds[2 * i + 1];
+        counts[i] = 0;
+        if (lo <= hi) {
+            // Keys up to hi, less those below lo
+            counts[i] = rankNode(sharedRoot, hi) + (searchNode(sharedRoot, hi) != NULL) - rankNode(sharedRoot, lo);
+        }
+    }
+    pthread_rwlock_unlock(&treeLock);
+}
+
+// Reads the WAL position every change logged so far ends at
+uint64_t walPosition() {
+    uint64_t position = 0;
+    if (walEnabled) {
+        pthread_mutex_lock(&wal.lock);
+        position = wal.appended;
+        pthread_mutex_unlock(&wal.lock);
+    }
+    return position;
+}
 
-        if (atomic_load(&root->data) == INT_MIN)
+// Collects the optimistic index's keys for a checkpoint. There is no lock
+// to freeze the tree, so the WAL position is read first and the keys after
+// it: every change logged before that position is already visible, and
+// replaying the records after it (inserts and removals are idempotent)
+// fixes up whatever changed while the scan ran.
+int* collectOptimisticKeys(size_t* count, uint64_t* walOffset) {
+    size_t capacity = 1024;
+    int* keys = (int*)malloc(capacity * sizeof(int));
+    *count = 0;
+    *walOffset = walPosition();
+
+    long long from = INT_MIN;
+    while (from <= INT_MAX) {
+        if (capacity - *count < RANGE_CHUNK_KEYS) {
+            capacity *= 2;
+            keys = (int*)realloc(keys, capacity * sizeof(int));
+        }
+        int n = oavlRange(&optimisticTree, (int)from, INT_MAX, keys + *count, RANGE_CHUNK_KEYS);
+        if (n == 0) {
             break;
+        }
+        *count += n;
+        from = (long long)keys[*count - 1] + 1;
+    }
+    return keys;
+}
+
+// Collects every key for a checkpoint. The keys and the WAL position are
+// captured together under the read lock (WAL records are only appended under
+// the write lock), so replay can resume exactly where the checkpoint ends.
+// The AVL tree is read from a snapshot taken then, after the lock is gone,
+// by the helper threads.
+void storeKey(void* ctx, int key, uint32_t rank) {
+    ((int*)ctx)[rank] = key;
+}
+
+int* collectTreeKeys(size_t* count, uint64_t* walOffset) {
+    size_t capacity = 1024;
+    int* keys = (int*)malloc(capacity * sizeof(int));
+    *count = 0;
 
-        // If the search reached a leaf node and the current height is less than maxAllowedHeight,
-        // assume the target is not in the BST and break out of the loop.
-        if (curr == NULL && currentHeight < maxAllowedHeight)
+    pthread_rwlock_rdlock(&treeLock);
+    TreeSnapshot* snapshot = treeIndex == INDEX_AVL ? lockedOpenSnapshot() : NULL;
+    if (snapshot != NULL) {
+        *walOffset = walPosition();
+        pthread_rwlock_unlock(&treeLock);
+        *count = getSize(snapshot->root);
+        keys = (int*)realloc(keys, (*count + 1) * sizeof(int));
+        if (treeForEachParallel(snapshot->root, storeKey, keys) < 0) {
+            TreeIterator it; // No memory to cut the tree up: walk it here
+            iteratorSeek(&it, snapshot->root, INT_MIN);
+            Node* node;
+            for (uint32_t rank = 0; (node = iteratorNext(&it)) != NULL; rank++) {
+                storeKey(keys, node->data, rank);
+            }
+        }
+        closeTreeSnapshot(snapshot);
+        return keys;
+    }
+    long long from = INT_MIN;
+    while (from <= INT_MAX) {
+        if (capacity - *count < RANGE_CHUNK_KEYS) {
+            capacity *= 2;
+            keys = (int*)realloc(keys, capacity * sizeof(int));
+        }
+        int n = lockedRange((int)from, INT_MAX, keys + *count, RANGE_CHUNK_KEYS);
+        if (n == 0) {
             break;
+        }
+        *count += n;
+        from = (long long)keys[*count - 1] + 1;
+    }
+    *walOffset = walPosition();
+    pthread_rwlock_unlock(&treeLock);
+    return keys;
+}
+
+// Rebuilds frozenKeys from the tree. The keys are read a chunk at a time,
+// so writers are held off only briefly; every key written from the moment
+// the rebuild starts is recorded and checked again when the new array is
+// swapped in. Returns 0, or -1 if out of memory.
+int frozenRebuild() {
+    long long start = nowNanos();
+    pthread_rwlock_wrlock(&treeLock);
+    frozenRebuilding = 1;
+    frozenChangedCount = 0;
+    pthread_rwlock_unlock(&treeLock);
 
-        // Increment the height of the current subtree being searched.
-        currentHeight++;
+    size_t capacity = 1024;
+    size_t count = 0;
+    int* keys = (int*)malloc(capacity * sizeof(int));
+    long long from = INT_MIN;
+    while (keys != NULL && from <= INT_MAX) {
+        if (capacity - count < RANGE_CHUNK_KEYS) {
+            capacity *= 2;
+            int* grown = (int*)realloc(keys, capacity * sizeof(int));
+            if (grown == NULL) {
+                free(keys);
+                keys = NULL;
+                break;
+            }
+            keys = grown;
+        }
+        pthread_rwlock_rdlock(&treeLock);
+        int n = lockedRange((int)from, INT_MAX, keys + count, RANGE_CHUNK_KEYS);
+        pthread_rwlock_unlock(&treeLock);
+        if (n == 0) {
+            break;
+        }
+        count += n;
+        from = (long long)keys[count - 1] + 1;
     }
+    EytzingerSet* built = keys != NULL ? eytBuild(keys, count) : NULL;
+    free(keys);
 
-    if (result != NULL) {
-        char* message = (char*)malloc(50 * sizeof(char));
-        snprintf(message, 50, "Found %d", result->data);
-        return message;
+    BPlusTree added, removed;
+    bptTreeInit(&added);
+    bptTreeInit(&removed);
+    int result = 0;
+    pthread_rwlock_wrlock(&treeLock);
+    if (built != NULL) {
+        // The current answer for each key written meanwhile, against the new array
+        for (size_t i = 0; i < frozenChangedCount; i++) {
+            int key = frozenChanged[i];
+            int present = lockedContains(key);
+            int frozen = eytContains(built, key);
+            if (present && !frozen) {
+                bptInsert(&added, key);
+            } else if (!present && frozen) {
+                bptInsert(&removed, key);
+            }
+        }
+        EytzingerSet* old = frozenKeys;
+        frozenKeys = built;
+        built = old;
+        bptFreeNodes(frozenAdded.root, frozenAdded.height);
+        bptFreeNodes(frozenRemoved.root, frozenRemoved.height);
+        frozenAdded = added;
+        frozenRemoved = removed;
+        frozenRebuilds++;
+        frozenLastBuildMs = (nowNanos() - start) / 1e6;
     } else {
-        char* message = (char*)malloc(50 * sizeof(char));
-        snprintf(message, 50, "%d not found", data);
-        return message;
+        bptFreeNodes(added.root, added.height);
+        bptFreeNodes(removed.root, removed.height);
+        result = -1;
+    }
+    frozenRebuilding = 0;
+    frozenRequested = 0;
+    pthread_rwlock_unlock(&treeLock);
+
+    eytFree(built); // The array just replaced; no reader can hold it any more
+    return result;
+}
+
+void* frozenThread(void* arg) {
+    (void)arg;
+    while (1) {
+        if (sem_wait(&frozenWanted) == 0 && frozenRebuild() < 0) {
+            perror("Lookup array rebuild error");
+        }
     }
+    return NULL;
 }
 
-void* handleClient(void* client_socket_ptr) {
-    int client_socket = *((int*)client_socket_ptr);
+// Writes every key to the checkpoint file
+int writeCheckpoint(const char* path) {
+    size_t count;
+    uint64_t walOffset;
+    int* keys = treeIndex == INDEX_OAVL ? collectOptimisticKeys(&count, &walOffset) : collectTreeKeys(&count, &walOffset);
+
+    // The checkpoint must never cover log records that could still be lost
+    if (walEnabled) {
+        walSync(&wal);
+    }
+    int result = snapshotWrite(path, keys, count, walOffset);
+    if (result < 0) {
+        perror("Checkpoint write error");
+    }
+    free(keys);
+    return result;
+}
+
+// Builds the reply for one request. Replies are NUL-terminated strings so a
+// client reading a stream of them can tell where each one ends.
+void processRequest(int option, int target, char* response, size_t size) {
+    switch (option) {
+        case SEARCH_TARGET:
+            if (treeSearch(target)) {
+                snprintf(response, size, "Found %d", target);
+            } else {
+                snprintf(response, size, "%d not found", target);
+            }
+            break;
+        case ADD_NODE:
+            if (treeInsert(target)) {
+                snprintf(response, size, "Added %d", target);
+            } else {
+                snprintf(response, size, "%d already in the tree", target);
+            }
+            break;
+        case REMOVE_NODE:
+            if (treeRemove(target)) {
+                snprintf(response, size, "Removed %d", target);
+            } else {
+                snprintf(response, size, "%d not found", target);
+            }
+            break;
+        default:
+            snprintf(response, size, "Invalid option %d", option);
+            break;
+    }
+}
 
-    int option, target;
-    recv(client_socket, &option, sizeof(option), 0);
-    recv(client_socket, &target, sizeof(target), 0);
+// Growable byte buffer used for per-connection input and output
+typedef struct Buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+} Buffer;
 
-    Node* root = NULL;
-    root = insertNode(root, 50);
-    root = insertNode(root, 35);
-    root = insertNode(root, 20);
-    root = insertNode(root, 40);
-    root = insertNode(root, 70);
-    root = insertNode(root, 60);
-    root = insertNode(root, 90);
-    root = insertNode(root, 45);
-    root = insertNode(root, 21);
-    root = insertNode(root, 56);
-    root = insertNode(root, 30);
+void bufferReserve(Buffer* buffer, size_t extra) {
+    if (buffer->len + extra <= buffer->cap) {
+        return;
+    }
+    size_t cap = buffer->cap ? buffer->cap : 1024;
+    while (cap < buffer->len + extra) {
+        cap *= 2;
+    }
+    buffer->data = (char*)realloc(buffer->data, cap);
+    buffer->cap = cap;
+}
+
+void bufferAppend(Buffer* buffer, const void* data, size_t len) {
+    bufferReserve(buffer, len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
 
-    ClientThreadArgs threadArgs = {target, root};
+// Drops the first n bytes of the buffer
+void bufferConsume(Buffer* buffer, size_t n) {
+    memmove(buffer->data, buffer->data + n, buffer->len - n);
+    buffer->len -= n;
+}
 
-    char* response = (char*)searchThread(&threadArgs);
+void bufferFree(Buffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->len = buffer->cap = 0;
+}
 
-    send(client_socket, response, strlen(response), 0);
+#define LEGACY_REQUEST_SIZE (2 * sizeof(int))
 
-    free(response);
-    close(client_socket);
-    return NULL;
+// Progress of a RANGE request that is being streamed back. The scan resumes
+// from `next` with a fresh descent for every chunk, so no tree state is held
+// between chunks and concurrent writes never invalidate the cursor. On the
+// AVL tree a scan that outlasts its first chunk reads the rest from a
+// snapshot taken with it, so it sees the keys of one moment. A WAIT
+// whose key is missing is held here too: like a scan, it keeps the requests
+// behind it from being answered until its reply is out.
+typedef struct ScanCursor {
+    int active;
+    uint32_t requestId;
+    int next;           // Smallest key not yet sent
+    int hi;
+    uint32_t remaining; // Keys still allowed by the limit
+    TreeSnapshot* snapshot; // Or NULL: chunks read the live index
+    int waiting;        // A WAIT for waitKey is pending (active is 0)
+    int waitKey;
+    long long waitDeadline;
+} ScanCursor;
+
+int replyPending(const ScanCursor* scan) {
+    return scan->active || scan->waiting;
 }
 
-int main() {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    pthread_t thread_id;
+// Stops a RANGE stream, finished or not, and lets go of its snapshot
+void endScan(ScanCursor* scan) {
+    scan->active = 0;
+    closeTreeSnapshot(scan->snapshot);
+    scan->snapshot = NULL;
+}
 
-    // Create socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Socket creation error");
-        return 1;
+// Appends the next chunk frame of the scan, finishing it when the range or
+// the limit is exhausted
+void appendScanChunk(ScanCursor* scan, Buffer* out) {
+    int keys[RANGE_CHUNK_KEYS];
+    int want = scan->remaining < RANGE_CHUNK_KEYS ? (int)scan->remaining : RANGE_CHUNK_KEYS;
+    int n = 0;
+    if (want > 0 && scan->snapshot != NULL) {
+        n = snapshotRange(scan->snapshot, scan->next, scan->hi, keys, want);
+    } else if (want > 0 && treeIndex == INDEX_AVL) {
+        pthread_rwlock_rdlock(&treeLock);
+        n = lockedRange(scan->next, scan->hi, keys, want);
+        if (n == want && scan->remaining > (uint32_t)n && keys[n - 1] < scan->hi) {
+            scan->snapshot = lockedOpenSnapshot(); // More to come, from the tree as it is now
+        }
+        pthread_rwlock_unlock(&treeLock);
+    } else if (want > 0) {
+        n = treeRange(scan->next, scan->hi, keys, want);
     }
 
-    // Set server address
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(1234);
+    scan->remaining -= n;
+    if (n < want || scan->remaining == 0 || keys[n - 1] >= scan->hi) {
+        endScan(scan);
+    } else {
+        scan->next = keys[n - 1] + 1;
+    }
 
-    // Bind socket to address and port
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Binding error");
-        return 1;
+    bufferReserve(out, FRAME_HEADER_SIZE + n * sizeof(int32_t));
+    unsigned char* frame = (unsigned char*)out->data + out->len;
+    encodeFrameHeader(frame, STATUS_OK, scan->active ? FLAG_MORE : 0, scan->requestId, n * sizeof(int32_t));
+    for (int i = 0; i < n; i++) {
+        putInt32(frame + FRAME_HEADER_SIZE + i * sizeof(int32_t), keys[i]);
     }
+    out->len += FRAME_HEADER_SIZE + n * sizeof(int32_t);
+}
 
-    // Listen for incoming connections
-    if (listen(server_socket, 5) < 0) {
-        perror("Listen error");
+// Streams scan chunks into out until the scan ends or out reaches limit
+void pumpScan(ScanCursor* scan, Buffer* out, size_t limit) {
+    while (scan->active && out->len < limit) {
+        appendScanChunk(scan, out);
+    }
+}
+
+// Appends a response frame with an empty payload
+void appendStatus(Buffer* out, uint8_t status, uint32_t requestId) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    encodeFrameHeader(header, status, 0, requestId, 0);
+    bufferAppend(out, header, sizeof(header));
+}
+
+// Appends the reply to a WAIT that ended with the waitTable.h result
+void appendWaitReply(Buffer* out, uint32_t requestId, int result) {
+    if (result == WAIT_CANCELLED) {
+        appendStatus(out, STATUS_SHUTTING_DOWN, requestId);
+        return;
+    }
+    unsigned char frame[FRAME_HEADER_SIZE + 1];
+    encodeFrameHeader(frame, STATUS_OK, 0, requestId, 1);
+    frame[FRAME_HEADER_SIZE] = result == WAIT_PRESENT;
+    bufferAppend(out, frame, sizeof(frame));
+}
+
+void finishWait(ScanCursor* scan, Buffer* out, int result) {
+    scan->waiting = 0;
+    appendWaitReply(out, scan->requestId, result);
+}
+
+// Registers the pending WAIT in *scan with the wait table, to be completed
+// through waiter's callback. Returns 1 if it now waits, or 0 if it ended on
+// the spot and its reply is in out.
+int parkWait(ScanCursor* scan, KeyWaiter* waiter, Buffer* out) {
+    waiter->key = scan->waitKey;
+    waiter->deadline = scan->waitDeadline;
+    waiter->token = &shutdownToken;
+    int result = waitTableWatch(&keyWaits, waiter);
+    if (result == 0) {
         return 1;
     }
+    finishWait(scan, out, result);
+    return 0;
+}
+
+// Answers one binary frame whose payload has fully arrived. A RANGE request
+// only sets up *scan; the caller streams its chunks as output drains. So
+// does a WAIT for a missing key; the caller blocks or parks the connection.
+void answerFrame(const FrameHeader* header, const unsigned char* payload, Buffer* out, ScanCursor* scan) {
+    if (header->version != PROTOCOL_VERSION) {
+        appendStatus(out, STATUS_BAD_VERSION, header->requestId);
+        return;
+    }
 
-    printf("Server started. Waiting for connections...\n");
+    switch (header->opcode) {
+        case OP_SEARCH:
+        case OP_INSERT:
+        case OP_REMOVE: {
+            if (header->length % sizeof(int32_t) != 0) {
+                appendStatus(out, STATUS_BAD_REQUEST, header->requestId);
+                return;
+            }
 
-    while (1) {
-        // Accept client connection
-        client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (client_socket < 0) {
-            perror("Accept error");
-            continue;
+            int n = header->length / sizeof(int32_t);
+            int* keys = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+            for (int i = 0; i < n; i++) {
+                keys[i] = getInt32(payload + i * sizeof(int32_t));
+            }
+
+            // Results are written straight into the output buffer
+            bufferReserve(out, FRAME_HEADER_SIZE + n);
+            unsigned char* response = (unsigned char*)out->data + out->len;
+            if (header->opcode == OP_SEARCH) {
+                treeSearchMany(keys, n, response + FRAME_HEADER_SIZE);
+            } else if (header->opcode == OP_INSERT) {
+                treeInsertMany(keys, n, response + FRAME_HEADER_SIZE);
+            } else {
+                treeRemoveMany(keys, n, response + FRAME_HEADER_SIZE);
+            }
+            encodeFrameHeader(response, STATUS_OK, 0, header->requestId, n);
+            out->len += FRAME_HEADER_SIZE + n;
+
+            free(keys);
+            break;
         }
+        case OP_RANK:
+        case OP_SELECT:
+        case OP_COUNT_RANGE: {
+            // Every request value is 4 bytes; COUNT_RANGE takes them in pairs
+            size_t unit = header->opcode == OP_COUNT_RANGE ? 2 * sizeof(int32_t) : sizeof(int32_t);
+            if (header->length % unit != 0) {
+                appendStatus(out, STATUS_BAD_REQUEST, header->requestId);
+                return;
+            }
 
-        printf("New client connected. IP: %s, Port: %d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            int n = header->length / unit;
+            int values = header->length / sizeof(int32_t);
+            int* in = (int*)malloc((values > 0 ? values : 1) * sizeof(int));
+            uint32_t* results = (uint32_t*)malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+            for (int i = 0; i < values; i++) {
+                in[i] = getInt32(payload + i * sizeof(int32_t));
+            }
 
-        // Create a new thread to handle the client
-        if (pthread_create(&thread_id, NULL, handleClient, &client_socket) < 0) {
-            perror("Thread creation error");
-            return 1;
+            uint32_t length = n * sizeof(int32_t);
+            uint32_t count = 0;
+            if (header->opcode == OP_RANK) {
+                treeRankMany(in, n, results);
+            } else if (header->opcode == OP_SELECT) {
+                count = treeSelectMany((const uint32_t*)in, n, (int*)results);
+                length += sizeof(uint32_t);
+            } else {
+                treeCountMany(in, n, results);
+            }
+
+            bufferReserve(out, FRAME_HEADER_SIZE + length);
+            unsigned char* response = (unsigned char*)out->data + out->len;
+            encodeFrameHeader(response, STATUS_OK, 0, header->requestId, length);
+            unsigned char* at = response + FRAME_HEADER_SIZE;
+            if (header->opcode == OP_SELECT) {
+                putUint32(at, count);
+                at += sizeof(uint32_t);
+            }
+            for (int i = 0; i < n; i++) {
+                putUint32(at + i * sizeof(uint32_t), results[i]);
+            }
+            out->len += FRAME_HEADER_SIZE + length;
+
+            free(in);
+            free(results);
+            break;
+        }
+        case OP_RANGE: {
+            if (header->length != 3 * sizeof(int32_t)) {
+                appendStatus(out, STATUS_BAD_REQUEST, header->requestId);
+                return;
+            }
+            uint32_t limit = getUint32(payload + 8);
+            scan->active = 1;
+            scan->requestId = header->requestId;
+            scan->next = getInt32(payload);
+            scan->hi = getInt32(payload + 4);
+            scan->remaining = limit ? limit : UINT32_MAX;
+            if (scan->next > scan->hi) {
+                scan->remaining = 0; // Empty range: one final, empty frame
+            }
+            break;
+        }
+        case OP_WAIT: {
+            if (header->length != 2 * sizeof(int32_t)) {
+                appendStatus(out, STATUS_BAD_REQUEST, header->requestId);
+                return;
+            }
+            int key = getInt32(payload);
+            uint32_t timeoutMs = getUint32(payload + 4);
+            if (cancelTokenFired(&shutdownToken)) {
+                appendWaitReply(out, header->requestId, WAIT_CANCELLED);
+            } else if (treeSearch(key)) {
+                appendWaitReply(out, header->requestId, WAIT_PRESENT);
+            } else if (timeoutMs == 0) {
+                appendWaitReply(out, header->requestId, WAIT_TIMED_OUT);
+            } else {
+                scan->waiting = 1;
+                scan->requestId = header->requestId;
+                scan->waitKey = key;
+                scan->waitDeadline = waitDeadline(timeoutMs == WAIT_FOREVER ? -1 : timeoutMs * 1000000LL);
+            }
+            break;
         }
+        default:
+            appendStatus(out, STATUS_UNKNOWN_OPCODE, header->requestId);
+            break;
+    }
+}
 
-        pthread_detach(thread_id);
+// Size of the request starting at data: a binary frame when it begins with
+// the protocol magic, a legacy (option, target) pair otherwise. Returns 0 if
+// not even the header has arrived yet.
+size_t requestSize(const char* data, size_t len) {
+    if (len > 0 && (unsigned char)data[0] == PROTOCOL_MAGIC) {
+        if (len < FRAME_HEADER_SIZE) {
+            return 0;
+        }
+        uint32_t length = getUint32((const unsigned char*)data + 8);
+        // An oversized frame is reported by answerRequests; don't wait for it
+        return length > MAX_FRAME_PAYLOAD ? FRAME_HEADER_SIZE : FRAME_HEADER_SIZE + length;
     }
+    return len >= LEGACY_REQUEST_SIZE ? LEGACY_REQUEST_SIZE : 0;
+}
 
-    close(server_socket);
-    return 0;
+// RANGE and WAIT replies may not be complete when the request is answered
+int isDeferredRequest(const char* data) {
+    return (unsigned char)data[0] == PROTOCOL_MAGIC &&
+           ((unsigned char)data[2] == OP_RANGE || (unsigned char)data[2] == OP_WAIT);
+}
+
+// Number of leading bytes that form complete requests, stopping before the
+// request that would take the total past limit (the first one always counts)
+// and right after a RANGE or WAIT request, since nothing behind it can be
+// answered before its reply is complete
+size_t completeRequestBytes(const char* data, size_t len, size_t limit) {
+    size_t pos = 0;
+    while (pos < len) {
+        size_t size = requestSize(data + pos, len - pos);
+        if (size == 0 || pos + size > len || (pos > 0 && pos + size > limit)) {
+            break;
+        }
+        pos += size;
+        if (isDeferredRequest(data + pos - size)) {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Answers every complete request in data, appending replies to out, and
+// returns the number of bytes consumed. *count receives the number of
+// requests answered. Stops after a RANGE request or a WAIT that has to
+// wait, leaving it in *scan. Sets *error on a malformed stream, after which
+// the connection should be closed.
+size_t answerRequests(const char* data, size_t len, Buffer* out, int* count, int* error, ScanCursor* scan) {
+    size_t pos = 0;
+    *count = 0;
+    *error = 0;
+
+    while (pos < len) {
+        const unsigned char* request = (const unsigned char*)data + pos;
+
+        if (request[0] == PROTOCOL_MAGIC) {
+            if (len - pos < FRAME_HEADER_SIZE) {
+                break;
+            }
+            FrameHeader header;
+            decodeFrameHeader(request, &header);
+            if (header.length > MAX_FRAME_PAYLOAD) {
+                appendStatus(out, STATUS_BAD_REQUEST, header.requestId);
+                *error = 1;
+                break;
+            }
+            if (len - pos < FRAME_HEADER_SIZE + header.length) {
+                break;
+            }
+            answerFrame(&header, request + FRAME_HEADER_SIZE, out, scan);
+            pos += FRAME_HEADER_SIZE + header.length;
+            (*count)++;
+            if (replyPending(scan)) {
+                break;
+            }
+        } else {
+            if (len - pos < LEGACY_REQUEST_SIZE) {
+                break;
+            }
+            int legacy[2];
+            memcpy(legacy, request, LEGACY_REQUEST_SIZE);
+
+            char response[64];
+            processRequest(legacy[0], legacy[1], response, sizeof(response));
+            bufferAppend(out, response, strlen(response) + 1);
+            pos += LEGACY_REQUEST_SIZE;
+            (*count)++;
+        }
+    }
+
+    return pos;
+}
+
+struct EventLoop;
+
+// State for one client connection. Requests may arrive split across reads,
+// so unparsed bytes stay in `in` until a whole request is available.
+typedef struct Connection {
+    int fd;
+    Buffer in;
+    Buffer out;
+    struct EventLoop* loop;
+    int inFlight;   // A job for this connection is queued or running, or a WAIT is parked
+    int stalled;    // Waiting for room in the job queue
+    int peerClosed; // Peer sent EOF; finish pending work, then close
+    int closing;    // Socket is gone; free once no job refers to us
+    ScanCursor scan; // RANGE stream or WAIT in progress; later requests wait for it
+    KeyWaiter waiter; // Registered in keyWaits while a WAIT is parked
+    struct Connection* next; // Link in the loop's stalled or released list
+    struct Connection* nextWoken; // Link in the loop's woken list
+} Connection;
+
+// A run of complete requests from one connection, answered by a worker
+typedef struct Job {
+    Connection* conn;
+    char* requests;
+    size_t len;
+    int error;
+    ScanCursor scan; // Unfinished RANGE stream handed back to the loop
+    Buffer output;
+    long long enqueuedAt;
+    struct Job* next;
+} Job;
+
+Connection* createConnection(int fd) {
+    Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+    conn->fd = fd;
+    return conn;
+}
+
+void closeConnection(Connection* conn) {
+    endScan(&conn->scan);
+    close(conn->fd);
+    bufferFree(&conn->in);
+    bufferFree(&conn->out);
+    free(conn);
+}
+
+#define READ_CHUNK 16384
+#define INPUT_HIGH_WATER (64 * 1024)
+#define OUTPUT_HIGH_WATER (256 * 1024)
+#define MAX_JOB_BYTES (64 * 1024)
+
+// Answers complete requests in the input buffer, streaming any RANGE scan
+// until the output buffer reaches the high-water mark; the caller flushes
+// and calls again to continue. Stops at a WAIT that has to wait, which the
+// caller completes before calling again. Returns -1 if the client sent
+// something malformed and the connection should be closed.
+int processInput(Connection* conn) {
+    while (1) {
+        pumpScan(&conn->scan, &conn->out, OUTPUT_HIGH_WATER);
+        if (replyPending(&conn->scan)) {
+            return 0;
+        }
+
+        int count, error;
+        size_t used = answerRequests(conn->in.data, conn->in.len, &conn->out, &count, &error, &conn->scan);
+        bufferConsume(&conn->in, used);
+        if (error) {
+            return -1;
+        }
+        if (!conn->scan.active) {
+            return 0;
+        }
+    }
+}
+
+// Writes as much pending output as the socket accepts. Returns 0 when the
+// buffer is empty, 1 when the socket would block, and -1 on error.
+int flushOutput(Connection* conn) {
+    size_t pos = 0;
+    int result = 0;
+
+    while (pos < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + pos, conn->out.len - pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+            break;
+        }
+        pos += n;
+    }
+
+    bufferConsume(&conn->out, pos);
+    return result;
+}
+
+// Reads one chunk from the socket. Returns the byte count, 0 once the peer
+// has closed the connection, or -1 (errno set) on error.
+ssize_t readChunk(Connection* conn) {
+    bufferReserve(&conn->in, READ_CHUNK);
+    ssize_t n;
+    do {
+        n = recv(conn->fd, conn->in.data + conn->in.len, READ_CHUNK, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        conn->in.len += n;
+    }
+    return n;
+}
+
+typedef struct ServerConfig {
+    int port;
+    int threadPerConnection; // Legacy mode: one pthread per accepted socket
+    int loops;               // Event-loop threads in epoll mode
+    int workers;             // Worker threads answering requests (0: answer in the event loop)
+    int queueSize;           // Capacity of the worker job queue
+    int statsInterval;       // Seconds between statistics reports (0: off)
+    int quiet;               // Don't log every new connection
+    int backlog;             // listen() backlog (the kernel caps it at somaxconn)
+    int reusePort;           // One SO_REUSEPORT listener per loop/acceptor thread
+    int ioUring;             // Use the io_uring backend (falls back to epoll)
+    const char* walPath;     // Write-ahead log file (NULL: keep the tree in memory only)
+    int durability;          // WAL_DURABILITY_* mode
+    int flushMs;             // Sync interval for WAL_DURABILITY_INTERVAL
+    const char* snapshotPath; // Checkpoint loaded at startup and rewritten periodically
+    int checkpointInterval;  // Seconds between checkpoints (0: never write one)
+    int index;               // INDEX_* structure that holds the keys
+    int frozenThreshold;     // Serve lookups from a frozen array rebuilt after this many changes
+    int helperThreads;       // Helper threads for large frames and bulk loads
+    long bloomKeys;          // Expected keys for the negative-lookup filter (0: no filter)
+    int relaxed;             // Rotate in a background thread instead of on every write
+} ServerConfig;
+
+ServerConfig config = {
+    .port = 1234,
+    .queueSize = 1024,
+    .backlog = 4096,
+    .durability = WAL_DURABILITY_ALWAYS,
+    .flushMs = 5,
+};
+
+int threadCount() {
+    int count = config.loops > 0 ? config.loops : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : count;
+}
+
+// Creates a bound, listening socket. With reusePort several sockets can
+// bind the same port and the kernel spreads incoming connections across
+// them, so each thread can run its own accept loop without contention.
+int createListenSocket(int reusePort) {
+    struct sockaddr_in server_addr;
+
+    // Create socket
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Socket creation error");
+        return -1;
+    }
+
+    // Allow quick restarts while old connections sit in TIME_WAIT
+    int one = 1;
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        (reusePort && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)) {
+        perror("Setsockopt error");
+        close(server_socket);
+        return -1;
+    }
+
+    // Set server address
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(config.port);
+
+    // Bind socket to address and port
+    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Binding error");
+        close(server_socket);
+        return -1;
+    }
+
+    // Listen for incoming connections
+    if (listen(server_socket, config.backlog) < 0) {
+        perror("Listen error");
+        close(server_socket);
+        return -1;
+    }
+
+    return server_socket;
+}
+
+void logConnection(struct sockaddr_in* client_addr) {
+    if (!config.quiet) {
+        printf("New client connected. IP: %s, Port: %d\n", inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
+    }
+}
+
+long long nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void* handleClient(void* client_socket_ptr) {
+    Connection* conn = createConnection((int)(intptr_t)client_socket_ptr);
+
+    // Serve requests on this connection until the client disconnects. A
+    // RANGE reply is written out one high-water mark's worth at a time, and
+    // a WAIT blocks this thread (after the replies before it are sent).
+    while (readChunk(conn) > 0) {
+        int error, flushed, waited;
+        do {
+            error = processInput(conn);
+            flushed = flushOutput(conn);
+            waited = !error && flushed == 0 && conn->scan.waiting;
+            if (waited) {
+                int result = waitForKey(&keyWaits, conn->scan.waitKey, conn->scan.waitDeadline, &shutdownToken);
+                finishWait(&conn->scan, &conn->out, result);
+            }
+        } while (!error && flushed == 0 && (conn->scan.active || waited));
+        if (flushed != 0 || error) {
+            break;
+        }
+    }
+
+    closeConnection(conn);
+    return NULL;
+}
+
+void* acceptLoop(void* arg) {
+    int server_socket = (int)(intptr_t)arg;
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+    pthread_t thread_id;
+
+    while (1) {
+        // Accept client connection
+        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
+        if (client_socket < 0) {
+            perror("Accept error");
+            continue;
+        }
+
+        logConnection(&client_addr);
+
+        // Create a new thread to handle the client. The descriptor is passed by
+        // value: the next accept() would overwrite a pointer to client_socket.
+        // If no thread can be created, drop this client rather than the server.
+        if (pthread_create(&thread_id, NULL, handleClient, (void*)(intptr_t)client_socket) != 0) {
+            perror("Thread creation error");
+            close(client_socket);
+            continue;
+        }
+
+        pthread_detach(thread_id);
+    }
+
+    return NULL;
+}
+
+int runThreadServer(int server_socket) {
+    if (!config.reusePort) {
+        acceptLoop((void*)(intptr_t)server_socket);
+        return 1;
+    }
+
+    int acceptors = threadCount();
+    printf("Running %d SO_REUSEPORT acceptor thread(s).\n", acceptors);
+
+    for (int i = 0; i < acceptors; i++) {
+        int listenFd = createListenSocket(1);
+        if (listenFd < 0) {
+            return 1;
+        }
+        if (i == acceptors - 1) {
+            acceptLoop((void*)(intptr_t)listenFd);
+            return 1;
+        }
+
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, acceptLoop, (void*)(intptr_t)listenFd) != 0) {
+            perror("Thread creation error");
+            return 1;
+        }
+    }
+    return 1;
+}
+
+#define MAX_EVENTS 256
+
+// One epoll instance per thread. Every loop either watches the shared
+// listening socket (EPOLLEXCLUSIVE wakes only one of them per connection) or,
+// with --reuseport, its own SO_REUSEPORT listener. A loop owns the
+// connections it accepts for their whole lifetime, so no locking is needed
+// except for the completion list that worker threads hand results back on.
+typedef struct EventLoop {
+    int epollFd;
+    int listenFd;
+    int wakeFd;                   // eventfd workers write to after posting completions
+    pthread_t thread;
+    pthread_mutex_t completedLock;
+    Job* completed;               // Finished jobs waiting to be written out
+    Connection* woken;            // Connections whose parked WAIT has ended
+    Connection* stalled;          // Connections waiting for room in the job queue
+    Connection* released;         // Closed connections, freed after the current epoll batch
+    _Atomic int wantsQueueSpace;  // Set while `stalled` is non-empty
+} EventLoop;
+
+// Fixed pool of worker threads fed by a bounded job queue. When the queue is
+// full, event loops stop reading the affected sockets, so the TCP window
+// pushes back on clients instead of the server queueing without limit.
+typedef struct WorkerPool {
+    JobQueue queue;
+    sem_t available;
+    EventLoop* loops;
+    int loopCount;
+    _Atomic long long jobs;
+    _Atomic long long requests;
+    _Atomic long long totalWaitNanos;
+    _Atomic long long maxWaitNanos;
+    _Atomic long long stalls;
+    _Atomic size_t maxDepth;
+    _Atomic int started;          // Set once the queue and workers exist
+} WorkerPool;
+
+WorkerPool pool;
+
+void wakeLoop(EventLoop* loop) {
+    uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("Eventfd write error");
+    }
+}
+
+void atomicMax(_Atomic long long* target, long long value) {
+    long long current = atomic_load(target);
+    while (value > current && !atomic_compare_exchange_weak(target, &current, value)) {
+    }
+}
+
+void* workerThread(void* arg) {
+    (void)arg;
+
+    while (1) {
+        sem_wait(&pool.available);
+
+        // The semaphore counts published jobs, but a slot claimed ahead of ours
+        // may still be mid-publish, so retry until our job shows up.
+        Job* job;
+        while ((job = (Job*)jobQueuePop(&pool.queue)) == NULL) {
+            sched_yield();
+        }
+
+        long long wait = nowNanos() - job->enqueuedAt;
+        atomic_fetch_add(&pool.totalWaitNanos, wait);
+        atomicMax(&pool.maxWaitNanos, wait);
+        atomic_fetch_add(&pool.jobs, 1);
+
+        // A slot just opened up; let loops with stalled connections retry
+        for (int i = 0; i < pool.loopCount; i++) {
+            EventLoop* loop = &pool.loops[i];
+            if (atomic_load(&loop->wantsQueueSpace) && atomic_exchange(&loop->wantsQueueSpace, 0)) {
+                wakeLoop(loop);
+            }
+        }
+
+        // A RANGE request ends the job; its first chunks go out with the
+        // job and the event loop streams the rest as the socket drains
+        int count;
+        answerRequests(job->requests, job->len, &job->output, &count, &job->error, &job->scan);
+        pumpScan(&job->scan, &job->output, OUTPUT_HIGH_WATER);
+        atomic_fetch_add(&pool.requests, count);
+
+        EventLoop* loop = job->conn->loop;
+        pthread_mutex_lock(&loop->completedLock);
+        job->next = loop->completed;
+        loop->completed = job;
+        pthread_mutex_unlock(&loop->completedLock);
+        wakeLoop(loop);
+    }
+
+    return NULL;
+}
+
+// Hands the next batch of complete requests to the worker pool. Only one
+// job per connection is outstanding at a time so replies stay in order.
+void dispatchInput(Connection* conn) {
+    if (conn->inFlight || conn->stalled || replyPending(&conn->scan)) {
+        return;
+    }
+    size_t len = completeRequestBytes(conn->in.data, conn->in.len, MAX_JOB_BYTES);
+    if (len == 0) {
+        return;
+    }
+
+    Job* job = (Job*)calloc(1, sizeof(Job));
+    job->conn = conn;
+    job->requests = (char*)malloc(len);
+    job->len = len;
+    memcpy(job->requests, conn->in.data, len);
+    job->enqueuedAt = nowNanos();
+
+    if (jobQueuePush(&pool.queue, job) < 0) {
+        // Ask workers for a wakeup first, then retry once: a worker that
+        // drained the queue before seeing the flag would otherwise leave this
+        // connection stalled forever.
+        EventLoop* loop = conn->loop;
+        atomic_store(&loop->wantsQueueSpace, 1);
+        if (jobQueuePush(&pool.queue, job) < 0) {
+            free(job->requests);
+            free(job);
+            conn->stalled = 1;
+            conn->next = loop->stalled;
+            loop->stalled = conn;
+            atomic_fetch_add(&pool.stalls, 1);
+            return;
+        }
+    }
+
+    size_t depth = jobQueueDepth(&pool.queue);
+    size_t maxDepth = atomic_load(&pool.maxDepth);
+    while (depth > maxDepth && !atomic_compare_exchange_weak(&pool.maxDepth, &maxDepth, depth)) {
+    }
+
+    sem_post(&pool.available);
+    bufferConsume(&conn->in, len);
+    conn->inFlight = 1;
+}
+
+// Takes the connection off epoll and closes the socket. The struct itself
+// is freed only once no queued job, parked WAIT or stall list still points
+// at it, and never before the current epoll batch is done (it may still hold
+// an event).
+void releaseConnection(Connection* conn) {
+    if (!conn->closing) {
+        epoll_ctl(conn->loop->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->closing = 1;
+        // A WAIT that already ended is on the woken list and comes back here
+        if (conn->scan.waiting && conn->inFlight && waitTableCancel(&keyWaits, &conn->waiter)) {
+            conn->inFlight = 0;
+        }
+    }
+    if (!conn->inFlight && !conn->stalled) {
+        conn->next = conn->loop->released;
+        conn->loop->released = conn;
+    }
+}
+
+void freeReleasedConnections(EventLoop* loop) {
+    while (loop->released != NULL) {
+        Connection* conn = loop->released;
+        loop->released = conn->next;
+        endScan(&conn->scan);
+        bufferFree(&conn->in);
+        bufferFree(&conn->out);
+        free(conn);
+    }
+}
+
+int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Wait table callback for a parked WAIT: hands the connection back to its
+// loop like a finished job
+void waitEnded(KeyWaiter* waiter) {
+    Connection* conn = (Connection*)waiter->ctx;
+    EventLoop* loop = conn->loop;
+    pthread_mutex_lock(&loop->completedLock);
+    conn->nextWoken = loop->woken;
+    loop->woken = conn;
+    pthread_mutex_unlock(&loop->completedLock);
+    wakeLoop(loop);
+}
+
+void acceptConnections(EventLoop* loop) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept4(loop->listenFd, (struct sockaddr*)&client_addr, &client_addr_len, SOCK_NONBLOCK);
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Accept error");
+            }
+            return;
+        }
+
+        logConnection(&client_addr);
+
+        Connection* conn = createConnection(client_socket);
+        conn->loop = loop;
+        conn->waiter.wake = waitEnded;
+        conn->waiter.ctx = conn;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            perror("Epoll add error");
+            closeConnection(conn);
+        }
+    }
+}
+
+// Drains the socket (edge-triggered) and answers what arrived. Reading
+// pauses while too much output is queued or while requests are backed up
+// behind an outstanding job or parked WAIT; a later EPOLLOUT edge, job
+// completion or wait table wakeup resumes it. A RANGE stream is produced
+// only as fast as the socket takes it. Returns -1 when the connection
+// should close.
+int serviceConnection(Connection* conn) {
+    while (1) {
+        if (conn->out.len >= OUTPUT_HIGH_WATER) {
+            int flushed = flushOutput(conn);
+            if (flushed < 0) {
+                return -1;
+            }
+            if (flushed > 0) {
+                return 0;
+            }
+        }
+
+        if (conn->scan.waiting && !conn->inFlight) {
+            conn->inFlight = parkWait(&conn->scan, &conn->waiter, &conn->out);
+            continue;
+        }
+
+        if (config.workers > 0) {
+            pumpScan(&conn->scan, &conn->out, OUTPUT_HIGH_WATER);
+            if (conn->scan.active) {
+                continue;
+            }
+            dispatchInput(conn);
+        } else if (!conn->inFlight) {
+            if (processInput(conn) < 0) {
+                flushOutput(conn);
+                return -1;
+            }
+            if (replyPending(&conn->scan)) {
+                continue;
+            }
+        }
+        // Stop reading while complete requests are backed up behind an
+        // outstanding job or WAIT; a partial frame always needs more input.
+        if ((conn->inFlight || conn->stalled) && conn->in.len >= INPUT_HIGH_WATER) {
+            break;
+        }
+
+        if (conn->peerClosed) {
+            break;
+        }
+
+        ssize_t n = readChunk(conn);
+        if (n == 0) {
+            conn->peerClosed = 1; // Answer what is still buffered first
+            continue;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+    }
+
+    if (config.workers > 0) {
+        dispatchInput(conn);
+    }
+
+    if (flushOutput(conn) < 0) {
+        return -1;
+    }
+
+    // After EOF, stay open only until the last buffered request is answered
+    if (conn->peerClosed && !conn->inFlight && !conn->stalled && !replyPending(&conn->scan) && conn->out.len == 0 &&
+        completeRequestBytes(conn->in.data, conn->in.len, MAX_JOB_BYTES) == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void handleCompletions(EventLoop* loop) {
+    uint64_t count;
+    if (read(loop->wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Eventfd read error");
+    }
+
+    pthread_mutex_lock(&loop->completedLock);
+    Job* job = loop->completed;
+    loop->completed = NULL;
+    Connection* woken = loop->woken;
+    loop->woken = NULL;
+    pthread_mutex_unlock(&loop->completedLock);
+
+    while (woken != NULL) {
+        Connection* next = woken->nextWoken;
+        woken->inFlight = 0;
+        if (woken->closing) {
+            releaseConnection(woken);
+        } else {
+            finishWait(&woken->scan, &woken->out, woken->waiter.result);
+            if (serviceConnection(woken) < 0) {
+                releaseConnection(woken);
+            }
+        }
+        woken = next;
+    }
+
+    while (job != NULL) {
+        Job* next = job->next;
+        Connection* conn = job->conn;
+        conn->inFlight = 0;
+        conn->scan = job->scan;
+
+        if (conn->closing) {
+            releaseConnection(conn);
+        } else {
+            bufferAppend(&conn->out, job->output.data, job->output.len);
+            if (job->error) {
+                flushOutput(conn);
+                releaseConnection(conn);
+            } else if (serviceConnection(conn) < 0) {
+                releaseConnection(conn);
+            }
+        }
+
+        free(job->requests);
+        bufferFree(&job->output);
+        free(job);
+        job = next;
+    }
+
+    // Give stalled connections another try now that the queue has drained
+    Connection* conn = loop->stalled;
+    loop->stalled = NULL;
+    while (conn != NULL) {
+        Connection* next = conn->next;
+        conn->stalled = 0;
+        conn->next = NULL;
+        if (conn->closing) {
+            releaseConnection(conn);
+        } else if (serviceConnection(conn) < 0) {
+            releaseConnection(conn);
+        }
+        conn = next;
+    }
+}
+
+void* eventLoop(void* arg) {
+    EventLoop* loop = (EventLoop*)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int count = epoll_wait(loop->epollFd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Epoll wait error");
+            return NULL;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                acceptConnections(loop);
+                continue;
+            }
+            if (events[i].data.ptr == loop) {
+                handleCompletions(loop);
+                continue;
+            }
+
+            Connection* conn = (Connection*)events[i].data.ptr;
+            if (conn->closing) {
+                continue;
+            }
+            if ((events[i].events & EPOLLERR) || serviceConnection(conn) < 0) {
+                releaseConnection(conn);
+            }
+        }
+
+        freeReleasedConnections(loop);
+    }
+}
+
+void printArenaStats(const char* label, NodeArena* arena) {
+    ArenaStats nodes;
+    arenaGetStats(arena, &nodes);
+    printf("[stats] %s: %zu live, %zu cached, %zu slab(s) of %d KB, occupancy %.1f%%, "
+           "fragmentation %.1f%%\n",
+           label, nodes.liveObjects, nodes.cachedObjects, nodes.slabs, ARENA_SLAB_BYTES / 1024,
+           nodes.occupancy * 100, nodes.fragmentation * 100);
+}
+
+void* statsThread(void* arg) {
+    (void)arg;
+    long long lastJobs = 0, lastWait = 0, lastRequests = 0;
+
+    while (1) {
+        sleep(config.statsInterval);
+
+        // The job queue only exists with --workers
+        if (atomic_load(&pool.started)) {
+            long long jobs = atomic_load(&pool.jobs);
+            long long requests = atomic_load(&pool.requests);
+            long long wait = atomic_load(&pool.totalWaitNanos);
+            long long deltaJobs = jobs - lastJobs;
+
+            printf("[stats] queue depth %zu/%zu (max %zu), %.0f requests/sec, "
+                   "avg queue wait %.1f us, max %.1f us, stalls %lld\n",
+                   jobQueueDepth(&pool.queue), jobQueueCapacity(&pool.queue), atomic_exchange(&pool.maxDepth, 0),
+                   (double)(requests - lastRequests) / config.statsInterval,
+                   deltaJobs > 0 ? (wait - lastWait) / 1000.0 / deltaJobs : 0.0,
+                   atomic_exchange(&pool.maxWaitNanos, 0) / 1000.0, atomic_load(&pool.stalls));
+            lastJobs = jobs;
+            lastRequests = requests;
+            lastWait = wait;
+        }
+        if (walEnabled) {
+            pthread_mutex_lock(&wal.lock);
+            printf("[stats] WAL %llu record(s) in %llu write(s), %.1f per write\n",
+                   (unsigned long long)wal.records, (unsigned long long)wal.batches,
+                   wal.batches ? (double)wal.records / wal.batches : 0.0);
+            pthread_mutex_unlock(&wal.lock);
+        }
+        if (treeIndex == INDEX_BTREE) {
+            printArenaStats("leaves", &bptLeafArena);
+            printArenaStats("inner nodes", &bptInnerArena);
+        } else {
+            printArenaStats("nodes", treeIndex == INDEX_OAVL ? &oavlArena : &nodeArena);
+        }
+        if (frozenThreshold > 0) {
+            pthread_rwlock_rdlock(&treeLock);
+            printf("[stats] lookup array: %zu key(s), %zu added / %zu removed since, %ld rebuild(s), "
+                   "last %.1f ms\n",
+                   frozenKeys->count, frozenAdded.count, frozenRemoved.count, frozenRebuilds, frozenLastBuildMs);
+            pthread_rwlock_unlock(&treeLock);
+        }
+        if (relaxedBalance) {
+            pthread_rwlock_rdlock(&treeLock);
+            printf("[stats] relaxed balance: height %d (limit %d), %ld node(s) rebalanced, %ld write(s) over the limit%s\n",
+                   getHeight(sharedRoot), relaxedHeightLimit(getSize(sharedRoot)), relaxedFixed, relaxedForced,
+                   isPending(sharedRoot) ? ", catching up" : "");
+            pthread_rwlock_unlock(&treeLock);
+        }
+        if (snapshotsTaken > 0) {
+            pthread_rwlock_rdlock(&treeLock);
+            printf("[stats] snapshots: %d open, %ld taken, %ld node(s) copied, %zu old version(s) waiting\n",
+                   atomic_load(&snapshotsOpen), snapshotsTaken, versionsCopied, retiredCount - retiredHead);
+            pthread_rwlock_unlock(&treeLock);
+        }
+        if (bloomEnabled) {
+            long rejected = atomic_load(&bloomRejected);
+            long falsePositives = atomic_load(&bloomFalsePositives);
+            pthread_rwlock_rdlock(&treeLock);
+            printf("[stats] bloom filter: %zu key(s) in %zu KB, %ld miss(es) ruled out, %ld false positive(s), "
+                   "rate %.2f%% (expected %.2f%%)\n",
+                   bloom.keys, bloomBytes(&bloom) / 1024, rejected, falsePositives,
+                   rejected + falsePositives ? 100.0 * falsePositives / (rejected + falsePositives) : 0.0,
+                   100 * bloomExpectedFpr(&bloom));
+            pthread_rwlock_unlock(&treeLock);
+        }
+        if (treeIndex == INDEX_OAVL) {
+            EbrStats ebr;
+            ebrGetStats(&ebr);
+            printf("[stats] reclamation: epoch %llu, %llu node(s) / %llu bytes waiting, lag %llu epoch(s), "
+                   "%llu freed\n",
+                   (unsigned long long)ebr.epoch, (unsigned long long)ebr.pendingNodes,
+                   (unsigned long long)ebr.pendingBytes, (unsigned long long)ebr.lag,
+                   (unsigned long long)ebr.freedNodes);
+        }
+        fflush(stdout);
+    }
+
+    return NULL;
+}
+
+int startWorkerPool(EventLoop* loops, int loopCount) {
+    if (jobQueueInit(&pool.queue, config.queueSize) < 0) {
+        perror("Job queue allocation error");
+        return -1;
+    }
+    sem_init(&pool.available, 0, 0);
+    pool.loops = loops;
+    pool.loopCount = loopCount;
+
+    for (int i = 0; i < config.workers; i++) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, workerThread, NULL) != 0) {
+            perror("Thread creation error");
+            return -1;
+        }
+        pthread_detach(thread_id);
+    }
+
+    atomic_store(&pool.started, 1);
+    printf("Running %d worker thread(s), job queue capacity %zu.\n", config.workers, jobQueueCapacity(&pool.queue));
+    return 0;
+}
+
+int runEpollServer(int server_socket) {
+    int loops = threadCount();
+
+    EventLoop* eventLoops = (EventLoop*)calloc(loops, sizeof(EventLoop));
+    for (int i = 0; i < loops; i++) {
+        EventLoop* loop = &eventLoops[i];
+        loop->listenFd = config.reusePort ? createListenSocket(1) : server_socket;
+        if (loop->listenFd < 0 || setNonBlocking(loop->listenFd) < 0) {
+            perror("Listener setup error");
+            return 1;
+        }
+        pthread_mutex_init(&loop->completedLock, NULL);
+        loop->epollFd = epoll_create1(0);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK);
+        if (loop->epollFd < 0 || loop->wakeFd < 0) {
+            perror("Epoll creation error");
+            return 1;
+        }
+
+        struct epoll_event event;
+        event.events = config.reusePort ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = NULL;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->listenFd, &event) < 0) {
+            perror("Epoll add error");
+            return 1;
+        }
+
+        event.events = EPOLLIN;
+        event.data.ptr = loop;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event) < 0) {
+            perror("Epoll add error");
+            return 1;
+        }
+    }
+
+    if (config.workers > 0 && startWorkerPool(eventLoops, loops) < 0) {
+        return 1;
+    }
+
+    printf("Running %d event loop thread(s)%s.\n", loops, config.reusePort ? " with SO_REUSEPORT listeners" : "");
+
+    for (int i = 1; i < loops; i++) {
+        if (pthread_create(&eventLoops[i].thread, NULL, eventLoop, &eventLoops[i]) != 0) {
+            perror("Thread creation error");
+            return 1;
+        }
+    }
+    eventLoop(&eventLoops[0]);
+    return 1;
+}
+
+#define URING_ENTRIES 4096
+#define URING_BUFFERS 1024
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+
+// user_data tags (connections are at least 8-byte aligned)
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_RECV 2
+#define URING_TAG_SEND 3
+#define URING_TAG_CANCEL 4
+#define URING_TAG_WAKE 5
+#define URING_TAG_MASK 7
+
+// Connection state for the io_uring backend. Replies accumulate in `out`
+// while a send owns `sending`; the two buffers are swapped when the send
+// completes, so the kernel never sees memory that a realloc could move.
+typedef struct UringConnection {
+    int fd;
+    Buffer in;
+    Buffer out;
+    Buffer sending;
+    size_t sendPos;
+    int recvArmed;    // A multishot recv is outstanding
+    int recvPaused;   // Too much output queued; recv was cancelled
+    int sendInFlight;
+    int peerClosed;
+    int closing;
+    int parked;       // A WAIT is registered in keyWaits
+    ScanCursor scan;
+    KeyWaiter waiter;
+    struct UringLoop* loop;
+    struct UringConnection* nextWoken;
+} UringConnection;
+
+// One ring per thread with multishot accept on the listening socket and
+// multishot recv into a ring of provided buffers. Everything queued while
+// handling a batch of completions goes out in the next io_uring_enter. A
+// read on an eventfd brings back connections whose WAIT ended elsewhere.
+typedef struct UringLoop {
+    Uring ring;
+    UringBufferRing buffers;
+    int listenFd;
+    int wakeFd;
+    uint64_t wakeCount;               // The eventfd read lands here
+    pthread_mutex_t wokenLock;
+    struct UringConnection* woken;    // Connections whose parked WAIT has ended
+    pthread_t thread;
+} UringLoop;
+
+void uringArmAccept(UringLoop* loop) {
+    struct io_uring_sqe* sqe = uringGetSqe(&loop->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = URING_TAG_ACCEPT;
+}
+
+void uringArmWake(UringLoop* loop) {
+    struct io_uring_sqe* sqe = uringGetSqe(&loop->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wakeFd;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->wakeCount;
+    sqe->len = sizeof(loop->wakeCount);
+    sqe->user_data = URING_TAG_WAKE;
+}
+
+void uringArmRecv(UringLoop* loop, UringConnection* conn) {
+    struct io_uring_sqe* sqe = uringGetSqe(&loop->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_TAG_RECV;
+    conn->recvArmed = 1;
+}
+
+void uringCancelRecv(UringLoop* loop, UringConnection* conn) {
+    struct io_uring_sqe* sqe = uringGetSqe(&loop->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)conn | URING_TAG_RECV;
+    sqe->user_data = URING_TAG_CANCEL;
+}
+
+void uringSubmitSend(UringLoop* loop, UringConnection* conn) {
+    struct io_uring_sqe* sqe = uringGetSqe(&loop->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->sending.data + conn->sendPos);
+    sqe->len = conn->sending.len - conn->sendPos;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_TAG_SEND;
+    conn->sendInFlight = 1;
+}
+
+// Starts a send of everything in `out` unless one is already running
+void uringStartSend(UringLoop* loop, UringConnection* conn) {
+    if (conn->sendInFlight || conn->closing || conn->out.len == 0) {
+        return;
+    }
+    Buffer swap = conn->sending;
+    conn->sending = conn->out;
+    conn->out = swap;
+    conn->out.len = 0;
+    conn->sendPos = 0;
+    uringSubmitSend(loop, conn);
+}
+
+// Shuts the socket down so outstanding operations complete, then frees the
+// connection once the last of them has been reaped
+void uringCloseConnection(UringConnection* conn) {
+    if (!conn->closing) {
+        conn->closing = 1;
+        shutdown(conn->fd, SHUT_RDWR);
+        // A WAIT that already ended is on the woken list and comes back here
+        if (conn->parked && waitTableCancel(&keyWaits, &conn->waiter)) {
+            conn->parked = 0;
+        }
+    }
+    if (!conn->recvArmed && !conn->sendInFlight && !conn->parked) {
+        endScan(&conn->scan);
+        close(conn->fd);
+        bufferFree(&conn->in);
+        bufferFree(&conn->out);
+        bufferFree(&conn->sending);
+        free(conn);
+    }
+}
+
+size_t uringPendingOutput(UringConnection* conn) {
+    return conn->out.len + conn->sending.len - conn->sendPos;
+}
+
+// Answers buffered requests and queues the replies. Stops receiving while
+// the client isn't reading its replies, and resumes once they drain.
+// Returns -1 if the connection was closed.
+int uringServiceConnection(UringLoop* loop, UringConnection* conn) {
+    while (uringPendingOutput(conn) < OUTPUT_HIGH_WATER) {
+        pumpScan(&conn->scan, &conn->out, OUTPUT_HIGH_WATER);
+        if (conn->scan.active) {
+            break;
+        }
+        if (conn->scan.waiting) {
+            if (conn->parked || parkWait(&conn->scan, &conn->waiter, &conn->out)) {
+                conn->parked = 1;
+                break;
+            }
+            continue;
+        }
+
+        int count, error;
+        size_t used = answerRequests(conn->in.data, conn->in.len, &conn->out, &count, &error, &conn->scan);
+        bufferConsume(&conn->in, used);
+        if (error) {
+            uringStartSend(loop, conn);
+            uringCloseConnection(conn);
+            return -1;
+        }
+        if (!replyPending(&conn->scan)) {
+            break;
+        }
+    }
+
+    uringStartSend(loop, conn);
+
+    size_t pending = uringPendingOutput(conn);
+    if (pending >= OUTPUT_HIGH_WATER && conn->recvArmed && !conn->recvPaused) {
+        conn->recvPaused = 1;
+        uringCancelRecv(loop, conn);
+    } else if (pending < OUTPUT_HIGH_WATER / 2 && conn->recvPaused) {
+        conn->recvPaused = 0;
+        if (!conn->recvArmed && !conn->peerClosed) {
+            uringArmRecv(loop, conn);
+        }
+    }
+
+    if (conn->peerClosed && pending == 0 && !replyPending(&conn->scan) && completeRequestBytes(conn->in.data, conn->in.len, MAX_JOB_BYTES) == 0) {
+        uringCloseConnection(conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait table callback for a parked WAIT, from any thread
+void uringWaitEnded(KeyWaiter* waiter) {
+    UringConnection* conn = (UringConnection*)waiter->ctx;
+    UringLoop* loop = conn->loop;
+    pthread_mutex_lock(&loop->wokenLock);
+    conn->nextWoken = loop->woken;
+    loop->woken = conn;
+    pthread_mutex_unlock(&loop->wokenLock);
+    uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("Eventfd write error");
+    }
+}
+
+// Answers the WAITs that ended and carries on with the requests behind them
+void uringHandleWake(UringLoop* loop) {
+    pthread_mutex_lock(&loop->wokenLock);
+    UringConnection* conn = loop->woken;
+    loop->woken = NULL;
+    pthread_mutex_unlock(&loop->wokenLock);
+
+    while (conn != NULL) {
+        UringConnection* next = conn->nextWoken;
+        conn->parked = 0;
+        if (conn->closing) {
+            uringCloseConnection(conn);
+        } else {
+            finishWait(&conn->scan, &conn->out, conn->waiter.result);
+            if (uringServiceConnection(loop, conn) == 0 && !conn->recvArmed && !conn->recvPaused && !conn->peerClosed) {
+                uringArmRecv(loop, conn);
+            }
+        }
+        conn = next;
+    }
+    uringArmWake(loop);
+}
+
+void uringHandleAccept(UringLoop* loop, int res, unsigned flags) {
+    if (res >= 0) {
+        UringConnection* conn = (UringConnection*)calloc(1, sizeof(UringConnection));
+        conn->fd = res;
+        conn->loop = loop;
+        conn->waiter.wake = uringWaitEnded;
+        conn->waiter.ctx = conn;
+        if (!config.quiet) {
+            struct sockaddr_in client_addr;
+            socklen_t client_addr_len = sizeof(client_addr);
+            if (getpeername(res, (struct sockaddr*)&client_addr, &client_addr_len) == 0) {
+                logConnection(&client_addr);
+            }
+        }
+        uringArmRecv(loop, conn);
+    } else if (res != -EAGAIN && res != -EINTR) {
+        fprintf(stderr, "Accept error: %s\n", strerror(-res));
+    }
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uringArmAccept(loop);
+    }
+}
+
+void uringHandleRecv(UringLoop* loop, UringConnection* conn, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recvArmed = 0;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned short id = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && !conn->closing) {
+            bufferAppend(&conn->in, uringBuffer(&loop->buffers, id), res);
+        }
+        uringBufferRingAdd(&loop->buffers, id);
+    }
+
+    if (conn->closing) {
+        uringCloseConnection(conn);
+        return;
+    }
+
+    if (res == 0) {
+        conn->peerClosed = 1;
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        uringCloseConnection(conn);
+        return;
+    }
+
+    if (uringServiceConnection(loop, conn) < 0) {
+        return;
+    }
+
+    // Multishot recv ends on errors such as running out of buffers; re-arm
+    // it unless the peer is gone or we paused it on purpose
+    if (!conn->recvArmed && !conn->recvPaused && !conn->peerClosed) {
+        uringArmRecv(loop, conn);
+    }
+}
+
+void uringHandleSend(UringLoop* loop, UringConnection* conn, int res) {
+    conn->sendInFlight = 0;
+
+    if (conn->closing) {
+        uringCloseConnection(conn);
+        return;
+    }
+    if (res < 0) {
+        uringCloseConnection(conn);
+        return;
+    }
+
+    conn->sendPos += res;
+    if (conn->sendPos < conn->sending.len) {
+        uringSubmitSend(loop, conn);
+        return;
+    }
+
+    conn->sending.len = 0;
+    conn->sendPos = 0;
+    uringServiceConnection(loop, conn);
+}
+
+void* uringEventLoop(void* arg) {
+    UringLoop* loop = (UringLoop*)arg;
+    uringArmAccept(loop);
+    uringArmWake(loop);
+
+    while (1) {
+        int submitted = uringSubmitAndWait(&loop->ring, 1);
+        if (submitted < 0 && submitted != -EBUSY && submitted != -EAGAIN) {
+            fprintf(stderr, "io_uring_enter error: %s\n", strerror(-submitted));
+            return NULL;
+        }
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = uringPeekCqe(&loop->ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uringCqeSeen(&loop->ring);
+
+            UringConnection* conn = (UringConnection*)(uintptr_t)(data & ~(uint64_t)URING_TAG_MASK);
+            switch (data & URING_TAG_MASK) {
+                case URING_TAG_ACCEPT:
+                    uringHandleAccept(loop, res, flags);
+                    break;
+                case URING_TAG_RECV:
+                    uringHandleRecv(loop, conn, res, flags);
+                    break;
+                case URING_TAG_SEND:
+                    uringHandleSend(loop, conn, res);
+                    break;
+                case URING_TAG_WAKE:
+                    uringHandleWake(loop);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Buffers consumed in this batch go back before the next submit
+        uringBufferRingPublish(&loop->buffers);
+    }
+}
+
+int uringLoopInit(UringLoop* loop) {
+    int result = uringInit(&loop->ring, URING_ENTRIES, IORING_SETUP_COOP_TASKRUN);
+    if (result == -EINVAL) {
+        result = uringInit(&loop->ring, URING_ENTRIES, 0);
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    result = uringBufferRingInit(&loop->ring, &loop->buffers, URING_BUFFERS, URING_BUFFER_SIZE, URING_BUFFER_GROUP);
+    if (result < 0) {
+        uringDestroy(&loop->ring);
+        return result;
+    }
+
+    loop->wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (loop->wakeFd < 0) {
+        result = -errno;
+        uringDestroy(&loop->ring);
+        return result;
+    }
+    pthread_mutex_init(&loop->wokenLock, NULL);
+    return 0;
+}
+
+// Returns -1 before serving anything if io_uring is unusable here, so the
+// caller can fall back to epoll
+int runUringServer(int server_socket) {
+    if (!uringKernelSupportsMultishotRecv()) {
+        printf("io_uring multishot recv needs Linux 6.0 or newer.\n");
+        return -1;
+    }
+
+    int loops = threadCount();
+    UringLoop* uringLoops = (UringLoop*)calloc(loops, sizeof(UringLoop));
+    for (int i = 0; i < loops; i++) {
+        UringLoop* loop = &uringLoops[i];
+        int result = uringLoopInit(loop);
+        if (result < 0) {
+            printf("io_uring setup failed: %s.\n", strerror(-result));
+            for (int j = 0; j < i; j++) {
+                uringDestroy(&uringLoops[j].ring);
+            }
+            free(uringLoops);
+            return -1;
+        }
+
+        loop->listenFd = config.reusePort ? createListenSocket(1) : server_socket;
+        if (loop->listenFd < 0) {
+            return 1;
+        }
+    }
+
+    if (config.workers > 0) {
+        printf("Note: --workers is ignored by the io_uring backend; requests are answered in the ring threads.\n");
+    }
+    printf("Running %d io_uring thread(s)%s.\n", loops, config.reusePort ? " with SO_REUSEPORT listeners" : "");
+
+    for (int i = 1; i < loops; i++) {
+        if (pthread_create(&uringLoops[i].thread, NULL, uringEventLoop, &uringLoops[i]) != 0) {
+            perror("Thread creation error");
+            return 1;
+        }
+    }
+    uringEventLoop(&uringLoops[0]);
+    return 1;
+}
+
+void printUsage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --port N      Port to listen on (default 1234)\n");
+    printf("  --threads     Use one thread per connection instead of epoll\n");
+    printf("  --io-uring    Use io_uring instead of epoll when the kernel supports it\n");
+    printf("  --loops N     Event-loop (or --reuseport acceptor) threads (default: one per core)\n");
+    printf("  --reuseport   Give each thread its own SO_REUSEPORT listener\n");
+    printf("  --backlog N   listen() backlog (default 4096)\n");
+    printf("  --workers N   Answer requests on N worker threads (default 0: in the event loop)\n");
+    printf("  --queue N     Worker job queue capacity (default 1024)\n");
+    printf("  --stats N     Print server statistics every N seconds\n");
+    printf("  --quiet       Don't log each new connection\n");
+    printf("  --wal FILE    Log inserts and removals to FILE and replay it at startup\n");
+    printf("  --durability always|interval|os\n");
+    printf("                When a logged write counts as done: after fdatasync (default),\n");
+    printf("                with fdatasync every --flush-ms in the background, or after write()\n");
+    printf("  --flush-ms N  Sync interval for --durability interval (default 5)\n");
+    printf("  --snapshot FILE\n");
+    printf("                Load the tree from this checkpoint at startup (then replay the WAL tail)\n");
+    printf("  --checkpoint N\n");
+    printf("                Rewrite the --snapshot checkpoint every N seconds\n");
+    printf("  --index avl|oavl|btree\n");
+    printf("                Tree behind the server: AVL under one read-write lock (default),\n");
+    printf("                an optimistic AVL with lock-free reads and per-node write locks,\n");
+    printf("                or a B+-tree with SIMD node search under the read-write lock\n");
+    printf("  --frozen N    Answer lookups from a frozen, cache-friendly copy of the keys plus\n");
+    printf("                the changes since; rebuild it in the background after N changes\n");
+    printf("  --helper-threads N\n");
+    printf("                Split large SEARCH and INSERT frames and checkpoint loads across\n");
+    printf("                N helper threads\n");
+    printf("  --bloom N     Rule out most misses with a counting Bloom filter sized for N keys\n");
+    printf("  --relaxed     Let AVL writes skip rotations; a background thread rebalances\n");
+    printf("                with the CPU time they leave idle\n");
+}
+
+int parseArguments(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"threads", no_argument, NULL, 't'},
+        {"io-uring", no_argument, NULL, 'u'},
+        {"loops", required_argument, NULL, 'l'},
+        {"reuseport", no_argument, NULL, 'r'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"workers", required_argument, NULL, 'w'},
+        {"queue", required_argument, NULL, 'Q'},
+        {"stats", required_argument, NULL, 's'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"wal", required_argument, NULL, 'W'},
+        {"durability", required_argument, NULL, 'D'},
+        {"flush-ms", required_argument, NULL, 'F'},
+        {"snapshot", required_argument, NULL, 'S'},
+        {"checkpoint", required_argument, NULL, 'C'},
+        {"index", required_argument, NULL, 'I'},
+        {"frozen", required_argument, NULL, 'Z'},
+        {"helper-threads", required_argument, NULL, 'L'},
+        {"bloom", required_argument, NULL, 'N'},
+        {"relaxed", no_argument, NULL, 'R'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:tul:rb:w:Q:s:qW:D:F:S:C:I:Z:L:N:Rh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 't':
+                config.threadPerConnection = 1;
+                break;
+            case 'u':
+                config.ioUring = 1;
+                break;
+            case 'l':
+                config.loops = atoi(optarg);
+                break;
+            case 'r':
+                config.reusePort = 1;
+                break;
+            case 'b':
+                config.backlog = atoi(optarg);
+                break;
+            case 'w':
+                config.workers = atoi(optarg);
+                break;
+            case 'Q':
+                config.queueSize = atoi(optarg);
+                break;
+            case 's':
+                config.statsInterval = atoi(optarg);
+                break;
+            case 'q':
+                config.quiet = 1;
+                break;
+            case 'W':
+                config.walPath = optarg;
+                break;
+            case 'D':
+                if (strcmp(optarg, "always") == 0) {
+                    config.durability = WAL_DURABILITY_ALWAYS;
+                } else if (strcmp(optarg, "interval") == 0) {
+                    config.durability = WAL_DURABILITY_INTERVAL;
+                } else if (strcmp(optarg, "os") == 0) {
+                    config.durability = WAL_DURABILITY_OS;
+                } else {
+                    printUsage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'F':
+                config.flushMs = atoi(optarg);
+                break;
+            case 'S':
+                config.snapshotPath = optarg;
+                break;
+            case 'C':
+                config.checkpointInterval = atoi(optarg);
+                break;
+            case 'I':
+                if (strcmp(optarg, "avl") == 0) {
+                    config.index = INDEX_AVL;
+                } else if (strcmp(optarg, "oavl") == 0) {
+                    config.index = INDEX_OAVL;
+                } else if (strcmp(optarg, "btree") == 0) {
+                    config.index = INDEX_BTREE;
+                } else {
+                    printUsage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'Z':
+                config.frozenThreshold = atoi(optarg);
+                break;
+            case 'L':
+                config.helperThreads = atoi(optarg);
+                break;
+            case 'N':
+                config.bloomKeys = atol(optarg);
+                break;
+            case 'R':
+                config.relaxed = 1;
+                break;
+            default:
+                printUsage(argv[0]);
+                return -1;
+        }
+    }
+    if (config.checkpointInterval > 0 && config.snapshotPath == NULL) {
+        printf("--checkpoint needs --snapshot FILE.\n");
+        return -1;
+    }
+    if (config.frozenThreshold > 0 && config.index == INDEX_OAVL) {
+        printf("--frozen needs --index avl or btree.\n");
+        return -1;
+    }
+    if (config.bloomKeys > 0 && config.index == INDEX_OAVL) {
+        printf("--bloom needs --index avl or btree.\n");
+        return -1;
+    }
+    if (config.relaxed && config.index != INDEX_AVL) {
+        printf("--relaxed needs --index avl.\n");
+        return -1;
+    }
+    return 0;
+}
+
+void* checkpointThread(void* arg) {
+    (void)arg;
+    while (1) {
+        sleep(config.checkpointInterval);
+        long long start = nowNanos();
+        if (writeCheckpoint(config.snapshotPath) == 0 && !config.quiet) {
+            printf("Checkpoint written in %.1f ms.\n", (nowNanos() - start) / 1e6);
+        }
+    }
+    return NULL;
+}
+
+// Loads the checkpoint (if any) and replays the WAL written after it.
+// Returns the number of keys and changes restored, or -1 on error.
+long restoreTree() {
+    long restored = 0;
+    uint64_t walFrom = 0;
+
+    if (config.snapshotPath != NULL) {
+        long long start = nowNanos();
+        Snapshot snapshot;
+        int result = snapshotOpen(config.snapshotPath, &snapshot);
+        if (result < 0) {
+            perror("Checkpoint load error");
+            return -1;
+        }
+        if (result == 0) {
+            if (treeIndex == INDEX_OAVL) {
+                atomic_store(&optimisticTree.holder.right,
+                             buildOptimisticTree(&snapshot, 0, snapshot.count, &optimisticTree.holder));
+            } else if (treeIndex == INDEX_BTREE) {
+                BptBuilder builder;
+                if (bptBuildStart(&builder, &bplusTree, snapshot.count) < 0) {
+                    perror("Checkpoint load error");
+                    snapshotClose(&snapshot);
+                    return -1;
+                }
+                for (uint64_t i = 0; i < snapshot.count; i++) {
+                    bptBuildAdd(&builder, snapshotKey(&snapshot, i));
+                }
+                bptBuildFinish(&builder);
+            } else {
+                sharedRoot = buildBalanced(checkpointKeyAt, &snapshot, snapshot.count);
+            }
+            restored = snapshot.count;
+            walFrom = snapshot.walOffset;
+            snapshotClose(&snapshot);
+            printf("Loaded %ld key(s) from %s in %.1f ms.\n", restored, config.snapshotPath,
+                   (nowNanos() - start) / 1e6);
+        }
+    }
+
+    if (config.walPath != NULL) {
+        long long start = nowNanos();
+        long replayed = walOpen(&wal, config.walPath, config.durability, config.flushMs, walFrom, replayMutation);
+        if (replayed < 0) {
+            return -1;
+        }
+        walEnabled = 1;
+        restored += replayed;
+        printf("Replayed %ld logged change(s) from %s in %.1f ms.\n", replayed, config.walPath,
+               (nowNanos() - start) / 1e6);
+    }
+    return restored;
+}
+
+#define SHUTDOWN_GRACE_MS 200 // For the event loops to send cancelled WAIT replies
+
+sigset_t shutdownSignals;
+
+// Takes SIGINT and SIGTERM, which every other thread has blocked. Pending
+// WAITs are answered as cancelled, the WAL is synced and the process exits.
+void* shutdownThread(void* arg) {
+    (void)arg;
+    int signal;
+    if (sigwait(&shutdownSignals, &signal) != 0) {
+        return NULL;
+    }
+    printf("Shutting down (%s).\n", strsignal(signal));
+    cancelTokenFire(&keyWaits, &shutdownToken);
+    struct timespec grace = {0, SHUTDOWN_GRACE_MS * 1000000L};
+    nanosleep(&grace, NULL);
+    if (walEnabled) {
+        walSync(&wal);
+    }
+    exit(0);
+}
+
+// Call before starting any other thread, so they all inherit the mask
+int startShutdownThread() {
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdownSignals, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, shutdownThread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (parseArguments(argc, argv) < 0) {
+        return 1;
+    }
+
+    waitTableInit(&keyWaits, keyPresent, NULL);
+    if (startShutdownThread() < 0) {
+        perror("Thread creation error");
+        return 1;
+    }
+    pthread_t waitTimer;
+    if (pthread_create(&waitTimer, NULL, waitTableTimerThread, &keyWaits) != 0) {
+        perror("Thread creation error");
+        return 1;
+    }
+    pthread_detach(waitTimer);
+
+    avlTreeInit();
+    treeIndex = config.index;
+    oavlTreeInit(&optimisticTree, optimisticChanged);
+    bptTreeInit(&bplusTree);
+    bptTreeInit(&frozenAdded);
+    bptTreeInit(&frozenRemoved);
+    sem_init(&frozenWanted, 0, 0);
+    if (config.helperThreads > 0 && taskPoolInit(&helperPool, config.helperThreads) < 0) {
+        perror("Helper thread pool error");
+        return 1;
+    }
+
+    // With --reuseport every thread opens its own listener instead
+    int server_socket = -1;
+    if (!config.reusePort && (server_socket = createListenSocket(0)) < 0) {
+        return 1;
+    }
+    long restored = restoreTree();
+    if (restored < 0) {
+        return 1;
+    }
+    if (config.bloomKeys > 0) {
+        if (bloomBuild(config.bloomKeys) < 0) {
+            perror("Bloom filter error");
+            return 1;
+        }
+        printf("Bloom filter of %zu KB holds %zu key(s).\n", bloomBytes(&bloom) / 1024, bloom.keys);
+    }
+
+    // Initial contents of the shared tree, unless it was restored from disk
+    if (restored == 0) {
+        int initialKeys[] = {50, 35, 20, 40, 70, 60, 90, 45, 21, 56, 30};
+        for (size_t i = 0; i < sizeof(initialKeys) / sizeof(initialKeys[0]); i++) {
+            if (treeIndex == INDEX_OAVL) {
+                oavlInsert(&optimisticTree, initialKeys[i]); // Logged by optimisticChanged
+            } else {
+                lockedAdd(initialKeys[i]);
+                logMutation(ADD_NODE, initialKeys[i]);
+            }
+        }
+        if (walEnabled) {
+            walSync(&wal);
+        }
+    }
+
+    if (config.frozenThreshold > 0) {
+        frozenThreshold = config.frozenThreshold;
+        if (frozenRebuild() < 0) {
+            perror("Lookup array build error");
+            return 1;
+        }
+        printf("Froze %zu key(s) for lookups in %.1f ms.\n", frozenKeys->count, frozenLastBuildMs);
+        pthread_t freezer;
+        if (pthread_create(&freezer, NULL, frozenThread, NULL) == 0) {
+            pthread_detach(freezer);
+        }
+    }
+
+    if (config.relaxed) {
+        relaxedBalance = 1;
+        pthread_t rebalancer;
+        if (pthread_create(&rebalancer, NULL, rebalanceThread, NULL) == 0) {
+            pthread_detach(rebalancer);
+        }
+    }
+
+    // Started before any front end, so it reports whichever one runs
+    pthread_t reporter;
+    if (config.statsInterval > 0 && pthread_create(&reporter, NULL, statsThread, NULL) == 0) {
+        pthread_detach(reporter);
+    }
+
+    pthread_t checkpointer;
+    if (config.checkpointInterval > 0 && pthread_create(&checkpointer, NULL, checkpointThread, NULL) == 0) {
+        pthread_detach(checkpointer);
+    }
+
+    printf("Server started. Waiting for connections...\n");
+
+    int result;
+    if (config.threadPerConnection) {
+        result = runThreadServer(server_socket);
+    } else if (config.ioUring && (result = runUringServer(server_socket)) >= 0) {
+        // Only returns on a fatal error
+    } else {
+        if (config.ioUring) {
+            printf("Falling back to epoll.\n");
+        }
+        result = runEpollServer(server_socket);
+    }
+
+    if (server_socket >= 0) {
+        close(server_socket);
+    }
+    return result;
 }
@@ -0,0 +1,1421 @@
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nodeArena.h"
+#include "taskPool.h"
+
+// AVL tree of int keys, the server's default index (--index avl).
+//
+// Nodes keep their subtree sizes, so rank and select take one descent.
+// Batches, bulk loads and set operations are built on joinTree and run on
+// the helper threads. One tree, sharedRoot, is shared under treeLock; it
+// can run with relaxed balance (insertRelaxed) and hands out O(1)
+// snapshots by copying paths (writableNode). Like the reclaimer in epoch.h,
+// this state is a single instance per program.
+
+typedef struct Node {
+    _Atomic int data;
+    int size;               // Keys in this subtree, for rank and select
+    // One word between them, so a node still fills half a cache line
+    uint64_t height : 8;
+    uint64_t pending : 1;   // Some node in this subtree may be out of AVL balance (--relaxed)
+    uint64_t version : 55;  // Generation that wrote it, for snapshots (see writableNode)
+    struct Node* left;
+    struct Node* right;
+} Node;
+
+// Function to get the height of the BST
+static inline int getBSTHeight(Node* node) {
+    return (node == NULL) ? -1 : node->height;
+}
+
+static inline int max(int a, int b) {
+    return (a > b) ? a : b;
+}
+
+static inline int getHeight(Node* node) {
+    return (node == NULL) ? -1 : node->height;
+}
+
+static inline int getSize(Node* node) {
+    return (node == NULL) ? 0 : node->size;
+}
+
+static inline int isPending(Node* node) {
+    return node != NULL && node->pending;
+}
+
+// Recomputes node's height, size and pending flag from its children
+static inline void updateNode(Node* node) {
+    int left = getHeight(node->left);
+    int right = getHeight(node->right);
+    node->height = max(left, right) + 1;
+    node->size = getSize(node->left) + getSize(node->right) + 1;
+    node->pending = left - right > 1 || right - left > 1 || isPending(node->left) || isPending(node->right);
+}
+
+// Slab allocator for the tree's nodes; set up by avlTreeInit
+static NodeArena nodeArena;
+
+// Helper threads for batches, bulk loads, set operations and walks, started
+// by the program with taskPoolInit; with none, the thread asking does all
+// the work
+static TaskPool helperPool;
+
+// Snapshots of the AVL tree (see openTreeSnapshot). While one is open,
+// writers copy a node before changing it unless it was written in the
+// current generation, which no snapshot can see; the parent then links to
+// the copy, so every change copies its path up to a new root and the nodes
+// a snapshot holds never change under it. Versions replaced this way are
+// retired, and freed once every snapshot that might still read them has
+// closed. With no snapshot open, writes change nodes in place as before.
+// Generations and the retired list are guarded by treeLock: writers hold
+// it for writing, and snapshots open with it held for reading.
+typedef struct RetiredVersion {
+    Node* node;
+    uint64_t generation; // Newest snapshot that may still read it
+} RetiredVersion;
+
+static uint64_t treeGeneration = 1;    // Stamped on the nodes written now
+static _Atomic int snapshotsOpen = 0;
+static _Atomic uint64_t oldestSnapshot = UINT64_MAX; // Generation of the oldest open snapshot
+static RetiredVersion* retiredVersions = NULL;
+static size_t retiredHead = 0;         // Oldest entry not yet freed
+static size_t retiredCount = 0;
+static size_t retiredCapacity = 0;
+static long versionsCopied = 0;
+
+static inline Node* createNode(int data) {
+    Node* newNode = (Node*)arenaAlloc(&nodeArena);
+    newNode->data = data;
+    newNode->left = newNode->right = NULL;
+    newNode->height = 0;
+    newNode->size = 1;
+    newNode->pending = 0;
+    newNode->version = treeGeneration;
+    return newNode;
+}
+
+static inline void retireVersion(Node* node) {
+    if (retiredCount == retiredCapacity) {
+        if (retiredHead > 0) {
+            // Slide the unfreed entries down before growing
+            retiredCount -= retiredHead;
+            memmove(retiredVersions, retiredVersions + retiredHead, retiredCount * sizeof(RetiredVersion));
+            retiredHead = 0;
+        }
+        if (retiredCount == retiredCapacity) {
+            retiredCapacity = retiredCapacity ? retiredCapacity * 2 : 1024;
+            retiredVersions = (RetiredVersion*)realloc(retiredVersions, retiredCapacity * sizeof(RetiredVersion));
+        }
+    }
+    retiredVersions[retiredCount++] = (RetiredVersion){node, treeGeneration - 1};
+}
+
+// Returns node itself if it may be changed in place, or else a copy of it
+// that may, retiring node. Call before changing a node of the shared tree,
+// and link the result in its place.
+static inline Node* writableNode(Node* node) {
+    if (atomic_load_explicit(&snapshotsOpen, memory_order_acquire) == 0 || node->version == treeGeneration) {
+        return node;
+    }
+    Node* copy = (Node*)arenaAlloc(&nodeArena);
+    memcpy(copy, node, sizeof(Node));
+    copy->version = treeGeneration;
+    retireVersion(node);
+    versionsCopied++;
+    return copy;
+}
+
+// Frees a node unlinked from the shared tree, or retires it if a snapshot
+// may still hold it
+static inline void releaseNode(Node* node) {
+    if (atomic_load_explicit(&snapshotsOpen, memory_order_acquire) == 0 || node->version == treeGeneration) {
+        arenaFree(&nodeArena, node);
+    } else {
+        retireVersion(node);
+    }
+}
+
+#define VERSION_RECLAIM_BATCH 256 // Retired versions freed per call, at most
+
+// Frees retired versions no open snapshot can read, oldest first and at
+// most VERSION_RECLAIM_BATCH of them, so writers are never held up for long.
+// Call with treeLock held for writing. Returns 1 if more could be freed now.
+static inline int reclaimVersions() {
+    uint64_t oldest = atomic_load(&oldestSnapshot);
+    size_t end = retiredHead + VERSION_RECLAIM_BATCH < retiredCount ? retiredHead + VERSION_RECLAIM_BATCH : retiredCount;
+    while (retiredHead < end && retiredVersions[retiredHead].generation < oldest) {
+        arenaFree(&nodeArena, retiredVersions[retiredHead++].node);
+    }
+    if (retiredHead == retiredCount) {
+        retiredHead = retiredCount = 0;
+    }
+    return retiredHead < retiredCount && retiredVersions[retiredHead].generation < oldest;
+}
+
+static inline Node* rightRotate(Node* y) {
+    y = writableNode(y);
+    Node* x = writableNode(y->left);
+    Node* T2 = x->right;
+
+    x->right = y;
+    y->left = T2;
+
+    updateNode(y);
+    updateNode(x);
+
+    return x;
+}
+
+static inline Node* leftRotate(Node* x) {
+    x = writableNode(x);
+    Node* y = writableNode(x->right);
+    Node* T2 = y->left;
+
+    y->left = x;
+    x->right = T2;
+
+    updateNode(x);
+    updateNode(y);
+
+    return y;
+}
+
+static inline int getBalance(Node* node) {
+    return (node == NULL) ? 0 : getHeight(node->left) - getHeight(node->right);
+}
+
+static inline Node* insertNode(Node* root, int data) {
+    if (root == NULL) {
+        return createNode(data);
+    }
+    root = writableNode(root);
+
+    if (data < root->data) {
+        root->left = insertNode(root->left, data);
+    } else if (data > root->data) {
+        root->right = insertNode(root->right, data);
+    } else {
+        return root; // Avoid duplicate values (assuming no duplicates in BST)
+    }
+
+    updateNode(root);
+
+    int balance = getBalance(root);
+
+    // Left Left Case
+    if (balance > 1 && data < root->left->data) {
+        return rightRotate(root);
+    }
+
+    // Right Right Case
+    if (balance < -1 && data > root->right->data) {
+        return leftRotate(root);
+    }
+
+    // Left Right Case
+    if (balance > 1 && data > root->left->data) {
+        root->left = leftRotate(root->left);
+        return rightRotate(root);
+    }
+
+    // Right Left Case
+    if (balance < -1 && data < root->right->data) {
+        root->right = rightRotate(root->right);
+        return leftRotate(root);
+    }
+
+    return root;
+}
+
+static inline Node* findMinNode(Node* node) {
+    Node* current = node;
+    while (current && current->left != NULL) {
+        current = current->left;
+    }
+    return current;
+}
+
+static inline Node* removeNode(Node* root, int data) {
+    if (root == NULL) {
+        return root;
+    }
+    root = writableNode(root);
+
+    if (data < root->data) {
+        root->left = removeNode(root->left, data);
+    } else if (data > root->data) {
+        root->right = removeNode(root->right, data);
+    } else {
+        if (root->left == NULL || root->right == NULL) {
+            Node* temp = root->left ? root->left : root->right;
+            releaseNode(root);
+            return temp;
+        }
+        Node* minRight = findMinNode(root->right);
+        root->data = minRight->data;
+        root->right = removeNode(root->right, minRight->data);
+    }
+
+    updateNode(root);
+
+    int balance = getBalance(root);
+
+    // Left Left Case
+    if (balance > 1 && getBalance(root->left) >= 0) {
+        return rightRotate(root);
+    }
+
+    // Left Right Case
+    if (balance > 1 && getBalance(root->left) < 0) {
+        root->left = leftRotate(root->left);
+        return rightRotate(root);
+    }
+
+    // Right Right Case
+    if (balance < -1 && getBalance(root->right) <= 0) {
+        return leftRotate(root);
+    }
+
+    // Right Left Case
+    if (balance < -1 && getBalance(root->right) > 0) {
+        root->right = rightRotate(root->right);
+        return leftRotate(root);
+    }
+
+    return root;
+}
+
+// Relaxed balance (--relaxed): writers insert and remove without rotating,
+// so a write holds the lock only for its descent, whatever the shape of the
+// tree. A write flags a node it leaves out of AVL balance, and every
+// ancestor above it, so the flags lead from the root to each imbalance
+// left behind. The rebalancer thread follows them and does the rotations a
+// bounded batch at a time, deepest first (the tags of Larsen, "AVL Trees
+// with Relaxed Balance", 1994, kept as a summary bit). It only gets CPU
+// time the writers leave over, so it catches up between bursts; a write
+// that takes the height past relaxedHeightLimit fixes small batches along
+// the tallest paths until it is back under, so scans and iterators can
+// still count on a bounded depth.
+
+#define RELAXED_HEIGHT_FACTOR 2 // Times the height of a perfectly balanced tree
+#define RELAXED_BATCH 8         // Imbalanced nodes fixed per write-lock hold
+
+static inline int relaxedHeightLimit(int size) {
+    return RELAXED_HEIGHT_FACTOR * (32 - __builtin_clz((unsigned)size + 1));
+}
+
+// Adds data, which must not be in the tree yet, without rotating and
+// without a way back up. A node whose path goes to its shorter child keeps
+// its height, and so does everything above it; below the deepest such node
+// every height on the path grows by one (the rebalancing point of Knuth's
+// top-down insertion). So the pass down counts the new key into each
+// subtree and finds that point, and a second, short pass from it raises
+// the heights. A node below it whose path goes to its taller child now
+// leans too far; then the second pass starts at the root instead, to flag
+// the ancestors as well. A node that leans less than before keeps its flag
+// until the rebalancer next passes by and clears it.
+static inline Node* insertRelaxed(Node* root, int data) {
+    Node** grows = &root;  // Link to the top of the path that grows
+    Node* leaning = NULL;  // Deepest node below it that will lean too far
+    Node** link = &root;
+    while (*link != NULL) {
+        Node* node = writableNode(*link);
+        *link = node;
+        node->size++;
+        Node* other = data < node->data ? node->right : node->left;
+        link = data < node->data ? &node->left : &node->right;
+        int lean = getHeight(*link) - getHeight(other);
+        if (lean < 0) {
+            grows = link;
+            leaning = NULL;
+        } else if (lean > 0 && !node->pending) { // Flagged ones have flagged ancestors
+            leaning = node;
+        }
+    }
+    *link = createNode(data);
+
+    Node* top = *grows;
+    int growing = 0;
+    Node* node = leaning != NULL ? root : top;
+    while (node->data != data) {
+        growing |= node == top;
+        node->height += growing;
+        if (leaning != NULL) {
+            node->pending = 1;
+            if (node == leaning) {
+                leaning = NULL;
+            }
+        }
+        node = data < node->data ? node->left : node->right;
+    }
+    return root;
+}
+
+static inline Node* removeRelaxed(Node* root, int data) {
+    if (root == NULL) {
+        return root;
+    }
+    root = writableNode(root);
+    if (data < root->data) {
+        root->left = removeRelaxed(root->left, data);
+    } else if (data > root->data) {
+        root->right = removeRelaxed(root->right, data);
+    } else {
+        if (root->left == NULL || root->right == NULL) {
+            Node* temp = root->left ? root->left : root->right;
+            releaseNode(root);
+            return temp;
+        }
+        Node* minRight = findMinNode(root->right);
+        root->data = minRight->data;
+        root->right = removeRelaxed(root->right, minRight->data);
+    }
+    updateNode(root);
+    return root;
+}
+
+// Rotates node until it is within AVL balance. A node rotated down may
+// lean too far in turn, so it is fixed the same way. With balanced
+// children the result is a balanced subtree.
+static inline Node* rebalanceNode(Node* node) {
+    while (1) {
+        int balance = getBalance(node);
+        if (balance > 1) {
+            if (getBalance(node->left) < 0) {
+                node = writableNode(node);
+                node->left = leftRotate(node->left);
+                node->left->left = rebalanceNode(node->left->left);
+                updateNode(node->left);
+            }
+            node = rightRotate(node);
+            node->right = rebalanceNode(node->right);
+            updateNode(node);
+        } else if (balance < -1) {
+            if (getBalance(node->right) > 0) {
+                node = writableNode(node);
+                node->right = rightRotate(node->right);
+                node->right->right = rebalanceNode(node->right->right);
+                updateNode(node->right);
+            }
+            node = leftRotate(node);
+            node->left = rebalanceNode(node->left);
+            updateNode(node);
+        } else {
+            return node;
+        }
+    }
+}
+
+// Follows the pending flags below node and rebalances the imbalanced nodes
+// bottom up, at most *budget of them; what is left stays flagged. The
+// taller child goes first, so a partial pass spends its budget where the
+// height is.
+static inline Node* rebalancePending(Node* node, int* budget) {
+    if (node == NULL || !node->pending || *budget <= 0) {
+        return node;
+    }
+    node = writableNode(node);
+    if (getHeight(node->left) >= getHeight(node->right)) {
+        node->left = rebalancePending(node->left, budget);
+        node->right = rebalancePending(node->right, budget);
+    } else {
+        node->right = rebalancePending(node->right, budget);
+        node->left = rebalancePending(node->left, budget);
+    }
+    updateNode(node);
+    if (!node->pending || isPending(node->left) || isPending(node->right)) {
+        return node; // Balanced, or out of budget below
+    }
+    (*budget)--;
+    return rebalanceNode(node);
+}
+
+static inline void inOrderTraversal(Node* root) {
+    if (root != NULL) {
+        inOrderTraversal(root->left);
+        printf("%d ", root->data);
+        inOrderTraversal(root->right);
+    }
+}
+
+// Sets node's children and recomputes its height and size
+static inline Node* attachChildren(Node* left, Node* node, Node* right) {
+    node->left = left;
+    node->right = right;
+    updateNode(node);
+    return node;
+}
+
+// joinTree when left is more than one level taller than right: follows
+// left's right spine down to a subtree at most one level taller than right,
+// hangs mid there, and rotates on the way back up where the spine grew
+// too tall
+static inline Node* joinRight(Node* left, Node* mid, Node* right) {
+    Node* inner = left->right;
+    if (getHeight(inner) <= getHeight(right) + 1) {
+        Node* joined = attachChildren(inner, mid, right);
+        if (getHeight(joined) <= getHeight(left->left) + 1) {
+            return attachChildren(left->left, left, joined);
+        }
+        return leftRotate(attachChildren(left->left, left, rightRotate(joined)));
+    }
+    Node* joined = joinRight(inner, mid, right);
+    attachChildren(left->left, left, joined);
+    if (getHeight(joined) <= getHeight(left->left) + 1) {
+        return left;
+    }
+    return leftRotate(left);
+}
+
+// Mirror image of joinRight
+static inline Node* joinLeft(Node* left, Node* mid, Node* right) {
+    Node* inner = right->left;
+    if (getHeight(inner) <= getHeight(left) + 1) {
+        Node* joined = attachChildren(left, mid, inner);
+        if (getHeight(joined) <= getHeight(right->right) + 1) {
+            return attachChildren(joined, right, right->right);
+        }
+        return rightRotate(attachChildren(leftRotate(joined), right, right->right));
+    }
+    Node* joined = joinLeft(left, mid, inner);
+    attachChildren(joined, right, right->right);
+    if (getHeight(joined) <= getHeight(right->right) + 1) {
+        return right;
+    }
+    return rightRotate(right);
+}
+
+// Joins two AVL trees of any heights and the node between them into one
+// AVL tree: every key in left must be smaller than mid's and every key in
+// right larger. Takes O(|height(left) - height(right)|) steps (Blelloch,
+// Ferizovic and Sun, "Just Join for Parallel Ordered Sets", 2016).
+static inline Node* joinTree(Node* left, Node* mid, Node* right) {
+    if (getHeight(left) > getHeight(right) + 1) {
+        return joinRight(left, mid, right);
+    }
+    if (getHeight(right) > getHeight(left) + 1) {
+        return joinLeft(left, mid, right);
+    }
+    return attachChildren(left, mid, right);
+}
+
+// Splits tree around key: *left gets the keys below it and *right those
+// above. Returns the node that held key, detached, or NULL if there was
+// none. Joins on the way back up put the pieces together, so it takes
+// O(log n) steps.
+static inline Node* splitTree(Node* tree, int key, Node** left, Node** right) {
+    if (tree == NULL) {
+        *left = *right = NULL;
+        return NULL;
+    }
+    Node* below = tree->left;
+    Node* above = tree->right;
+    Node* found;
+    Node* inner;
+    if (key == tree->data) {
+        *left = below;
+        *right = above;
+        return attachChildren(NULL, tree, NULL);
+    } else if (key < tree->data) {
+        found = splitTree(below, key, left, &inner);
+        *right = joinTree(inner, tree, above);
+    } else {
+        found = splitTree(above, key, &inner, right);
+        *left = joinTree(below, tree, inner);
+    }
+    return found;
+}
+
+// Detaches the node with the largest key of a non-empty tree; *rest gets
+// the other keys
+static inline Node* splitLast(Node* tree, Node** rest) {
+    if (tree->right == NULL) {
+        *rest = tree->left;
+        return attachChildren(NULL, tree, NULL);
+    }
+    Node* inner;
+    Node* last = splitLast(tree->right, &inner);
+    *rest = joinTree(tree->left, tree, inner);
+    return last;
+}
+
+// joinTree without a node in between
+static inline Node* joinTrees(Node* left, Node* right) {
+    if (left == NULL) {
+        return right;
+    }
+    Node* rest;
+    Node* last = splitLast(left, &rest);
+    return joinTree(rest, last, right);
+}
+
+static inline void freeTree(Node* root) {
+    if (root != NULL) {
+        freeTree(root->left);
+        freeTree(root->right);
+        arenaFree(&nodeArena, root);
+    }
+}
+
+// Set operations on whole trees (Blelloch et al. as above). Each splits one
+// tree at the other's root key and recurses on the two halves, which share
+// no nodes, so large halves run on the helper threads while the calling
+// thread takes its share. Merging m keys into n costs O(m log(n/m + 1)).
+// They consume both trees: the result is built from their nodes and the
+// nodes left over are freed.
+#define SET_PARALLEL_MIN 16384 // Smaller operations recurse on one thread
+
+typedef Node* (*SetOperation)(Node* a, Node* b);
+
+typedef struct SetHalves {
+    SetOperation op;
+    Node* a[2];
+    Node* b[2];
+    Node* result[2];
+} SetHalves;
+
+static inline void setHalf(void* ctx, size_t from, size_t to) {
+    SetHalves* halves = (SetHalves*)ctx;
+    for (size_t i = from; i < to; i++) {
+        halves->result[i] = halves->op(halves->a[i], halves->b[i]);
+    }
+}
+
+// Runs op on both pairs of halves, side by side when they are large enough
+static inline void setForkJoin(SetHalves* halves) {
+    size_t keys = getSize(halves->a[0]) + getSize(halves->b[0]) + getSize(halves->a[1]) + getSize(halves->b[1]);
+    taskPoolFor(&helperPool, 2, keys >= SET_PARALLEL_MIN ? 1 : 2, setHalf, halves);
+}
+
+static inline Node* unionTrees(Node* a, Node* b) {
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    SetHalves halves = {unionTrees, {NULL, NULL}, {b->left, b->right}, {NULL, NULL}};
+    Node* found = splitTree(a, b->data, &halves.a[0], &halves.a[1]);
+    if (found != NULL) {
+        arenaFree(&nodeArena, found);
+    }
+    setForkJoin(&halves);
+    return joinTree(halves.result[0], b, halves.result[1]);
+}
+
+static inline Node* intersectTrees(Node* a, Node* b) {
+    if (a == NULL || b == NULL) {
+        freeTree(a);
+        freeTree(b);
+        return NULL;
+    }
+    SetHalves halves = {intersectTrees, {NULL, NULL}, {b->left, b->right}, {NULL, NULL}};
+    Node* found = splitTree(a, b->data, &halves.a[0], &halves.a[1]);
+    setForkJoin(&halves);
+    if (found != NULL) {
+        arenaFree(&nodeArena, found);
+        return joinTree(halves.result[0], b, halves.result[1]);
+    }
+    arenaFree(&nodeArena, b);
+    return joinTrees(halves.result[0], halves.result[1]);
+}
+
+// The keys of a that are not in b
+static inline Node* differenceTrees(Node* a, Node* b) {
+    if (a == NULL || b == NULL) {
+        freeTree(b);
+        return a;
+    }
+    SetHalves halves = {differenceTrees, {NULL, NULL}, {b->left, b->right}, {NULL, NULL}};
+    Node* found = splitTree(a, b->data, &halves.a[0], &halves.a[1]);
+    if (found != NULL) {
+        arenaFree(&nodeArena, found);
+    }
+    arenaFree(&nodeArena, b);
+    setForkJoin(&halves);
+    return joinTrees(halves.result[0], halves.result[1]);
+}
+
+// Levels buildBalanced lays out itself before handing the subtrees below
+// them to helper threads, at most
+#define BUILD_TOP_LEVELS 10
+#define BUILD_PARALLEL_MIN 65536 // Smaller builds stay on one thread
+#define BUILD_SPREAD 8           // Subtrees per thread, so uneven ones even out
+
+typedef struct BuildTask {
+    Node** slot; // Child pointer the subtree goes in
+    uint64_t lo;
+    uint64_t hi;
+} BuildTask;
+
+typedef struct BalancedBuild {
+    int (*keyAt)(const void* source, uint64_t i);
+    const void* source;
+    BuildTask tasks[1 << BUILD_TOP_LEVELS];
+    int taskCount;
+} BalancedBuild;
+
+// Builds a perfectly balanced tree from the sorted keys [lo, hi): the
+// middle key becomes the root and each half a subtree. Every key is visited
+// once and heights are set on the way back up, so there are no per-key
+// descents or rotations.
+static inline Node* buildBalancedRange(const BalancedBuild* build, uint64_t lo, uint64_t hi) {
+    if (lo >= hi) {
+        return NULL;
+    }
+    uint64_t mid = lo + (hi - lo) / 2;
+    Node* node = createNode(build->keyAt(build->source, mid));
+    node->left = buildBalancedRange(build, lo, mid);
+    node->right = buildBalancedRange(build, mid + 1, hi);
+    updateNode(node);
+    return node;
+}
+
+// The same for the top depth levels only; each subtree below them is left
+// as a task that fills in its parent's child pointer
+static inline Node* buildBalancedTop(BalancedBuild* build, uint64_t lo, uint64_t hi, int depth, Node** slot) {
+    if (lo >= hi) {
+        return NULL;
+    }
+    if (depth == 0) {
+        build->tasks[build->taskCount++] = (BuildTask){slot, lo, hi};
+        return NULL;
+    }
+    uint64_t mid = lo + (hi - lo) / 2;
+    Node* node = createNode(build->keyAt(build->source, mid));
+    node->left = buildBalancedTop(build, lo, mid, depth - 1, &node->left);
+    node->right = buildBalancedTop(build, mid + 1, hi, depth - 1, &node->right);
+    return node;
+}
+
+static inline void buildChunk(void* ctx, size_t from, size_t to) {
+    BalancedBuild* build = (BalancedBuild*)ctx;
+    for (size_t i = from; i < to; i++) {
+        BuildTask* task = &build->tasks[i];
+        *task->slot = buildBalancedRange(build, task->lo, task->hi);
+    }
+}
+
+// Sets the heights and sizes of the top depth levels once the subtrees
+// below are in
+static inline void setTopHeights(Node* node, int depth) {
+    if (node != NULL && depth > 0) {
+        setTopHeights(node->left, depth - 1);
+        setTopHeights(node->right, depth - 1);
+        updateNode(node);
+    }
+}
+
+// Builds a balanced tree from count strictly ascending keys, read with
+// keyAt(source, i). Large builds lay out the top levels here and build the
+// subtrees under them on the helper threads.
+static inline Node* buildBalanced(int (*keyAt)(const void* source, uint64_t i), const void* source, uint64_t count) {
+    BalancedBuild build;
+    build.keyAt = keyAt;
+    build.source = source;
+    build.taskCount = 0;
+    int depth = 0;
+    if (helperPool.threads > 0 && count >= BUILD_PARALLEL_MIN) {
+        while ((1 << depth) < BUILD_SPREAD * (helperPool.threads + 1) && depth < BUILD_TOP_LEVELS) {
+            depth++;
+        }
+    }
+    if (depth == 0) {
+        return buildBalancedRange(&build, 0, count);
+    }
+    Node* root = buildBalancedTop(&build, 0, count, depth, NULL);
+    taskPoolFor(&helperPool, build.taskCount, 1, buildChunk, &build);
+    setTopHeights(root, depth);
+    return root;
+}
+
+static inline int arrayKeyAt(const void* source, uint64_t i) {
+    return ((const int*)source)[i];
+}
+
+// Builds the AVL tree for count strictly ascending keys in O(count)
+static inline Node* bulkLoad(const int* sorted, uint64_t count) {
+    return buildBalanced(arrayKeyAt, sorted, count);
+}
+
+static inline Node* searchNode(Node* root, int data) {
+    Node* curr = root;
+    while (curr != NULL) {
+        if (data == curr->data) {
+            return curr;
+        } else if (data < curr->data) {
+            curr = curr->left;
+        } else {
+            curr = curr->right;
+        }
+    }
+    return NULL;
+}
+
+// Number of keys smaller than data. Every right turn passes over the node
+// and its whole left subtree, so one descent suffices.
+static inline int rankNode(Node* root, int data) {
+    int rank = 0;
+    Node* curr = root;
+    while (curr != NULL) {
+        if (data <= curr->data) {
+            curr = curr->left;
+        } else {
+            rank += getSize(curr->left) + 1;
+            curr = curr->right;
+        }
+    }
+    return rank;
+}
+
+// The node holding the key of rank k (0: the smallest), or NULL if the tree
+// has no more than k keys
+static inline Node* selectNode(Node* root, int k) {
+    Node* curr = root;
+    while (curr != NULL) {
+        int leftSize = getSize(curr->left);
+        if (k < leftSize) {
+            curr = curr->left;
+        } else if (k == leftSize) {
+            return curr;
+        } else {
+            k -= leftSize + 1;
+            curr = curr->right;
+        }
+    }
+    return NULL;
+}
+
+// Descents searchNodeMany keeps in flight
+#define SEARCH_GROUP 16
+
+// Looks up keys[0 .. n) together. A single descent stalls on every node it
+// visits; here up to SEARCH_GROUP descents take turns, each prefetching its
+// next node and then yielding to the others, so their cache misses overlap
+// instead of queueing up. results[i] is 1 when keys[i] is in the tree.
+static inline void searchNodeMany(Node* root, const int* keys, int n, unsigned char* results) {
+    Node* current[SEARCH_GROUP];
+    int slot[SEARCH_GROUP]; // Which key each descent is looking for
+    int active = 0;
+    int next = 0;
+    while (active < SEARCH_GROUP && next < n) {
+        current[active] = root;
+        slot[active++] = next++;
+    }
+    while (active > 0) {
+        for (int i = 0; i < active;) {
+            Node* node = current[i];
+            int key = keys[slot[i]];
+            if (node != NULL && node->data != key) {
+                node = key < node->data ? node->left : node->right;
+                __builtin_prefetch(node);
+                current[i++] = node;
+                continue;
+            }
+            results[slot[i]] = node != NULL;
+            if (next < n) {
+                current[i] = root;
+                slot[i++] = next++;
+            } else {
+                // Fill the hole with the last descent, which runs next
+                active--;
+                current[i] = current[active];
+                slot[i] = slot[active];
+            }
+        }
+    }
+}
+
+// In-order iterator with an explicit stack, so a walk can start at any key
+// and stop after any number of steps. AVL heights stay far below the bound.
+#define MAX_TREE_DEPTH 96
+
+typedef struct TreeIterator {
+    Node* stack[MAX_TREE_DEPTH];
+    int depth;
+} TreeIterator;
+
+// Positions the iterator at the smallest key >= lo
+static inline void iteratorSeek(TreeIterator* it, Node* root, int lo) {
+    it->depth = 0;
+    Node* curr = root;
+    while (curr != NULL) {
+        if (curr->data >= lo) {
+            it->stack[it->depth++] = curr;
+            curr = curr->left;
+        } else {
+            curr = curr->right;
+        }
+    }
+}
+
+// Returns the next node in key order, or NULL at the end of the tree
+static inline Node* iteratorNext(TreeIterator* it) {
+    if (it->depth == 0) {
+        return NULL;
+    }
+    Node* node = it->stack[--it->depth];
+    Node* curr = node->right;
+    while (curr != NULL) {
+        it->stack[it->depth++] = curr;
+        curr = curr->left;
+    }
+    return node;
+}
+
+// Parallel walks over a whole tree. The tree is cut along subtree
+// boundaries into pieces: subtrees of at most `grain` keys, found from the
+// subtree sizes, each followed by the node above it that comes next in key
+// order, if any. The pieces run on the helper threads, the calling thread
+// taking its share (and a walk may start walks of its own, as any
+// taskPoolFor loop may). They share no nodes, so all the tree needs is to
+// stay unchanged while the walk runs: hold treeLock for reading, or walk a
+// snapshot's root.
+#define TREE_WALK_GRAIN 16384 // Smaller trees, and pieces, stay on one thread
+#define TREE_WALK_SPREAD 8    // Pieces per thread, so uneven ones even out
+
+// How a reduction folds keys: every piece gets an accumulator of accSize
+// bytes set up by init, map folds each of its keys into it in ascending
+// order, and combine folds the pieces' accumulators together, also in key
+// order, so combine only has to be associative.
+typedef struct TreeReducer {
+    size_t accSize;
+    void (*init)(void* ctx, void* acc);
+    void (*map)(void* ctx, void* acc, int key);
+    void (*combine)(void* ctx, void* into, const void* from);
+    void* ctx;
+} TreeReducer;
+
+typedef struct TreePiece {
+    Node* subtree; // May be NULL
+    Node* after;   // Node right after the subtree in key order, or NULL
+    uint32_t rank; // Keys in the tree before the piece
+} TreePiece;
+
+typedef struct TreeWalk {
+    TreePiece* pieces;
+    int count;
+    const TreeReducer* reducer; // treeReduce
+    unsigned char* accs;
+    void (*visit)(void* ctx, int key, uint32_t rank); // treeForEachParallel
+    void* ctx;
+} TreeWalk;
+
+static inline int countPieces(Node* node, int grain) {
+    if (getSize(node) <= grain) {
+        return 1;
+    }
+    return countPieces(node->left, grain) + countPieces(node->right, grain);
+}
+
+// Appends node's subtree to walk as pieces, in key order. The left one
+// always ends in a piece (an empty subtree makes an empty one), which node
+// then follows.
+static inline void cutPieces(TreeWalk* walk, Node* node, int grain, uint32_t rank) {
+    if (getSize(node) <= grain) {
+        walk->pieces[walk->count++] = (TreePiece){node, NULL, rank};
+        return;
+    }
+    cutPieces(walk, node->left, grain, rank);
+    walk->pieces[walk->count - 1].after = node;
+    cutPieces(walk, node->right, grain, rank + getSize(node->left) + 1);
+}
+
+// Cuts root's tree into pieces sized for the helper threads, or one piece
+// when it is small. Returns -1 if out of memory.
+static inline int cutTree(TreeWalk* walk, Node* root) {
+    int grain = getSize(root);
+    if (helperPool.threads > 0 && grain > TREE_WALK_GRAIN) {
+        grain /= TREE_WALK_SPREAD * (helperPool.threads + 1);
+        if (grain < TREE_WALK_GRAIN) {
+            grain = TREE_WALK_GRAIN;
+        }
+    }
+    walk->pieces = (TreePiece*)malloc(countPieces(root, grain) * sizeof(TreePiece));
+    if (walk->pieces == NULL) {
+        return -1;
+    }
+    walk->count = 0;
+    cutPieces(walk, root, grain, 0);
+    return 0;
+}
+
+static inline void reducePieces(void* ctx, size_t from, size_t to) {
+    TreeWalk* walk = (TreeWalk*)ctx;
+    const TreeReducer* reducer = walk->reducer;
+    for (size_t i = from; i < to; i++) {
+        void* acc = walk->accs + i * reducer->accSize;
+        reducer->init(reducer->ctx, acc);
+        TreeIterator it;
+        iteratorSeek(&it, walk->pieces[i].subtree, INT_MIN);
+        Node* node;
+        while ((node = iteratorNext(&it)) != NULL) {
+            reducer->map(reducer->ctx, acc, node->data);
+        }
+        if (walk->pieces[i].after != NULL) {
+            reducer->map(reducer->ctx, acc, walk->pieces[i].after->data);
+        }
+    }
+}
+
+// Folds every key of root's tree into *result (accSize bytes) with
+// reducer. Returns 0, or -1 if out of memory.
+static inline int treeReduce(Node* root, const TreeReducer* reducer, void* result) {
+    TreeWalk walk = {NULL, 0, reducer, NULL, NULL, NULL};
+    if (cutTree(&walk, root) < 0) {
+        return -1;
+    }
+    walk.accs = (unsigned char*)malloc(walk.count * reducer->accSize);
+    if (walk.accs == NULL) {
+        free(walk.pieces);
+        return -1;
+    }
+    taskPoolFor(&helperPool, walk.count, 1, reducePieces, &walk);
+    reducer->init(reducer->ctx, result);
+    for (int i = 0; i < walk.count; i++) {
+        reducer->combine(reducer->ctx, result, walk.accs + i * reducer->accSize);
+    }
+    free(walk.accs);
+    free(walk.pieces);
+    return 0;
+}
+
+static inline void visitPieces(void* ctx, size_t from, size_t to) {
+    TreeWalk* walk = (TreeWalk*)ctx;
+    for (size_t i = from; i < to; i++) {
+        uint32_t rank = walk->pieces[i].rank;
+        TreeIterator it;
+        iteratorSeek(&it, walk->pieces[i].subtree, INT_MIN);
+        Node* node;
+        while ((node = iteratorNext(&it)) != NULL) {
+            walk->visit(walk->ctx, node->data, rank++);
+        }
+        if (walk->pieces[i].after != NULL) {
+            walk->visit(walk->ctx, walk->pieces[i].after->data, rank);
+        }
+    }
+}
+
+// Calls visit(ctx, key, rank) for every key of root's tree, where rank is
+// the number of smaller keys (so an export can place each key directly).
+// Keys of different pieces are visited in no particular order, possibly at
+// the same time. Returns 0, or -1 if out of memory.
+static inline int treeForEachParallel(Node* root, void (*visit)(void* ctx, int key, uint32_t rank), void* ctx) {
+    TreeWalk walk = {NULL, 0, NULL, NULL, visit, ctx};
+    if (cutTree(&walk, root) < 0) {
+        return -1;
+    }
+    taskPoolFor(&helperPool, walk.count, 1, visitPieces, &walk);
+    free(walk.pieces);
+    return 0;
+}
+
+// Shared tree used by every client thread. Lookups take the read side of the
+// lock so they never block each other; inserts and removals take the write
+// side, but only after a read-side probe shows the operation changes the tree.
+static Node* sharedRoot = NULL;
+static pthread_rwlock_t treeLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Relaxed balance for sharedRoot (--relaxed, see insertRelaxed), also
+// guarded by treeLock
+static int relaxedBalance = 0;
+static int relaxedRequested = 0; // relaxedWanted has been posted
+static sem_t relaxedWanted;
+static long relaxedFixed = 0;    // Imbalanced nodes the rebalancer thread has fixed
+static long relaxedForced = 0;   // Writes that went over the height limit and rebalanced
+
+// Call with treeLock held for writing after a relaxed write: keeps the
+// height under the limit and hands any imbalance to the rebalancer thread.
+// A write over the limit fixes only what it takes to get back under, which
+// is usually one small batch, and leaves the rest to the rebalancer.
+static inline void relaxedNoteWrite() {
+    if (sharedRoot != NULL && sharedRoot->height > relaxedHeightLimit(sharedRoot->size)) {
+        do {
+            int budget = RELAXED_BATCH;
+            sharedRoot = rebalancePending(sharedRoot, &budget);
+        } while (sharedRoot->height > relaxedHeightLimit(sharedRoot->size));
+        relaxedForced++;
+    }
+    if (isPending(sharedRoot) && !relaxedRequested) {
+        relaxedRequested = 1;
+        sem_post(&relaxedWanted);
+    }
+}
+
+// Adds data to the shared tree, which the caller has checked does not hold
+// it yet, or removes it, in whichever balance mode it runs. Call with
+// treeLock held for writing.
+static inline void lockedAvlAdd(int data) {
+    if (relaxedBalance) {
+        sharedRoot = insertRelaxed(sharedRoot, data);
+        relaxedNoteWrite();
+    } else {
+        sharedRoot = insertNode(sharedRoot, data);
+    }
+    if (retiredCount > 0) {
+        reclaimVersions();
+    }
+}
+
+static inline void lockedAvlDelete(int data) {
+    if (relaxedBalance) {
+        sharedRoot = removeRelaxed(sharedRoot, data);
+        relaxedNoteWrite();
+    } else {
+        sharedRoot = removeNode(sharedRoot, data);
+    }
+    if (retiredCount > 0) {
+        reclaimVersions();
+    }
+}
+
+// Point-in-time view of the AVL tree. Reading one takes no lock: writers
+// leave its nodes alone until it is closed (see writableNode), so a scan or
+// an aggregate over it may take as long as it likes without holding them up.
+typedef struct TreeSnapshot {
+    Node* root;
+    uint64_t generation;
+    struct TreeSnapshot* prev;
+    struct TreeSnapshot* next;
+} TreeSnapshot;
+
+static pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER; // Guards the list of open snapshots
+static TreeSnapshot* oldestOpen = NULL;
+static TreeSnapshot* newestOpen = NULL;
+static long snapshotsTaken = 0;
+
+// Opens a snapshot of the shared tree as it is now, in O(1). Call with
+// treeLock held for reading. Returns NULL if out of memory.
+static inline TreeSnapshot* lockedOpenSnapshot() {
+    TreeSnapshot* snapshot = (TreeSnapshot*)malloc(sizeof(TreeSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->root = sharedRoot;
+    snapshot->next = NULL;
+
+    pthread_mutex_lock(&snapshotLock);
+    // Everything it holds is older than the nodes written from now on
+    snapshot->generation = treeGeneration++;
+    snapshot->prev = newestOpen;
+    if (newestOpen != NULL) {
+        newestOpen->next = snapshot;
+    } else {
+        oldestOpen = snapshot;
+        atomic_store(&oldestSnapshot, snapshot->generation);
+    }
+    newestOpen = snapshot;
+    atomic_fetch_add(&snapshotsOpen, 1);
+    snapshotsTaken++;
+    pthread_mutex_unlock(&snapshotLock);
+    return snapshot;
+}
+
+static inline TreeSnapshot* openTreeSnapshot() {
+    pthread_rwlock_rdlock(&treeLock);
+    TreeSnapshot* snapshot = lockedOpenSnapshot();
+    pthread_rwlock_unlock(&treeLock);
+    return snapshot;
+}
+
+// Releases a snapshot (NULL is ignored). Call without treeLock held.
+static inline void closeTreeSnapshot(TreeSnapshot* snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&snapshotLock);
+    int wasOldest = snapshot == oldestOpen;
+    if (snapshot->prev != NULL) {
+        snapshot->prev->next = snapshot->next;
+    } else {
+        oldestOpen = snapshot->next;
+    }
+    if (snapshot->next != NULL) {
+        snapshot->next->prev = snapshot->prev;
+    } else {
+        newestOpen = snapshot->prev;
+    }
+    atomic_store(&oldestSnapshot, oldestOpen != NULL ? oldestOpen->generation : UINT64_MAX);
+    atomic_fetch_sub(&snapshotsOpen, 1);
+    pthread_mutex_unlock(&snapshotLock);
+    free(snapshot);
+
+    // Free what only it was holding on to, a batch per write-lock hold, and
+    // leave the rest to the writers whenever they want the lock
+    int more = wasOldest;
+    while (more && pthread_rwlock_trywrlock(&treeLock) == 0) {
+        more = reclaimVersions();
+        pthread_rwlock_unlock(&treeLock);
+        sched_yield();
+    }
+}
+
+// Copies up to max keys in [lo, hi] from the snapshot into keys in
+// ascending order
+static inline int snapshotRange(const TreeSnapshot* snapshot, int lo, int hi, int* keys, int max) {
+    int n = 0;
+    TreeIterator it;
+    iteratorSeek(&it, snapshot->root, lo);
+    Node* node;
+    while (n < max && (node = iteratorNext(&it)) != NULL && node->data <= hi) {
+        keys[n++] = node->data;
+    }
+    return n;
+}
+
+
+#define INSERT_TOP_LEVELS 10  // Levels insertBatch splits a batch along, at most
+#define INSERT_SPREAD 8       // Subtrees per thread, so uneven ones even out
+
+typedef struct BatchKey {
+    int key;
+    int index; // Position in the frame
+} BatchKey;
+
+static inline int compareBatchKeys(const void* a, const void* b) {
+    const BatchKey* x = (const BatchKey*)a;
+    const BatchKey* y = (const BatchKey*)b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+static inline int batchKeyAt(const void* source, uint64_t i) {
+    return ((const BatchKey*)source)[i].key;
+}
+
+typedef struct InsertTask {
+    Node** slot; // Child pointer of the subtree the keys belong in
+    const BatchKey* keys;
+    int n;
+} InsertTask;
+
+typedef struct InsertBatch {
+    InsertTask tasks[1 << INSERT_TOP_LEVELS];
+    int taskCount;
+    unsigned char* results;
+} InsertBatch;
+
+// Hands every subtree depth levels below *slot the run of sorted keys that
+// belongs in it. Keys equal to a node on the way are already present.
+static inline void splitInsertBatch(InsertBatch* batch, Node** slot, const BatchKey* keys, int n, int depth) {
+    if (n == 0) {
+        return;
+    }
+    Node* node = *slot;
+    if (node == NULL || depth == 0) {
+        batch->tasks[batch->taskCount++] = (InsertTask){slot, keys, n};
+        return;
+    }
+    int lower = 0, upper = n; // First key not below node->data
+    while (lower < upper) {
+        int mid = lower + (upper - lower) / 2;
+        if (keys[mid].key < node->data) {
+            lower = mid + 1;
+        } else {
+            upper = mid;
+        }
+    }
+    int after = lower;
+    if (after < n && keys[after].key == node->data) {
+        batch->results[keys[after++].index] = 0;
+    }
+    splitInsertBatch(batch, &node->left, keys, lower, depth - 1);
+    splitInsertBatch(batch, &node->right, keys + after, n - after, depth - 1);
+}
+
+static inline void insertChunk(void* ctx, size_t from, size_t to) {
+    InsertBatch* batch = (InsertBatch*)ctx;
+    for (size_t t = from; t < to; t++) {
+        InsertTask* task = &batch->tasks[t];
+        if (*task->slot == NULL) {
+            // A run for an empty spot becomes a balanced subtree directly
+            BalancedBuild build;
+            build.keyAt = batchKeyAt;
+            build.source = task->keys;
+            *task->slot = buildBalancedRange(&build, 0, task->n);
+            for (int i = 0; i < task->n; i++) {
+                batch->results[task->keys[i].index] = 1;
+            }
+            continue;
+        }
+        Node* root = *task->slot;
+        for (int i = 0; i < task->n; i++) {
+            int added = searchNode(root, task->keys[i].key) == NULL;
+            if (added) {
+                root = insertNode(root, task->keys[i].key);
+            }
+            batch->results[task->keys[i].index] = added;
+        }
+        *task->slot = root;
+    }
+}
+
+// Rebalances the top depth levels bottom-up once the subtrees below them
+// have taken their keys: those are valid AVL trees again, but of whatever
+// heights the inserts left them, which joinTree evens out around each node
+static inline Node* rejoinTop(Node* node, int depth) {
+    if (node == NULL || depth == 0) {
+        return node;
+    }
+    Node* left = rejoinTop(node->left, depth - 1);
+    Node* right = rejoinTop(node->right, depth - 1);
+    return joinTree(left, node, right);
+}
+
+// Adds keys[0 .. n) to the AVL tree; results[i] is 1 when keys[i] was added.
+// The batch is sorted and split along the top levels of the tree, the
+// subtrees below take their runs of keys on the helper threads (they share
+// no nodes, so no locking), and one pass over the top levels rebalances it.
+// Call with treeLock held for writing and no snapshot open. Returns -1,
+// with the tree unchanged, if out of memory or if relaxed writes have left
+// the tree out of AVL balance: inserts into the subtrees and the joins
+// above them need balanced input.
+static inline int insertBatch(const int* keys, int n, unsigned char* results) {
+    if (isPending(sharedRoot)) {
+        return -1;
+    }
+    BatchKey* sorted = (BatchKey*)malloc(n * sizeof(BatchKey));
+    InsertBatch* batch = (InsertBatch*)malloc(sizeof(InsertBatch));
+    if (sorted == NULL || batch == NULL) {
+        free(sorted);
+        free(batch);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        sorted[i] = (BatchKey){keys[i], i};
+    }
+    qsort(sorted, n, sizeof(BatchKey), compareBatchKeys);
+    // Only the first of repeated keys can be added; the run keeps it
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique > 0 && sorted[unique - 1].key == sorted[i].key) {
+            results[sorted[i].index] = 0;
+        } else {
+            sorted[unique++] = sorted[i];
+        }
+    }
+
+    if (sharedRoot == NULL) {
+        sharedRoot = buildBalanced(batchKeyAt, sorted, unique);
+        for (int i = 0; i < unique; i++) {
+            results[sorted[i].index] = 1;
+        }
+    } else {
+        int depth = 0;
+        while ((1 << depth) < INSERT_SPREAD * (helperPool.threads + 1) && depth < INSERT_TOP_LEVELS) {
+            depth++;
+        }
+        batch->taskCount = 0;
+        batch->results = results;
+        splitInsertBatch(batch, &sharedRoot, sorted, unique, depth);
+        taskPoolFor(&helperPool, batch->taskCount, 1, insertChunk, batch);
+        sharedRoot = rejoinTop(sharedRoot, depth);
+    }
+    free(sorted);
+    free(batch);
+    return 0;
+}
+
+// Removes keys[0 .. n) from the AVL tree; results[i] is 1 when keys[i] was
+// removed. The keys present go into a balanced tree of their own, which is
+// subtracted from the shared tree in one differenceTrees. Call with treeLock
+// held for writing and no snapshot open. Returns -1, with the tree
+// unchanged, if out of memory or out of AVL balance, as for insertBatch.
+static inline int removeBatch(const int* keys, int n, unsigned char* results) {
+    if (isPending(sharedRoot)) {
+        return -1;
+    }
+    BatchKey* sorted = (BatchKey*)malloc(n * sizeof(BatchKey));
+    int* unique = (int*)malloc(n * sizeof(int));
+    unsigned char* present = (unsigned char*)malloc(n);
+    if (sorted == NULL || unique == NULL || present == NULL) {
+        free(sorted);
+        free(unique);
+        free(present);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        sorted[i] = (BatchKey){keys[i], i};
+    }
+    qsort(sorted, n, sizeof(BatchKey), compareBatchKeys);
+    // Only the first of repeated keys can be removed
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (count > 0 && sorted[count - 1].key == sorted[i].key) {
+            results[sorted[i].index] = 0;
+        } else {
+            sorted[count++] = sorted[i];
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        unique[i] = sorted[i].key;
+    }
+    searchNodeMany(sharedRoot, unique, count, present);
+
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        results[sorted[i].index] = present[i];
+        if (present[i]) {
+            unique[found++] = sorted[i].key;
+        }
+    }
+    sharedRoot = differenceTrees(sharedRoot, bulkLoad(unique, found));
+    free(sorted);
+    free(unique);
+    free(present);
+    return 0;
+}
+
+// Works through the imbalances relaxed writes leave behind, one write-lock
+// hold of RELAXED_BATCH fixes at a time, until none are left. Where the
+// scheduler allows it, the thread runs at idle priority, so a burst of
+// writes keeps the CPU and the fixes wait for the gap after it.
+static inline void* rebalanceThread(void* arg) {
+    (void)arg;
+#ifdef SCHED_IDLE
+    struct sched_param idle = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle); // Best effort
+#endif
+    while (1) {
+        if (sem_wait(&relaxedWanted) != 0) {
+            continue;
+        }
+        int more = 1;
+        while (more) {
+            pthread_rwlock_wrlock(&treeLock);
+            int budget = RELAXED_BATCH;
+            sharedRoot = rebalancePending(sharedRoot, &budget);
+            relaxedFixed += RELAXED_BATCH - budget;
+            if (retiredCount > 0) {
+                reclaimVersions();
+            }
+            more = isPending(sharedRoot);
+            relaxedRequested = more;
+            pthread_rwlock_unlock(&treeLock);
+            sched_yield(); // Writers waiting for the lock go first
+        }
+    }
+    return NULL;
+}
+
+// Call once before using the tree
+static inline void avlTreeInit() {
+    arenaInit(&nodeArena, sizeof(Node));
+    sem_init(&relaxedWanted, 0, 0);
+}
+
+#endif
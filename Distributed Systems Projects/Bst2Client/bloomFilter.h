@@ -0,0 +1,146 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counting Bloom filter over int keys, for answering most misses without
+// a tree walk.
+//
+// A lookup answers "definitely absent" or "maybe present". Every slot is a
+// 4-bit counter instead of a bit, so keys can be removed as well as added.
+// The filter is blocked: all of a key's probes land in one 64-byte block,
+// chosen by a second hash, so a lookup costs one cache line instead of one
+// per probe (Putze, Sanders and Singler, "Cache-, Hash- and Space-Efficient
+// Bloom Filters", 2007). A counter that reaches its maximum stays there,
+// since a removal can't tell how far it overflowed; that can only add false
+// positives, never false negatives.
+//
+// Not thread-safe: updates must exclude each other and lookups.
+
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_BLOCK_SLOTS (BLOOM_BLOCK_BYTES * 2) // Two 4-bit counters per byte
+#define BLOOM_SLOTS_PER_KEY 10                    // About 1% false positives when full
+#define BLOOM_PROBES 7                            // 7 bits of slot index each
+#define BLOOM_COUNTER_MAX 15
+
+typedef struct BloomFilter {
+    uint8_t* counters;
+    size_t blocks;    // 64-byte blocks of counters
+    size_t keys;      // Added and not removed since
+} BloomFilter;
+
+// MurmurHash3's 64-bit finalizer over the key and a seed
+static inline uint64_t bloomHash(int key, uint64_t seed) {
+    uint64_t h = (uint64_t)(uint32_t)key ^ seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint8_t* bloomBlock(const BloomFilter* filter, int key) {
+    // The top 32 bits scaled to [0, blocks), which needs no power of two
+    uint64_t h = bloomHash(key, 0x9e3779b97f4a7c15ULL) >> 32;
+    return filter->counters + ((h * filter->blocks) >> 32) * BLOOM_BLOCK_BYTES;
+}
+
+// Sized for expectedKeys at BLOOM_SLOTS_PER_KEY. Returns 0, or -1 if out of
+// memory.
+static inline int bloomInit(BloomFilter* filter, size_t expectedKeys) {
+    size_t blocks = (expectedKeys * BLOOM_SLOTS_PER_KEY + BLOOM_BLOCK_SLOTS - 1) / BLOOM_BLOCK_SLOTS;
+    if (blocks == 0) {
+        blocks = 1;
+    }
+    filter->counters = (uint8_t*)aligned_alloc(BLOOM_BLOCK_BYTES, blocks * BLOOM_BLOCK_BYTES);
+    if (filter->counters == NULL) {
+        return -1;
+    }
+    memset(filter->counters, 0, blocks * BLOOM_BLOCK_BYTES);
+    filter->blocks = blocks;
+    filter->keys = 0;
+    return 0;
+}
+
+static inline size_t bloomBytes(const BloomFilter* filter) {
+    return filter->blocks * BLOOM_BLOCK_BYTES;
+}
+
+// Adds one to (or with delta -1, takes one from) each of key's counters
+static inline void bloomUpdate(BloomFilter* filter, int key, int delta) {
+    uint8_t* block = bloomBlock(filter, key);
+    uint64_t h = bloomHash(key, 0);
+    for (int i = 0; i < BLOOM_PROBES; i++, h >>= 7) {
+        unsigned slot = h & (BLOOM_BLOCK_SLOTS - 1);
+        int shift = (slot & 1) * 4;
+        unsigned counter = (block[slot / 2] >> shift) & BLOOM_COUNTER_MAX;
+        if (counter < BLOOM_COUNTER_MAX && (delta > 0 || counter > 0)) {
+            block[slot / 2] += delta * (1 << shift);
+        }
+    }
+}
+
+static inline void bloomAdd(BloomFilter* filter, int key) {
+    bloomUpdate(filter, key, 1);
+    filter->keys++;
+}
+
+// Only for keys that were added and not removed since
+static inline void bloomRemove(BloomFilter* filter, int key) {
+    bloomUpdate(filter, key, -1);
+    filter->keys--;
+}
+
+static inline void bloomPrefetch(const BloomFilter* filter, int key) {
+    __builtin_prefetch(bloomBlock(filter, key));
+}
+
+// 0 when key was certainly never added (or was removed since)
+static inline int bloomMayContain(const BloomFilter* filter, int key) {
+    const uint8_t* block = bloomBlock(filter, key);
+    uint64_t h = bloomHash(key, 0);
+    int present = 1;
+    for (int i = 0; i < BLOOM_PROBES; i++, h >>= 7) {
+        unsigned slot = h & (BLOOM_BLOCK_SLOTS - 1);
+        present &= ((block[slot / 2] >> ((slot & 1) * 4)) & BLOOM_COUNTER_MAX) != 0;
+    }
+    return present;
+}
+
+// e^-x for x >= 0 without libm: a cubic Taylor series on x / 2^s, squared
+// s times. Within 1e-8 of exp(-x), plenty for a rate printed in percent.
+static inline double bloomExpNeg(double x) {
+    int halvings = 0;
+    while (x > 1.0 / 1024 && halvings < 64) {
+        x /= 2;
+        halvings++;
+    }
+    double result = 1 - x + x * x / 2 - x * x * x / 6;
+    while (halvings-- > 0) {
+        result *= result;
+    }
+    return result;
+}
+
+// False-positive rate expected at the current key count, from the classic
+// formula (1 - e^(-kn/m))^k. Blocking makes the real rate slightly higher.
+static inline double bloomExpectedFpr(const BloomFilter* filter) {
+    double slots = (double)filter->blocks * BLOOM_BLOCK_SLOTS;
+    double slotClear = 1 - bloomExpNeg(BLOOM_PROBES * (double)filter->keys / slots);
+    double rate = 1;
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        rate *= slotClear;
+    }
+    return rate;
+}
+
+static inline void bloomFree(BloomFilter* filter) {
+    free(filter->counters);
+    filter->counters = NULL;
+}
+
+#endif
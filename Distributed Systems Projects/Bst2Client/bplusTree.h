@@ -0,0 +1,562 @@
+#ifndef BPLUS_TREE_H
+#define BPLUS_TREE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "nodeArena.h"
+
+// Cache-conscious B+-tree of ints.
+//
+// A binary tree pays one dependent cache miss per level, about 23 of them
+// for 10M keys. Here every node is exactly four cache lines (256 bytes) and
+// holds a sorted array of keys, so the same lookup touches 5 or 6 nodes, and
+// the compares inside a node run on all of its keys at once: with AVX2 eight
+// keys per instruction, with SSE2 (any x86-64) four, and one at a time on
+// other targets. Build with -mavx2 (or -march=native) for the wide version.
+//
+// Keys live only in the leaves, and the leaves are linked in key order, so a
+// range scan descends once and then reads leaves sequentially. Inner nodes
+// hold separators: child i covers keys in [keys[i - 1], keys[i]).
+//
+// Unused key slots hold INT_MAX. That lets the in-node search compare whole
+// vectors without a tail mask: padding never counts as smaller than a key.
+//
+// The tree itself does no locking; callers serialize writers against
+// readers (the server keeps it under the same read-write lock as the AVL).
+
+#define BPT_LEAF_KEYS 60   // 240 bytes of keys + count + next pointer = 256
+#define BPT_INNER_KEYS 20  // 80 bytes of keys + count + 21 children = 256
+#define BPT_LEAF_MIN (BPT_LEAF_KEYS / 2)
+#define BPT_INNER_MIN (BPT_INNER_KEYS / 2)
+#define BPT_MAX_HEIGHT 16  // Inner levels; 21^16 children is far more than any int set
+
+// Bulk builds fill nodes to 7/8 so the first inserts don't split them all
+#define BPT_BUILD_LEAF_FILL (BPT_LEAF_KEYS * 7 / 8)
+#define BPT_BUILD_INNER_FILL ((BPT_INNER_KEYS + 1) * 7 / 8)
+
+typedef struct BptLeaf {
+    int count;
+    int keys[BPT_LEAF_KEYS];
+    struct BptLeaf* next;
+} BptLeaf;
+
+typedef struct BptInner {
+    int count; // Keys; there is one more child than keys
+    int keys[BPT_INNER_KEYS];
+    void* children[BPT_INNER_KEYS + 1]; // Leaves on the lowest inner level, inner nodes above
+} BptInner;
+
+typedef struct BPlusTree {
+    void* root;  // A leaf while height is 0
+    int height;  // Inner levels above the leaves
+    size_t count;
+} BPlusTree;
+
+// All trees share one arena per node type
+static NodeArena bptLeafArena;
+static NodeArena bptInnerArena;
+
+// Number of keys[i] < key among the first slots (a multiple of 4). The
+// keys are sorted, so this is also the index of the first key >= key.
+static inline int bptRank(const int* keys, int slots, int key) {
+    int rank = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i needle8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= slots; i += 8) {
+        __m256i less = _mm256_cmpgt_epi32(needle8, _mm256_loadu_si256((const __m256i*)(keys + i)));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(less));
+        rank += __builtin_popcount(mask);
+        if (mask != 0xFF) {
+            return rank; // Sorted: nothing further along is smaller
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i needle4 = _mm_set1_epi32(key);
+    for (; i + 4 <= slots; i += 4) {
+        __m128i less = _mm_cmpgt_epi32(needle4, _mm_loadu_si128((const __m128i*)(keys + i)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(less));
+        rank += __builtin_popcount(mask);
+        if (mask != 0xF) {
+            return rank;
+        }
+    }
+#endif
+    for (; i < slots && keys[i] < key; i++) {
+        rank++;
+    }
+    return rank;
+}
+
+// Only the slots up to count rounded up to a whole SSE vector are read
+static inline int bptSlots(int count) {
+    return (count + 3) & ~3;
+}
+
+// Index of the child of node that covers key
+static inline int bptChildIndex(const BptInner* node, int key) {
+    int i = bptRank(node->keys, bptSlots(node->count), key);
+    return i < node->count && node->keys[i] == key ? i + 1 : i;
+}
+
+static inline void bptPadKeys(int* keys, int from, int capacity) {
+    for (int i = from; i < capacity; i++) {
+        keys[i] = INT_MAX;
+    }
+}
+
+static inline BptLeaf* bptNewLeaf(void) {
+    BptLeaf* leaf = (BptLeaf*)arenaAlloc(&bptLeafArena);
+    leaf->count = 0;
+    bptPadKeys(leaf->keys, 0, BPT_LEAF_KEYS);
+    leaf->next = NULL;
+    return leaf;
+}
+
+static inline BptInner* bptNewInner(void) {
+    BptInner* node = (BptInner*)arenaAlloc(&bptInnerArena);
+    node->count = 0;
+    bptPadKeys(node->keys, 0, BPT_INNER_KEYS);
+    return node;
+}
+
+static inline void bptTreeInit(BPlusTree* tree) {
+    if (bptLeafArena.objectSize == 0) {
+        arenaInit(&bptLeafArena, sizeof(BptLeaf));
+        arenaInit(&bptInnerArena, sizeof(BptInner));
+    }
+    tree->root = bptNewLeaf();
+    tree->height = 0;
+    tree->count = 0;
+}
+
+static inline BptLeaf* bptFindLeaf(const BPlusTree* tree, int key) {
+    void* node = tree->root;
+    for (int level = 0; level < tree->height; level++) {
+        BptInner* inner = (BptInner*)node;
+        node = inner->children[bptChildIndex(inner, key)];
+    }
+    return (BptLeaf*)node;
+}
+
+static inline int bptSearch(const BPlusTree* tree, int key) {
+    BptLeaf* leaf = bptFindLeaf(tree, key);
+    int i = bptRank(leaf->keys, bptSlots(leaf->count), key);
+    return i < leaf->count && leaf->keys[i] == key;
+}
+
+static inline void bptPrefetch(const void* node) {
+    for (int line = 0; line < 4; line++) {
+        __builtin_prefetch((const char*)node + line * 64);
+    }
+}
+
+#define BPT_SEARCH_GROUP 16 // Descents bptSearchMany keeps in flight
+
+// Looks up keys[0 .. n) together: up to BPT_SEARCH_GROUP descents take
+// turns, each prefetching its next node before yielding to the others, so
+// their cache misses overlap. results[i] is 1 when keys[i] is present.
+static inline void bptSearchMany(const BPlusTree* tree, const int* keys, int n, unsigned char* results) {
+    void* current[BPT_SEARCH_GROUP];
+    int level[BPT_SEARCH_GROUP];
+    int slot[BPT_SEARCH_GROUP]; // Which key each descent is looking for
+    int active = 0;
+    int next = 0;
+    while (active < BPT_SEARCH_GROUP && next < n) {
+        current[active] = tree->root;
+        level[active] = 0;
+        slot[active++] = next++;
+    }
+    while (active > 0) {
+        for (int i = 0; i < active;) {
+            int key = keys[slot[i]];
+            if (level[i] < tree->height) {
+                BptInner* inner = (BptInner*)current[i];
+                current[i] = inner->children[bptChildIndex(inner, key)];
+                bptPrefetch(current[i]);
+                level[i]++;
+                i++;
+                continue;
+            }
+            BptLeaf* leaf = (BptLeaf*)current[i];
+            int at = bptRank(leaf->keys, bptSlots(leaf->count), key);
+            results[slot[i]] = at < leaf->count && leaf->keys[at] == key;
+            if (next < n) {
+                current[i] = tree->root;
+                level[i] = 0;
+                slot[i++] = next++;
+            } else {
+                // Fill the hole with the last descent, which runs next
+                active--;
+                current[i] = current[active];
+                level[i] = level[active];
+                slot[i] = slot[active];
+            }
+        }
+    }
+}
+
+// Puts key and its right-hand child at position i of a non-full inner node
+static inline void bptInnerInsertAt(BptInner* node, int i, int key, void* right) {
+    memmove(node->keys + i + 1, node->keys + i, (node->count - i) * sizeof(int));
+    memmove(node->children + i + 2, node->children + i + 1, (node->count - i) * sizeof(void*));
+    node->keys[i] = key;
+    node->children[i + 1] = right;
+    node->count++;
+}
+
+// Returns 1 if key was added, 0 if it was already present
+static inline int bptInsert(BPlusTree* tree, int key) {
+    BptInner* path[BPT_MAX_HEIGHT];
+    int pathIndex[BPT_MAX_HEIGHT];
+    void* node = tree->root;
+    for (int level = 0; level < tree->height; level++) {
+        path[level] = (BptInner*)node;
+        pathIndex[level] = bptChildIndex(path[level], key);
+        node = path[level]->children[pathIndex[level]];
+    }
+
+    BptLeaf* leaf = (BptLeaf*)node;
+    int i = bptRank(leaf->keys, bptSlots(leaf->count), key);
+    if (i < leaf->count && leaf->keys[i] == key) {
+        return 0;
+    }
+    tree->count++;
+    if (leaf->count < BPT_LEAF_KEYS) {
+        memmove(leaf->keys + i + 1, leaf->keys + i, (leaf->count - i) * sizeof(int));
+        leaf->keys[i] = key;
+        leaf->count++;
+        return 1;
+    }
+
+    // Split the full leaf: the upper half moves to a new right sibling,
+    // whose first key becomes the separator for the parent
+    int merged[BPT_LEAF_KEYS + 1];
+    memcpy(merged, leaf->keys, i * sizeof(int));
+    merged[i] = key;
+    memcpy(merged + i + 1, leaf->keys + i, (BPT_LEAF_KEYS - i) * sizeof(int));
+    BptLeaf* right = bptNewLeaf();
+    int keep = (BPT_LEAF_KEYS + 1) / 2;
+    if (i == BPT_LEAF_KEYS && leaf->next == NULL) {
+        keep = BPT_LEAF_KEYS; // Appending past the largest key: keep this leaf full
+    }
+    right->count = BPT_LEAF_KEYS + 1 - keep;
+    memcpy(right->keys, merged + keep, right->count * sizeof(int));
+    memcpy(leaf->keys, merged, keep * sizeof(int));
+    bptPadKeys(leaf->keys, keep, BPT_LEAF_KEYS);
+    leaf->count = keep;
+    right->next = leaf->next;
+    leaf->next = right;
+
+    int separator = right->keys[0];
+    void* newChild = right;
+    for (int level = tree->height - 1; level >= 0; level--) {
+        BptInner* parent = path[level];
+        int at = pathIndex[level];
+        if (parent->count < BPT_INNER_KEYS) {
+            bptInnerInsertAt(parent, at, separator, newChild);
+            return 1;
+        }
+
+        // Split the full inner node; its middle key moves up a level
+        int keys[BPT_INNER_KEYS + 1];
+        void* children[BPT_INNER_KEYS + 2];
+        memcpy(keys, parent->keys, at * sizeof(int));
+        keys[at] = separator;
+        memcpy(keys + at + 1, parent->keys + at, (BPT_INNER_KEYS - at) * sizeof(int));
+        memcpy(children, parent->children, (at + 1) * sizeof(void*));
+        children[at + 1] = newChild;
+        memcpy(children + at + 2, parent->children + at + 1, (BPT_INNER_KEYS - at) * sizeof(void*));
+
+        int mid = (BPT_INNER_KEYS + 1) / 2;
+        BptInner* sibling = bptNewInner();
+        sibling->count = BPT_INNER_KEYS - mid;
+        memcpy(sibling->keys, keys + mid + 1, sibling->count * sizeof(int));
+        memcpy(sibling->children, children + mid + 1, (sibling->count + 1) * sizeof(void*));
+        memcpy(parent->keys, keys, mid * sizeof(int));
+        bptPadKeys(parent->keys, mid, BPT_INNER_KEYS);
+        memcpy(parent->children, children, (mid + 1) * sizeof(void*));
+        parent->count = mid;
+
+        separator = keys[mid];
+        newChild = sibling;
+    }
+
+    // The root split: grow the tree by one level
+    BptInner* root = bptNewInner();
+    root->count = 1;
+    root->keys[0] = separator;
+    root->children[0] = tree->root;
+    root->children[1] = newChild;
+    tree->root = root;
+    tree->height++;
+    return 1;
+}
+
+// Drops key i and the child to its right from an inner node
+static inline void bptInnerRemoveAt(BptInner* node, int i) {
+    memmove(node->keys + i, node->keys + i + 1, (node->count - i - 1) * sizeof(int));
+    memmove(node->children + i + 1, node->children + i + 2, (node->count - i - 1) * sizeof(void*));
+    node->count--;
+    node->keys[node->count] = INT_MAX;
+}
+
+// Refills leaf (child i of parent) from a sibling, or merges it into one
+static inline void bptFixLeaf(BptInner* parent, int i, BptLeaf* leaf) {
+    BptLeaf* left = i > 0 ? (BptLeaf*)parent->children[i - 1] : NULL;
+    BptLeaf* right = i < parent->count ? (BptLeaf*)parent->children[i + 1] : NULL;
+
+    if (left != NULL && left->count > BPT_LEAF_MIN) {
+        memmove(leaf->keys + 1, leaf->keys, leaf->count * sizeof(int));
+        leaf->keys[0] = left->keys[--left->count];
+        left->keys[left->count] = INT_MAX;
+        leaf->count++;
+        parent->keys[i - 1] = leaf->keys[0];
+    } else if (right != NULL && right->count > BPT_LEAF_MIN) {
+        leaf->keys[leaf->count++] = right->keys[0];
+        memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(int));
+        right->keys[--right->count] = INT_MAX;
+        parent->keys[i] = right->keys[0];
+    } else {
+        // Neither sibling can spare a key, so two leaves fit in one
+        if (left == NULL) {
+            left = leaf;
+            leaf = right;
+            i++;
+        }
+        memcpy(left->keys + left->count, leaf->keys, leaf->count * sizeof(int));
+        left->count += leaf->count;
+        left->next = leaf->next;
+        bptInnerRemoveAt(parent, i - 1);
+        arenaFree(&bptLeafArena, leaf);
+    }
+}
+
+// Same for an inner node, rotating keys through the parent's separator
+static inline void bptFixInner(BptInner* parent, int i, BptInner* node) {
+    BptInner* left = i > 0 ? (BptInner*)parent->children[i - 1] : NULL;
+    BptInner* right = i < parent->count ? (BptInner*)parent->children[i + 1] : NULL;
+
+    if (left != NULL && left->count > BPT_INNER_MIN) {
+        memmove(node->keys + 1, node->keys, node->count * sizeof(int));
+        memmove(node->children + 1, node->children, (node->count + 1) * sizeof(void*));
+        node->keys[0] = parent->keys[i - 1];
+        node->children[0] = left->children[left->count];
+        node->count++;
+        parent->keys[i - 1] = left->keys[--left->count];
+        left->keys[left->count] = INT_MAX;
+    } else if (right != NULL && right->count > BPT_INNER_MIN) {
+        node->keys[node->count] = parent->keys[i];
+        node->children[node->count + 1] = right->children[0];
+        node->count++;
+        parent->keys[i] = right->keys[0];
+        memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(int));
+        memmove(right->children, right->children + 1, right->count * sizeof(void*));
+        right->keys[--right->count] = INT_MAX;
+    } else {
+        if (left == NULL) {
+            left = node;
+            node = right;
+            i++;
+        }
+        // The separator between the two comes down between their keys
+        left->keys[left->count] = parent->keys[i - 1];
+        memcpy(left->keys + left->count + 1, node->keys, node->count * sizeof(int));
+        memcpy(left->children + left->count + 1, node->children, (node->count + 1) * sizeof(void*));
+        left->count += node->count + 1;
+        bptInnerRemoveAt(parent, i - 1);
+        arenaFree(&bptInnerArena, node);
+    }
+}
+
+// Returns 1 if key was removed, 0 if it was not present
+static inline int bptRemove(BPlusTree* tree, int key) {
+    BptInner* path[BPT_MAX_HEIGHT];
+    int pathIndex[BPT_MAX_HEIGHT];
+    void* node = tree->root;
+    for (int level = 0; level < tree->height; level++) {
+        path[level] = (BptInner*)node;
+        pathIndex[level] = bptChildIndex(path[level], key);
+        node = path[level]->children[pathIndex[level]];
+    }
+
+    BptLeaf* leaf = (BptLeaf*)node;
+    int i = bptRank(leaf->keys, bptSlots(leaf->count), key);
+    if (i >= leaf->count || leaf->keys[i] != key) {
+        return 0;
+    }
+    memmove(leaf->keys + i, leaf->keys + i + 1, (leaf->count - i - 1) * sizeof(int));
+    leaf->keys[--leaf->count] = INT_MAX;
+    tree->count--;
+
+    // Repair underfull nodes bottom-up; a fix can only underfill the parent
+    int level = tree->height - 1;
+    if (level >= 0 && leaf->count < BPT_LEAF_MIN) {
+        bptFixLeaf(path[level], pathIndex[level], leaf);
+        for (level--; level >= 0 && path[level + 1]->count < BPT_INNER_MIN; level--) {
+            bptFixInner(path[level], pathIndex[level], path[level + 1]);
+        }
+    }
+
+    if (tree->height > 0 && ((BptInner*)tree->root)->count == 0) {
+        BptInner* root = (BptInner*)tree->root;
+        tree->root = root->children[0];
+        tree->height--;
+        arenaFree(&bptInnerArena, root);
+    }
+    return 1;
+}
+
+// Copies up to max keys in [lo, hi] into keys in ascending order
+static inline int bptRange(const BPlusTree* tree, int lo, int hi, int* keys, int max) {
+    BptLeaf* leaf = bptFindLeaf(tree, lo);
+    int i = bptRank(leaf->keys, bptSlots(leaf->count), lo);
+    int n = 0;
+    while (n < max) {
+        if (i == leaf->count) {
+            leaf = leaf->next;
+            i = 0;
+            if (leaf == NULL) {
+                break;
+            }
+            continue;
+        }
+        if (leaf->keys[i] > hi) {
+            break;
+        }
+        keys[n++] = leaf->keys[i++];
+    }
+    return n;
+}
+
+static inline void bptFreeNodes(void* node, int height) {
+    if (height == 0) {
+        arenaFree(&bptLeafArena, node);
+        return;
+    }
+    BptInner* inner = (BptInner*)node;
+    for (int i = 0; i <= inner->count; i++) {
+        bptFreeNodes(inner->children[i], height - 1);
+    }
+    arenaFree(&bptInnerArena, inner);
+}
+
+// Frees every node and leaves the tree empty
+static inline void bptClear(BPlusTree* tree) {
+    bptFreeNodes(tree->root, tree->height);
+    bptTreeInit(tree);
+}
+
+// Bottom-up build from keys that arrive in ascending order, e.g. straight
+// from a checkpoint. Each key is copied once and no node ever splits:
+// leaves are filled left to right, then each inner level is laid over the
+// one below. Nodes in a level share the keys evenly; when that leaves them
+// under half full, removes repair them like any other underfull node.
+typedef struct BptBuilder {
+    BPlusTree* tree;
+    size_t total;      // Keys the caller will add
+    size_t added;
+    size_t nodeCount;  // Nodes on the level being built
+    void** nodes;
+    int* lows;         // Smallest key under each node
+    BptLeaf* leaf;     // Leaf being filled
+    size_t leafKeys;   // Keys that leaf gets
+} BptBuilder;
+
+// Keys a node of level gets when count items are spread over parts nodes
+static inline size_t bptShare(size_t count, size_t parts, size_t index) {
+    return count / parts + (index < count % parts ? 1 : 0);
+}
+
+// Starts filling an empty, initialized tree with exactly total keys; the
+// tree stays valid (and empty) until bptBuildFinish. Returns 0, or -1 if
+// out of memory.
+static inline int bptBuildStart(BptBuilder* builder, BPlusTree* tree, size_t total) {
+    builder->tree = tree;
+    builder->total = total;
+    builder->added = 0;
+    builder->nodeCount = 0;
+    builder->leaf = NULL;
+    builder->leafKeys = 0;
+    size_t leaves = (total + BPT_BUILD_LEAF_FILL - 1) / BPT_BUILD_LEAF_FILL;
+    if (leaves == 0) {
+        leaves = 1;
+    }
+    builder->nodes = (void**)malloc(leaves * sizeof(void*));
+    builder->lows = (int*)malloc(leaves * sizeof(int));
+    if (builder->nodes == NULL || builder->lows == NULL) {
+        free(builder->nodes);
+        free(builder->lows);
+        return -1;
+    }
+    return 0;
+}
+
+// Adds the next key; keys must be strictly ascending
+static inline void bptBuildAdd(BptBuilder* builder, int key) {
+    BptLeaf* leaf = builder->leaf;
+    if (leaf == NULL || (size_t)leaf->count == builder->leafKeys) {
+        size_t leaves = (builder->total + BPT_BUILD_LEAF_FILL - 1) / BPT_BUILD_LEAF_FILL;
+        BptLeaf* next = bptNewLeaf();
+        if (leaf != NULL) {
+            leaf->next = next;
+        }
+        builder->leafKeys = bptShare(builder->total, leaves, builder->nodeCount);
+        builder->nodes[builder->nodeCount] = next;
+        builder->lows[builder->nodeCount] = key;
+        builder->nodeCount++;
+        builder->leaf = leaf = next;
+    }
+    leaf->keys[leaf->count++] = key;
+    builder->added++;
+}
+
+static inline void bptBuildFinish(BptBuilder* builder) {
+    BPlusTree* tree = builder->tree;
+    if (builder->nodeCount == 0) {
+        builder->nodes[builder->nodeCount++] = bptNewLeaf();
+    }
+
+    // Lay inner levels over the nodes until one node is left; each parent
+    // takes over its first child's low key, so the arrays shrink in place
+    int height = 0;
+    size_t count = builder->nodeCount;
+    while (count > 1) {
+        size_t parents = (count + BPT_BUILD_INNER_FILL - 1) / BPT_BUILD_INNER_FILL;
+        size_t child = 0;
+        for (size_t p = 0; p < parents; p++) {
+            BptInner* parent = bptNewInner();
+            size_t take = bptShare(count, parents, p);
+            int low = builder->lows[child];
+            for (size_t c = 0; c < take; c++, child++) {
+                parent->children[c] = builder->nodes[child];
+                if (c > 0) {
+                    parent->keys[c - 1] = builder->lows[child];
+                }
+            }
+            parent->count = (int)take - 1;
+            builder->nodes[p] = parent;
+            builder->lows[p] = low;
+        }
+        count = parents;
+        height++;
+    }
+
+    arenaFree(&bptLeafArena, tree->root); // The empty tree's only leaf
+    tree->root = builder->nodes[0];
+    tree->height = height;
+    tree->count = builder->added;
+    free(builder->nodes);
+    free(builder->lows);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef BST_PROTOCOL_H
+#define BST_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Binary wire protocol shared by Server.c, Client.c and BenchClient.c.
+//
+// Every message is a 12-byte header followed by `length` payload bytes. All
+// integers are little-endian regardless of host byte order.
+//
+//   offset 0  u8   magic (PROTOCOL_MAGIC)
+//   offset 1  u8   version (PROTOCOL_VERSION)
+//   offset 2  u8   opcode in requests, status in responses
+//   offset 3  u8   flags
+//   offset 4  u32  request id, echoed back in the response
+//   offset 8  u32  payload length in bytes
+//
+// SEARCH/INSERT/REMOVE requests carry a vector of int32 keys, so one frame
+// can batch many keys. The response carries one status byte per key in the
+// same order (1: found/added/removed, 0: not found/already present/absent).
+// Requests may be pipelined; responses come back in request order and carry
+// the request id so clients can match them up.
+//
+// RANGE carries three int32s: lo, hi and limit (0: no limit). The keys in
+// [lo, hi] come back in ascending order as a stream of frames that share the
+// request id, each holding up to RANGE_CHUNK_KEYS int32 keys. Every frame but
+// the last has FLAG_MORE set; the last may be empty. On the AVL index the
+// whole stream shows the tree as it was when the request was answered,
+// however long the client takes to read it; on the others a write made
+// while it streams may or may not show up.
+//
+// The order statistics also take vectors, answered in request order:
+//   RANK         int32 keys; one u32 per key: how many keys are smaller
+//   SELECT       u32 ranks (0: the smallest key); a u32 holding the number
+//                of keys in the tree, then the int32 key of each rank (0
+//                for ranks at or past that number)
+//   COUNT_RANGE  (lo, hi) int32 pairs; one u32 per pair: how many keys are
+//                in [lo, hi]
+//
+// WAIT carries an int32 key and a u32 timeout in milliseconds (0: don't
+// wait, WAIT_FOREVER: no limit). The response comes once the key is in the
+// tree or the timeout has passed, as one byte (1: present, 0: timed out);
+// requests behind it on the connection are answered after it. If the server
+// shuts down first, the status is STATUS_SHUTTING_DOWN.
+//
+// A connection may also speak the original protocol (two host-endian ints:
+// option, target; NUL-terminated text reply). The magic byte can never be a
+// valid legacy option, which is how the server tells the two apart.
+
+#define PROTOCOL_MAGIC 0xB5
+#define PROTOCOL_VERSION 1
+#define FRAME_HEADER_SIZE 12
+#define MAX_FRAME_PAYLOAD (1024 * 1024)
+
+// Opcodes (the point operations match the legacy request codes)
+#define OP_SEARCH 1
+#define OP_INSERT 2
+#define OP_REMOVE 3
+#define OP_RANGE 4
+#define OP_RANK 5
+#define OP_SELECT 6
+#define OP_COUNT_RANGE 7
+#define OP_WAIT 8
+
+// Flags
+#define FLAG_MORE 0x01 // More response frames follow for this request
+
+#define RANGE_CHUNK_KEYS 1024
+#define WAIT_FOREVER 0xFFFFFFFFu
+
+// Response statuses
+#define STATUS_OK 0
+#define STATUS_BAD_REQUEST 1
+#define STATUS_BAD_VERSION 2
+#define STATUS_UNKNOWN_OPCODE 3
+#define STATUS_SHUTTING_DOWN 4
+
+typedef struct FrameHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t opcode; // Status in responses
+    uint8_t flags;
+    uint32_t requestId;
+    uint32_t length;
+} FrameHeader;
+
+static inline void putUint32(unsigned char* out, uint32_t value) {
+    out[0] = (unsigned char)value;
+    out[1] = (unsigned char)(value >> 8);
+    out[2] = (unsigned char)(value >> 16);
+    out[3] = (unsigned char)(value >> 24);
+}
+
+static inline uint32_t getUint32(const unsigned char* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static inline void putInt32(unsigned char* out, int32_t value) {
+    putUint32(out, (uint32_t)value);
+}
+
+static inline int32_t getInt32(const unsigned char* in) {
+    return (int32_t)getUint32(in);
+}
+
+static inline void encodeFrameHeader(unsigned char* out, uint8_t opcode, uint8_t flags, uint32_t requestId, uint32_t length) {
+    out[0] = PROTOCOL_MAGIC;
+    out[1] = PROTOCOL_VERSION;
+    out[2] = opcode;
+    out[3] = flags;
+    putUint32(out + 4, requestId);
+    putUint32(out + 8, length);
+}
+
+static inline void decodeFrameHeader(const unsigned char* in, FrameHeader* header) {
+    header->magic = in[0];
+    header->version = in[1];
+    header->opcode = in[2];
+    header->flags = in[3];
+    header->requestId = getUint32(in + 4);
+    header->length = getUint32(in + 8);
+}
+
+#endif
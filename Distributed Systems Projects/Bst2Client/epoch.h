@@ -0,0 +1,241 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Epoch-based memory reclamation for the concurrent trees (Fraser,
+// "Practical lock-freedom", 2004).
+//
+// A node unlinked from a lock-free tree can't be freed at once: a reader
+// that found it a moment earlier may still be reading it. So every tree
+// operation runs between ebrEnter() and ebrExit(), and unlinked nodes are
+// handed to ebrRetire() instead of free().
+//
+// A global epoch counter moves forward only once every thread inside an
+// operation has seen its current value. A thread that is inside an
+// operation at epoch e can only hold nodes that were still linked at
+// epoch e, so anything retired at epoch e is unreachable once the global
+// epoch reaches e + 2. Each thread keeps its retired nodes in three
+// buckets by epoch and frees a whole bucket at once when it gets that old.
+//
+// Threads register on first use. A thread's record is handed back when it
+// exits and reused by the next new thread; until then, whichever thread
+// advances the epoch frees what the exited one left waiting.
+
+#define EBR_BUCKETS 3
+#define EBR_ADVANCE_EVERY 64 // Retires (or exits with nodes pending) per attempt to advance the epoch
+#define EBR_NONE UINT64_MAX
+
+typedef struct EbrRetired {
+    void* ptr;
+    size_t size;
+    void (*release)(void* ptr);
+} EbrRetired;
+
+typedef struct EbrBucket {
+    uint64_t epoch; // Epoch its items were retired in
+    EbrRetired* items;
+    size_t count;
+    size_t capacity;
+} EbrBucket;
+
+typedef struct EbrThread {
+    _Atomic uint64_t state;         // (epoch seen on entry << 1) | 1 while inside an operation
+    _Atomic int inUse;
+    _Atomic uint64_t oldestPending; // Epoch of the oldest unfreed bucket (EBR_NONE: none)
+    int nesting;
+    int sinceAdvance;
+    EbrBucket buckets[EBR_BUCKETS];
+    struct EbrThread* next;
+} EbrThread;
+
+typedef struct EbrStats {
+    uint64_t epoch;
+    uint64_t pendingNodes;  // Retired but not yet freed
+    uint64_t pendingBytes;
+    uint64_t freedNodes;
+    uint64_t freedBytes;
+    uint64_t lag;           // Epochs since the oldest pending node was retired
+    int threads;            // Thread records ever created
+} EbrStats;
+
+static _Atomic uint64_t ebrEpoch = 0;
+static _Atomic(EbrThread*) ebrThreads = NULL;
+static _Atomic uint64_t ebrPendingNodes = 0, ebrPendingBytes = 0;
+static _Atomic uint64_t ebrFreedNodes = 0, ebrFreedBytes = 0;
+static pthread_key_t ebrKey;
+static pthread_once_t ebrOnce = PTHREAD_ONCE_INIT;
+static __thread EbrThread* ebrCurrent = NULL;
+
+static inline void ebrReleaseThread(void* arg) {
+    EbrThread* self = (EbrThread*)arg;
+    atomic_store(&self->state, 0);
+    self->nesting = 0;
+    atomic_store(&self->inUse, 0);
+}
+
+static inline void ebrCreateKey(void) {
+    pthread_key_create(&ebrKey, ebrReleaseThread);
+}
+
+static inline EbrThread* ebrSelf(void) {
+    if (ebrCurrent != NULL) {
+        return ebrCurrent;
+    }
+    pthread_once(&ebrOnce, ebrCreateKey);
+
+    EbrThread* self = NULL;
+    for (EbrThread* t = atomic_load(&ebrThreads); t != NULL && self == NULL; t = t->next) {
+        int expected = 0;
+        if (atomic_load(&t->inUse) == 0 && atomic_compare_exchange_strong(&t->inUse, &expected, 1)) {
+            self = t;
+        }
+    }
+    if (self == NULL) {
+        self = (EbrThread*)calloc(1, sizeof(EbrThread));
+        atomic_init(&self->inUse, 1);
+        atomic_init(&self->oldestPending, EBR_NONE);
+        EbrThread* head = atomic_load(&ebrThreads);
+        do {
+            self->next = head;
+        } while (!atomic_compare_exchange_weak(&ebrThreads, &head, self));
+    }
+    pthread_setspecific(ebrKey, self);
+    ebrCurrent = self;
+    return self;
+}
+
+static inline void ebrFreeBucket(EbrBucket* bucket) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < bucket->count; i++) {
+        bucket->items[i].release(bucket->items[i].ptr);
+        bytes += bucket->items[i].size;
+    }
+    atomic_fetch_sub(&ebrPendingNodes, bucket->count);
+    atomic_fetch_sub(&ebrPendingBytes, bytes);
+    atomic_fetch_add(&ebrFreedNodes, bucket->count);
+    atomic_fetch_add(&ebrFreedBytes, bytes);
+    bucket->count = 0;
+}
+
+static inline void ebrUpdateOldest(EbrThread* self) {
+    uint64_t oldest = EBR_NONE;
+    for (int i = 0; i < EBR_BUCKETS; i++) {
+        if (self->buckets[i].count > 0 && self->buckets[i].epoch < oldest) {
+            oldest = self->buckets[i].epoch;
+        }
+    }
+    atomic_store_explicit(&self->oldestPending, oldest, memory_order_relaxed);
+}
+
+// Frees every bucket of self that no thread can still be reading
+static inline void ebrReclaim(EbrThread* self) {
+    uint64_t epoch = atomic_load(&ebrEpoch);
+    int freed = 0;
+    for (int i = 0; i < EBR_BUCKETS; i++) {
+        EbrBucket* bucket = &self->buckets[i];
+        if (bucket->count > 0 && bucket->epoch + 2 <= epoch) {
+            ebrFreeBucket(bucket);
+            freed = 1;
+        }
+    }
+    if (freed) {
+        ebrUpdateOldest(self);
+    }
+}
+
+// Moves the epoch forward if every thread inside an operation has seen it.
+// The thread that succeeds also frees what exited threads left behind.
+static inline void ebrTryAdvance(void) {
+    uint64_t epoch = atomic_load(&ebrEpoch);
+    for (EbrThread* t = atomic_load(&ebrThreads); t != NULL; t = t->next) {
+        uint64_t state = atomic_load(&t->state);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return;
+        }
+    }
+    if (!atomic_compare_exchange_strong(&ebrEpoch, &epoch, epoch + 1)) {
+        return;
+    }
+    for (EbrThread* t = atomic_load(&ebrThreads); t != NULL; t = t->next) {
+        int expected = 0;
+        if (atomic_load_explicit(&t->oldestPending, memory_order_relaxed) != EBR_NONE &&
+            atomic_load(&t->inUse) == 0 && atomic_compare_exchange_strong(&t->inUse, &expected, 1)) {
+            ebrReclaim(t);
+            atomic_store(&t->inUse, 0);
+        }
+    }
+}
+
+static inline void ebrEnter(void) {
+    EbrThread* self = ebrSelf();
+    if (self->nesting++ == 0) {
+        // Announce the epoch before touching any node
+        atomic_store(&self->state, (atomic_load(&ebrEpoch) << 1) | 1);
+    }
+}
+
+static inline void ebrExit(void) {
+    EbrThread* self = ebrCurrent;
+    if (--self->nesting == 0) {
+        atomic_store_explicit(&self->state, 0, memory_order_release);
+        // Keep the epoch moving even when this thread has stopped retiring,
+        // or its last few nodes would wait for some other thread's removes
+        if (atomic_load_explicit(&self->oldestPending, memory_order_relaxed) != EBR_NONE) {
+            if (++self->sinceAdvance >= EBR_ADVANCE_EVERY) {
+                self->sinceAdvance = 0;
+                ebrTryAdvance();
+            }
+            ebrReclaim(self);
+        }
+    }
+}
+
+// Frees ptr with release() once no thread can still be reading it. Call it
+// after ptr has been unlinked, from inside an operation or outside one.
+static inline void ebrRetire(void* ptr, size_t size, void (*release)(void* ptr)) {
+    EbrThread* self = ebrSelf();
+    uint64_t epoch = atomic_load(&ebrEpoch);
+    EbrBucket* bucket = &self->buckets[epoch % EBR_BUCKETS];
+    if (bucket->count > 0 && bucket->epoch != epoch) {
+        ebrFreeBucket(bucket); // At least EBR_BUCKETS epochs old
+    }
+    bucket->epoch = epoch;
+    if (bucket->count == bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 256;
+        bucket->items = (EbrRetired*)realloc(bucket->items, bucket->capacity * sizeof(EbrRetired));
+    }
+    bucket->items[bucket->count++] = (EbrRetired){ptr, size, release};
+    atomic_fetch_add(&ebrPendingNodes, 1);
+    atomic_fetch_add(&ebrPendingBytes, size);
+    ebrUpdateOldest(self);
+
+    if (++self->sinceAdvance >= EBR_ADVANCE_EVERY) {
+        self->sinceAdvance = 0;
+        ebrTryAdvance();
+        ebrReclaim(self);
+    }
+}
+
+static inline void ebrGetStats(EbrStats* stats) {
+    stats->epoch = atomic_load(&ebrEpoch);
+    stats->pendingNodes = atomic_load(&ebrPendingNodes);
+    stats->pendingBytes = atomic_load(&ebrPendingBytes);
+    stats->freedNodes = atomic_load(&ebrFreedNodes);
+    stats->freedBytes = atomic_load(&ebrFreedBytes);
+    stats->threads = 0;
+    uint64_t oldest = EBR_NONE;
+    for (EbrThread* t = atomic_load(&ebrThreads); t != NULL; t = t->next) {
+        uint64_t pending = atomic_load_explicit(&t->oldestPending, memory_order_relaxed);
+        if (pending < oldest) {
+            oldest = pending;
+        }
+        stats->threads++;
+    }
+    stats->lag = oldest == EBR_NONE || oldest > stats->epoch ? 0 : stats->epoch - oldest;
+}
+
+#endif
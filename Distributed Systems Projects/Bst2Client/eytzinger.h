@@ -0,0 +1,111 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Immutable sorted set of ints in Eytzinger (BFS) order.
+//
+// The keys form an implicit complete binary search tree in one array: the
+// root is at index 1 and the children of k are at 2k and 2k + 1. There are
+// no pointers to chase, and the top levels every search shares stay packed
+// in a few cache lines. The search loop has no data-dependent branch: the
+// comparison result is added into the next index. Sixteen ints fill a
+// cache line and the descendants of k four levels down are 16k .. 16k + 15,
+// so each step prefetches the line it will need four steps later and the
+// memory latency of a lookup overlaps instead of adding up.
+//
+// (Khuong and Morin, "Array Layouts for Comparison-Based Searching", 2017.)
+
+#define EYT_CACHE_LINE 64
+#define EYT_PREFETCH_STRIDE (EYT_CACHE_LINE / sizeof(int)) // Keys per line
+
+typedef struct EytzingerSet {
+    int* keys;    // keys[1 .. count]; keys[0] is unused
+    size_t count;
+} EytzingerSet;
+
+// Places sorted[*next ..] into the subtree rooted at k, in order
+static inline void eytFill(EytzingerSet* set, const int* sorted, size_t* next, size_t k) {
+    if (k <= set->count) {
+        eytFill(set, sorted, next, 2 * k);
+        set->keys[k] = sorted[(*next)++];
+        eytFill(set, sorted, next, 2 * k + 1);
+    }
+}
+
+// Builds a set from count strictly ascending keys. Returns NULL if out of
+// memory; release it with eytFree.
+static inline EytzingerSet* eytBuild(const int* sorted, size_t count) {
+    EytzingerSet* set = (EytzingerSet*)malloc(sizeof(EytzingerSet));
+    if (set == NULL) {
+        return NULL;
+    }
+    // Line-aligned from index 0, so 16k .. 16k + 15 is exactly one line
+    size_t bytes = ((count + 1) * sizeof(int) + EYT_CACHE_LINE - 1) / EYT_CACHE_LINE * EYT_CACHE_LINE;
+    set->keys = (int*)aligned_alloc(EYT_CACHE_LINE, bytes);
+    if (set->keys == NULL) {
+        free(set);
+        return NULL;
+    }
+    set->count = count;
+    set->keys[0] = 0;
+    size_t next = 0;
+    eytFill(set, sorted, &next, 1);
+    return set;
+}
+
+static inline int eytContains(const EytzingerSet* set, int key) {
+    const int* keys = set->keys;
+    size_t k = 1;
+    while (k <= set->count) {
+        __builtin_prefetch(keys + k * EYT_PREFETCH_STRIDE); // Never faults, even past the end
+        k = 2 * k + (keys[k] < key);
+    }
+    // Each right turn appended a 1 bit; strip the trailing right turns and
+    // the left turn before them to get the last node where key <= keys[k]
+    k >>= __builtin_ffsll((long long)~k);
+    return k != 0 && keys[k] == key;
+}
+
+#define EYT_SEARCH_GROUP 16 // Searches eytContainsMany runs side by side
+
+// Looks up keys[0 .. n) a group at a time. The searches of a group advance
+// one level together, so while one waits for memory the others' loads are
+// already on their way. results[i] is 1 when keys[i] is in the set.
+static inline void eytContainsMany(const EytzingerSet* set, const int* keys, int n, unsigned char* results) {
+    const int* array = set->keys;
+    for (int base = 0; base < n; base += EYT_SEARCH_GROUP) {
+        int group = n - base < EYT_SEARCH_GROUP ? n - base : EYT_SEARCH_GROUP;
+        size_t k[EYT_SEARCH_GROUP];
+        for (int j = 0; j < group; j++) {
+            k[j] = 1;
+        }
+        // Every search ends within one level of the others
+        int running = set->count > 0;
+        while (running) {
+            running = 0;
+            for (int j = 0; j < group; j++) {
+                if (k[j] <= set->count) {
+                    __builtin_prefetch(array + k[j] * EYT_PREFETCH_STRIDE);
+                    k[j] = 2 * k[j] + (array[k[j]] < keys[base + j]);
+                    running = 1;
+                }
+            }
+        }
+        for (int j = 0; j < group; j++) {
+            size_t at = k[j] >> __builtin_ffsll((long long)~k[j]);
+            results[base + j] = at != 0 && array[at] == keys[base + j];
+        }
+    }
+}
+
+static inline void eytFree(EytzingerSet* set) {
+    if (set != NULL) {
+        free(set->keys);
+        free(set);
+    }
+}
+
+#endif
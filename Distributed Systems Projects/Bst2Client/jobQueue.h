@@ -0,0 +1,112 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Bounded multi-producer/multi-consumer queue of pointers (Vyukov's design).
+// Each cell carries a sequence number that tells producers and consumers
+// whether it is free for the current lap, so both sides only need one CAS on
+// their own position counter. Push fails instead of blocking when the queue
+// is full, which lets the caller decide how to push back.
+
+typedef struct QueueCell {
+    _Atomic size_t sequence;
+    void* item;
+} QueueCell;
+
+typedef struct JobQueue {
+    QueueCell* cells;
+    size_t mask;
+    char pad0[64];
+    _Atomic size_t enqueuePos;
+    char pad1[64];
+    _Atomic size_t dequeuePos;
+    char pad2[64];
+} JobQueue;
+
+// Capacity is rounded up to a power of two
+static inline int jobQueueInit(JobQueue* queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    queue->cells = (QueueCell*)malloc(size * sizeof(QueueCell));
+    if (queue->cells == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+    return 0;
+}
+
+static inline size_t jobQueueCapacity(JobQueue* queue) {
+    return queue->mask + 1;
+}
+
+// Returns 0 on success, -1 when the queue is full
+static inline int jobQueuePush(JobQueue* queue, void* item) {
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    QueueCell* cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 0;
+}
+
+// Returns NULL when the queue is empty
+static inline void* jobQueuePop(JobQueue* queue) {
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    QueueCell* cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    void* item = cell->item;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return item;
+}
+
+// Approximate number of queued items
+static inline size_t jobQueueDepth(JobQueue* queue) {
+    size_t tail = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef LOCK_FREE_BST_H
+#define LOCK_FREE_BST_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "epoch.h"
+#include "nodeArena.h"
+
+// Non-blocking external binary search tree (Natarajan and Mittal, "Fast
+// Concurrent Lock-Free Binary Search Trees", PPoPP 2014).
+//
+// Keys live in the leaves; internal nodes only route. Every internal node
+// has exactly two children. Instead of locking nodes, a remove marks edges:
+//   FLAG on the edge to a leaf means the leaf is being removed
+//   TAG on the edge to its sibling freezes that edge
+// and then one CAS at the nearest untagged ancestor (the "successor" edge)
+// splices the leaf and its parent out. Any thread that runs into a marked
+// edge helps finish that removal, so no thread ever waits on another.
+//
+// Searches are plain loads down the tree: no locks and no atomic
+// read-modify-write. Inserts are a single CAS that swaps a leaf for a new
+// internal node with the old and new leaves below it.
+//
+// Three sentinel keys larger than any int (inf0 < inf1 < inf2) keep the top
+// of the tree fixed, so the seek below never runs out of ancestors.
+//
+// A concurrent reader may still be standing on removed nodes, so they are
+// retired to the epoch-based reclaimer (epoch.h) rather than freed, and
+// every operation runs inside an epoch.
+
+#define LF_FLAG ((uintptr_t)1)
+#define LF_TAG ((uintptr_t)2)
+#define LF_MARKS (LF_FLAG | LF_TAG)
+
+typedef struct LfNode {
+    int data;
+    int sentinel;             // 0 for real keys, 1..3 for inf0..inf2
+    _Atomic uintptr_t left;   // Child pointer with FLAG/TAG in the low bits
+    _Atomic uintptr_t right;
+} LfNode;
+
+typedef struct LfTree {
+    LfNode* root; // Sentinel internal node with key inf2
+} LfTree;
+
+// Where a seek ended: the leaf for the key, its parent, and the edge from
+// `ancestor` to `successor` that a cleanup would swing
+typedef struct LfSeekRecord {
+    LfNode* ancestor;
+    LfNode* successor;
+    LfNode* parent;
+    LfNode* leaf;
+} LfSeekRecord;
+
+static inline LfNode* lfAddress(uintptr_t edge) {
+    return (LfNode*)(edge & ~LF_MARKS);
+}
+
+// True if key belongs in node's left subtree. Search keys are never
+// sentinels, so any sentinel compares larger.
+static inline bool lfGoesLeft(int key, const LfNode* node) {
+    return node->sentinel != 0 || key < node->data;
+}
+
+static inline _Atomic uintptr_t* lfChildField(LfNode* node, int key) {
+    return lfGoesLeft(key, node) ? &node->left : &node->right;
+}
+
+// Every tree's nodes come from one arena (there is a single node type)
+static NodeArena lfArena;
+
+static inline void lfFreeNode(void* node) {
+    arenaFree(&lfArena, node);
+}
+
+static inline LfNode* lfNewNode(int data, int sentinel, LfNode* left, LfNode* right) {
+    LfNode* node = (LfNode*)arenaAlloc(&lfArena);
+    node->data = data;
+    node->sentinel = sentinel;
+    atomic_init(&node->left, (uintptr_t)left);
+    atomic_init(&node->right, (uintptr_t)right);
+    return node;
+}
+
+static inline void lfRetire(LfNode* node) {
+    ebrRetire(node, sizeof(LfNode), lfFreeNode);
+}
+
+// Call before starting any thread that uses the tree
+static inline void lfTreeInit(LfTree* tree) {
+    if (lfArena.objectSize == 0) {
+        arenaInit(&lfArena, sizeof(LfNode));
+    }
+    LfNode* inner = lfNewNode(0, 2, lfNewNode(0, 1, NULL, NULL), lfNewNode(0, 2, NULL, NULL));
+    tree->root = lfNewNode(0, 3, inner, lfNewNode(0, 3, NULL, NULL));
+}
+
+static inline void lfSeek(LfTree* tree, int key, LfSeekRecord* record) {
+    LfNode* inner = lfAddress(atomic_load_explicit(&tree->root->left, memory_order_acquire));
+    record->ancestor = tree->root;
+    record->successor = inner;
+    record->parent = inner;
+    uintptr_t parentField = atomic_load_explicit(&inner->left, memory_order_acquire);
+    record->leaf = lfAddress(parentField);
+
+    uintptr_t currentField = atomic_load_explicit(&record->leaf->left, memory_order_acquire);
+    LfNode* current = lfAddress(currentField);
+    while (current != NULL) {
+        // Only an untagged edge can be the one a cleanup swings
+        if (!(parentField & LF_TAG)) {
+            record->ancestor = record->parent;
+            record->successor = record->leaf;
+        }
+        record->parent = record->leaf;
+        record->leaf = current;
+        parentField = currentField;
+        currentField = atomic_load_explicit(lfChildField(current, key), memory_order_acquire);
+        current = lfAddress(currentField);
+    }
+}
+
+// Finishes the removal of the flagged leaf below record->parent by swinging
+// the successor edge past it. Returns true if this call did the splice.
+static inline bool lfCleanup(int key, LfSeekRecord* record) {
+    LfNode* parent = record->parent;
+    _Atomic uintptr_t* successorField = lfChildField(record->ancestor, key);
+    _Atomic uintptr_t* childField;
+    _Atomic uintptr_t* siblingField;
+    if (lfGoesLeft(key, parent)) {
+        childField = &parent->left;
+        siblingField = &parent->right;
+    } else {
+        childField = &parent->right;
+        siblingField = &parent->left;
+    }
+
+    // If the edge toward key isn't the flagged one, the leaf being removed
+    // is on the other side and this side is the one that survives
+    if (!(atomic_load_explicit(childField, memory_order_acquire) & LF_FLAG)) {
+        siblingField = childField;
+    }
+
+    // Freeze the surviving edge, then hang the sibling (keeping its flag, in
+    // case it is being removed too) directly off the ancestor
+    uintptr_t sibling = atomic_fetch_or(siblingField, LF_TAG);
+    uintptr_t expected = (uintptr_t)record->successor;
+    if (!atomic_compare_exchange_strong(successorField, &expected, (sibling & ~LF_TAG))) {
+        return false;
+    }
+
+    // That cut out every internal node from successor down to parent. Each
+    // one above parent had its edge toward key tagged, so its other edge
+    // holds a flagged leaf; at parent the leaf is whichever isn't sibling.
+    LfNode* node = record->successor;
+    while (node != parent) {
+        _Atomic uintptr_t* pathField = lfChildField(node, key);
+        _Atomic uintptr_t* leafField = pathField == &node->left ? &node->right : &node->left;
+        lfRetire(lfAddress(atomic_load(leafField)));
+        lfRetire(node);
+        node = lfAddress(atomic_load(pathField));
+    }
+    uintptr_t left = atomic_load(&parent->left);
+    lfRetire(lfAddress(lfAddress(left) == lfAddress(sibling) ? atomic_load(&parent->right) : left));
+    lfRetire(parent);
+    return true;
+}
+
+static inline bool lfSearch(LfTree* tree, int key) {
+    LfSeekRecord record;
+    ebrEnter();
+    lfSeek(tree, key, &record);
+    bool found = record.leaf->sentinel == 0 && record.leaf->data == key;
+    ebrExit();
+    return found;
+}
+
+#define LF_SEARCH_GROUP 16 // Descents lfSearchMany keeps in flight
+
+// Looks up keys[0 .. n) together: up to LF_SEARCH_GROUP descents take turns,
+// each prefetching its next node before yielding to the others, so their
+// cache misses overlap. results[i] is true when keys[i] is present.
+static inline void lfSearchMany(LfTree* tree, const int* keys, int n, bool* results) {
+    LfNode* current[LF_SEARCH_GROUP];
+    int slot[LF_SEARCH_GROUP]; // Which key each descent is looking for
+    int active = 0;
+    int next = 0;
+
+    ebrEnter();
+    while (active < LF_SEARCH_GROUP && next < n) {
+        current[active] = tree->root;
+        slot[active++] = next++;
+    }
+    while (active > 0) {
+        for (int i = 0; i < active;) {
+            int key = keys[slot[i]];
+            LfNode* child = lfAddress(atomic_load_explicit(lfChildField(current[i], key), memory_order_acquire));
+            if (child != NULL) {
+                __builtin_prefetch(child);
+                current[i++] = child;
+                continue;
+            }
+            // current[i] is the leaf for key
+            results[slot[i]] = current[i]->sentinel == 0 && current[i]->data == key;
+            if (next < n) {
+                current[i] = tree->root;
+                slot[i++] = next++;
+            } else {
+                // Fill the hole with the last descent, which runs next
+                active--;
+                current[i] = current[active];
+                slot[i] = slot[active];
+            }
+        }
+    }
+    ebrExit();
+}
+
+// Returns true if key was added, false if it was already present
+static inline bool lfInsert(LfTree* tree, int key) {
+    LfNode* newLeaf = NULL;
+    LfNode* newInternal = NULL;
+
+    ebrEnter();
+    while (1) {
+        LfSeekRecord record;
+        lfSeek(tree, key, &record);
+        LfNode* leaf = record.leaf;
+        if (leaf->sentinel == 0 && leaf->data == key) {
+            if (newLeaf != NULL) {
+                lfFreeNode(newLeaf);
+                lfFreeNode(newInternal);
+            }
+            ebrExit();
+            return false;
+        }
+
+        // The new internal node routes between the old leaf and the new one
+        if (newLeaf == NULL) {
+            newLeaf = lfNewNode(key, 0, NULL, NULL);
+            newInternal = lfNewNode(0, 0, NULL, NULL);
+        }
+        if (lfGoesLeft(key, leaf)) {
+            newInternal->data = leaf->data;
+            newInternal->sentinel = leaf->sentinel;
+            atomic_store_explicit(&newInternal->left, (uintptr_t)newLeaf, memory_order_relaxed);
+            atomic_store_explicit(&newInternal->right, (uintptr_t)leaf, memory_order_relaxed);
+        } else {
+            newInternal->data = key;
+            newInternal->sentinel = 0;
+            atomic_store_explicit(&newInternal->left, (uintptr_t)leaf, memory_order_relaxed);
+            atomic_store_explicit(&newInternal->right, (uintptr_t)newLeaf, memory_order_relaxed);
+        }
+
+        _Atomic uintptr_t* childField = lfChildField(record.parent, key);
+        uintptr_t expected = (uintptr_t)leaf;
+        if (atomic_compare_exchange_strong(childField, &expected, (uintptr_t)newInternal)) {
+            ebrExit();
+            return true;
+        }
+
+        // The edge changed under us. If it still points at our leaf, it was
+        // marked by a remove in progress: help that remove, then retry.
+        if (lfAddress(expected) == leaf && (expected & LF_MARKS)) {
+            lfCleanup(key, &record);
+        }
+    }
+}
+
+// Returns true if key was removed, false if it was not present
+static inline bool lfRemove(LfTree* tree, int key) {
+    LfNode* target = NULL; // Leaf we flagged; once set we are only cleaning up
+    bool removed = false;
+
+    ebrEnter();
+    while (1) {
+        LfSeekRecord record;
+        lfSeek(tree, key, &record);
+
+        if (target == NULL) {
+            LfNode* leaf = record.leaf;
+            if (leaf->sentinel != 0 || leaf->data != key) {
+                break;
+            }
+
+            // Injection: flag the edge to the leaf, which claims the removal
+            _Atomic uintptr_t* childField = lfChildField(record.parent, key);
+            uintptr_t expected = (uintptr_t)leaf;
+            if (atomic_compare_exchange_strong(childField, &expected, (uintptr_t)leaf | LF_FLAG)) {
+                target = leaf;
+                if (lfCleanup(key, &record)) {
+                    removed = true;
+                    break;
+                }
+            } else if (lfAddress(expected) == leaf && (expected & LF_MARKS)) {
+                lfCleanup(key, &record);
+            }
+        } else {
+            // Someone helping us may already have spliced the leaf out
+            if (record.leaf != target || lfCleanup(key, &record)) {
+                removed = true;
+                break;
+            }
+        }
+    }
+    ebrExit();
+    return removed;
+}
+
+// Calls visit(key) for every key in ascending order. Only meaningful while
+// no updates are running.
+static inline void lfInOrder(LfNode* node, bool deleted, void (*visit)(int key)) {
+    uintptr_t left = atomic_load(&node->left);
+    uintptr_t right = atomic_load(&node->right);
+    if (lfAddress(left) == NULL) {
+        if (node->sentinel == 0 && !deleted) {
+            visit(node->data);
+        }
+        return;
+    }
+    lfInOrder(lfAddress(left), left & LF_FLAG, visit);
+    lfInOrder(lfAddress(right), right & LF_FLAG, visit);
+}
+
+#endif
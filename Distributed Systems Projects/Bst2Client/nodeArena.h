@@ -0,0 +1,269 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fixed-size allocator for tree nodes.
+//
+// Each arena serves one object size, rounded up to a 16-byte size class,
+// and carves its objects out of 64 KB slabs, so nodes allocated one after
+// another sit next to each other in memory. Freed objects are reused, and
+// a whole tree can be dropped at once by releasing its arena.
+//
+// Every thread keeps a magazine of free objects per arena and allocates
+// and frees from it without locking or touching shared cache lines. Only
+// when a magazine runs empty (or full) does the thread lock the arena and
+// move a batch of objects in (or out). A thread's magazines go back to
+// their arenas when it exits, and its record is reused by the next thread.
+
+#define ARENA_SLAB_BYTES (64 * 1024)
+#define ARENA_SIZE_CLASS 16
+#define ARENA_CACHE_LINE 64  // Objects sized in whole lines start on a line boundary
+#define ARENA_MAGAZINE 64    // Free objects a thread may hold per arena
+#define ARENA_BATCH 32       // Objects moved between a magazine and its arena at once
+#define ARENA_MAX_ARENAS 16  // Arenas per program (one per node type is typical)
+
+typedef struct ArenaSlab {
+    struct ArenaSlab* next;
+    size_t reserved; // Keeps the objects after the header 16-byte aligned
+} ArenaSlab;
+
+typedef struct NodeArena {
+    int id;
+    size_t objectSize;
+    pthread_mutex_t lock;
+    ArenaSlab* slabs;
+    char* bump;          // Next never-used object in the newest slab
+    char* bumpEnd;
+    void* freeList;      // Objects handed back by magazines, linked through their first word
+    size_t freeCount;
+    size_t slabCount;
+    size_t carved;       // Objects ever taken from the slabs
+    _Atomic uint64_t generation; // Bumped by arenaRelease so stale magazines are dropped
+} NodeArena;
+
+typedef struct ArenaMagazine {
+    _Atomic uint64_t generation; // Only the owning thread writes these; statistics read them
+    _Atomic int count;
+    void* items[ARENA_MAGAZINE];
+} ArenaMagazine;
+
+typedef struct ArenaThread {
+    _Atomic int inUse;
+    ArenaMagazine magazines[ARENA_MAX_ARENAS];
+    struct ArenaThread* next;
+} ArenaThread;
+
+typedef struct ArenaStats {
+    size_t objectSize;
+    size_t slabs;
+    size_t reservedBytes; // Slab memory
+    size_t liveObjects;   // Allocated and not yet freed
+    size_t cachedObjects; // Free, waiting in magazines or the arena's free list
+    double occupancy;     // Live objects / objects carved from the slabs
+    double fragmentation; // Share of slab memory not holding live objects
+} ArenaStats;
+
+static NodeArena* arenaRegistry[ARENA_MAX_ARENAS];
+static _Atomic int arenaCount = 0;
+static _Atomic(ArenaThread*) arenaThreads = NULL;
+static pthread_key_t arenaKey;
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+static __thread ArenaThread* arenaCurrent = NULL;
+
+// Returns 0, or -1 if the program already has ARENA_MAX_ARENAS arenas
+static inline int arenaInit(NodeArena* arena, size_t objectSize) {
+    memset(arena, 0, sizeof(*arena));
+    if (objectSize < sizeof(void*)) {
+        objectSize = sizeof(void*);
+    }
+    arena->objectSize = (objectSize + ARENA_SIZE_CLASS - 1) / ARENA_SIZE_CLASS * ARENA_SIZE_CLASS;
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->id = atomic_fetch_add(&arenaCount, 1);
+    if (arena->id >= ARENA_MAX_ARENAS) {
+        return -1;
+    }
+    arenaRegistry[arena->id] = arena;
+    return 0;
+}
+
+// Moves up to count objects from a magazine back to its arena
+static inline void arenaReturn(NodeArena* arena, ArenaMagazine* magazine, int count) {
+    int left = atomic_load_explicit(&magazine->count, memory_order_relaxed);
+    pthread_mutex_lock(&arena->lock);
+    if (magazine->generation == atomic_load(&arena->generation)) {
+        for (int i = 0; i < count && left > 0; i++) {
+            void* object = magazine->items[--left];
+            *(void**)object = arena->freeList;
+            arena->freeList = object;
+            arena->freeCount++;
+        }
+    } else {
+        left = 0; // The arena was released; these objects are gone
+    }
+    pthread_mutex_unlock(&arena->lock);
+    atomic_store_explicit(&magazine->count, left, memory_order_relaxed);
+}
+
+static inline void arenaReleaseThread(void* arg) {
+    ArenaThread* self = (ArenaThread*)arg;
+    int arenas = atomic_load(&arenaCount);
+    for (int i = 0; i < arenas && i < ARENA_MAX_ARENAS; i++) {
+        if (atomic_load_explicit(&self->magazines[i].count, memory_order_relaxed) > 0) {
+            arenaReturn(arenaRegistry[i], &self->magazines[i], ARENA_MAGAZINE);
+        }
+    }
+    atomic_store(&self->inUse, 0);
+}
+
+static inline void arenaCreateKey(void) {
+    pthread_key_create(&arenaKey, arenaReleaseThread);
+}
+
+static inline ArenaThread* arenaSelf(void) {
+    if (arenaCurrent != NULL) {
+        return arenaCurrent;
+    }
+    pthread_once(&arenaOnce, arenaCreateKey);
+
+    ArenaThread* self = NULL;
+    for (ArenaThread* t = atomic_load(&arenaThreads); t != NULL && self == NULL; t = t->next) {
+        int expected = 0;
+        if (atomic_load(&t->inUse) == 0 && atomic_compare_exchange_strong(&t->inUse, &expected, 1)) {
+            self = t;
+        }
+    }
+    if (self == NULL) {
+        self = (ArenaThread*)calloc(1, sizeof(ArenaThread));
+        atomic_init(&self->inUse, 1);
+        ArenaThread* head = atomic_load(&arenaThreads);
+        do {
+            self->next = head;
+        } while (!atomic_compare_exchange_weak(&arenaThreads, &head, self));
+    }
+    pthread_setspecific(arenaKey, self);
+    arenaCurrent = self;
+    return self;
+}
+
+static inline ArenaMagazine* arenaMagazine(NodeArena* arena) {
+    ArenaMagazine* magazine = &arenaSelf()->magazines[arena->id];
+    uint64_t generation = atomic_load_explicit(&arena->generation, memory_order_acquire);
+    if (magazine->generation != generation) {
+        magazine->generation = generation;
+        atomic_store_explicit(&magazine->count, 0, memory_order_relaxed);
+    }
+    return magazine;
+}
+
+// Fills an empty magazine with a batch from the free list, or from the
+// slabs. Carved objects go in so that they come back out in address order.
+static inline void arenaRefill(NodeArena* arena, ArenaMagazine* magazine) {
+    int count = 0;
+    pthread_mutex_lock(&arena->lock);
+    while (count < ARENA_BATCH && arena->freeList != NULL) {
+        void* object = arena->freeList;
+        arena->freeList = *(void**)object;
+        arena->freeCount--;
+        magazine->items[count++] = object;
+    }
+    if (count == 0) {
+        if ((size_t)(arena->bumpEnd - arena->bump) < ARENA_BATCH * arena->objectSize) {
+            ArenaSlab* slab = (ArenaSlab*)aligned_alloc(ARENA_CACHE_LINE, ARENA_SLAB_BYTES);
+            if (slab == NULL) {
+                pthread_mutex_unlock(&arena->lock);
+                return;
+            }
+            slab->next = arena->slabs;
+            arena->slabs = slab;
+            arena->slabCount++;
+            arena->bump = arena->objectSize % ARENA_CACHE_LINE == 0 ? (char*)slab + ARENA_CACHE_LINE : (char*)(slab + 1);
+            arena->bumpEnd = (char*)slab + ARENA_SLAB_BYTES;
+        }
+        count = ARENA_BATCH;
+        for (int i = count - 1; i >= 0; i--) {
+            magazine->items[i] = arena->bump;
+            arena->bump += arena->objectSize;
+        }
+        arena->carved += count;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    atomic_store_explicit(&magazine->count, count, memory_order_relaxed);
+}
+
+// Returns an uninitialized object, or NULL when out of memory
+static inline void* arenaAlloc(NodeArena* arena) {
+    ArenaMagazine* magazine = arenaMagazine(arena);
+    int count = atomic_load_explicit(&magazine->count, memory_order_relaxed);
+    if (count == 0) {
+        arenaRefill(arena, magazine);
+        count = atomic_load_explicit(&magazine->count, memory_order_relaxed);
+        if (count == 0) {
+            return NULL;
+        }
+    }
+    atomic_store_explicit(&magazine->count, count - 1, memory_order_relaxed);
+    return magazine->items[count - 1];
+}
+
+static inline void arenaFree(NodeArena* arena, void* object) {
+    ArenaMagazine* magazine = arenaMagazine(arena);
+    int count = atomic_load_explicit(&magazine->count, memory_order_relaxed);
+    if (count == ARENA_MAGAZINE) {
+        arenaReturn(arena, magazine, ARENA_BATCH);
+        count -= ARENA_BATCH;
+    }
+    magazine->items[count] = object;
+    atomic_store_explicit(&magazine->count, count + 1, memory_order_relaxed);
+}
+
+// Frees every object of the arena at once, e.g. a whole tree. No thread
+// may use the arena's objects (or be inside arenaAlloc/arenaFree) meanwhile.
+static inline void arenaRelease(NodeArena* arena) {
+    pthread_mutex_lock(&arena->lock);
+    ArenaSlab* slab = arena->slabs;
+    while (slab != NULL) {
+        ArenaSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    arena->slabs = NULL;
+    arena->bump = arena->bumpEnd = NULL;
+    arena->freeList = NULL;
+    arena->freeCount = arena->slabCount = arena->carved = 0;
+    atomic_fetch_add(&arena->generation, 1);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+static inline void arenaGetStats(NodeArena* arena, ArenaStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t generation = atomic_load(&arena->generation);
+    size_t cached = 0;
+    for (ArenaThread* t = atomic_load(&arenaThreads); t != NULL; t = t->next) {
+        ArenaMagazine* magazine = &t->magazines[arena->id];
+        if (magazine->generation == generation) {
+            cached += atomic_load_explicit(&magazine->count, memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    cached += arena->freeCount;
+    stats->objectSize = arena->objectSize;
+    stats->slabs = arena->slabCount;
+    stats->reservedBytes = arena->slabCount * ARENA_SLAB_BYTES;
+    stats->liveObjects = arena->carved > cached ? arena->carved - cached : 0;
+    stats->cachedObjects = cached;
+    if (arena->carved > 0) {
+        stats->occupancy = (double)stats->liveObjects / arena->carved;
+    }
+    if (stats->reservedBytes > 0) {
+        stats->fragmentation = 1.0 - (double)(stats->liveObjects * arena->objectSize) / stats->reservedBytes;
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+#endif
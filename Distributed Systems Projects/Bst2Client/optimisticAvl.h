@@ -0,0 +1,854 @@
+#ifndef OPTIMISTIC_AVL_H
+#define OPTIMISTIC_AVL_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epoch.h"
+#include "nodeArena.h"
+
+// Concurrent relaxed-balance AVL tree with optimistic readers (Bronson,
+// Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search Tree",
+// PPoPP 2010).
+//
+// Every node carries a version number. A rotation marks the node that moves
+// down as SHRINKING while it works and bumps its version when done, and an
+// unlinked node gets UNLINKED for good. Readers take no locks and write
+// nothing: they read a child pointer, then check that the parent's version
+// is unchanged, which proves the child still covers the key. If it changed,
+// they back up one level and retry from there rather than from the root.
+// Growth (inserts below a node) never invalidates a reader, so only the
+// nodes a writer actually restructures ever move cache lines around.
+//
+// Writers lock just the nodes they change, always parent before child.
+// A removed key whose node still has two children stays in the tree as a
+// routing node (present == 0) and is unlinked later, once it has at most
+// one child. Heights are repaired and rotations applied bottom-up after
+// each change, so the balance is relaxed only while those repairs run.
+//
+// Optimistic readers may still be on an unlinked node, so unlinked nodes
+// are retired to the epoch-based reclaimer (epoch.h) rather than freed, and
+// every public operation runs inside an epoch.
+
+#define OAVL_SHRINKING 1L
+#define OAVL_UNLINKED 2L
+#define OAVL_SHRINK_INCR 4L
+#define OAVL_SPINS 100
+#define OAVL_RETRY -1
+#define OAVL_MAX_DEPTH 128
+
+typedef struct OAvlNode {
+    int key;
+    _Atomic int height;
+    _Atomic int present;  // 0: routing node left behind by a remove
+    _Atomic int lock;
+    _Atomic long version;
+    _Atomic(struct OAvlNode*) parent;
+    _Atomic(struct OAvlNode*) left;
+    _Atomic(struct OAvlNode*) right;
+} OAvlNode;
+
+typedef struct OAvlTree {
+    OAvlNode holder; // Its right child is the root; it never changes itself
+    // Called with the changed node locked, so calls for one key happen in
+    // the same order as the changes (the server appends WAL records here)
+    void (*changed)(int inserted, int key);
+} OAvlTree;
+
+static inline void oavlLock(OAvlNode* node) {
+    while (atomic_exchange_explicit(&node->lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&node->lock, memory_order_relaxed)) {
+            sched_yield();
+        }
+    }
+}
+
+static inline void oavlUnlock(OAvlNode* node) {
+    atomic_store_explicit(&node->lock, 0, memory_order_release);
+}
+
+static inline OAvlNode* oavlChild(OAvlNode* node, int dir) {
+    return dir < 0 ? atomic_load(&node->left) : atomic_load(&node->right);
+}
+
+static inline void oavlSetChild(OAvlNode* node, int dir, OAvlNode* child) {
+    if (dir < 0) {
+        atomic_store(&node->left, child);
+    } else {
+        atomic_store(&node->right, child);
+    }
+}
+
+static inline int oavlHeight(OAvlNode* node) {
+    return node == NULL ? 0 : atomic_load(&node->height);
+}
+
+static inline int oavlMax(int a, int b) {
+    return a > b ? a : b;
+}
+
+static inline int oavlCompare(int key, int nodeKey) {
+    return key < nodeKey ? -1 : (key > nodeKey ? 1 : 0);
+}
+
+// Every tree's nodes come from one arena
+static NodeArena oavlArena;
+
+static inline void oavlFreeNode(void* node) {
+    arenaFree(&oavlArena, node);
+}
+
+static inline OAvlNode* oavlNewNode(int key, int present, OAvlNode* parent) {
+    OAvlNode* node = (OAvlNode*)arenaAlloc(&oavlArena);
+    memset(node, 0, sizeof(*node));
+    node->key = key;
+    atomic_init(&node->height, 1);
+    atomic_init(&node->present, present);
+    atomic_init(&node->parent, parent);
+    return node;
+}
+
+// Call before starting any thread that uses the tree
+static inline void oavlTreeInit(OAvlTree* tree, void (*changed)(int inserted, int key)) {
+    if (oavlArena.objectSize == 0) {
+        arenaInit(&oavlArena, sizeof(OAvlNode));
+    }
+    atomic_init(&tree->holder.height, 0);
+    atomic_init(&tree->holder.version, 0);
+    atomic_init(&tree->holder.lock, 0);
+    atomic_init(&tree->holder.parent, NULL);
+    atomic_init(&tree->holder.left, NULL);
+    atomic_init(&tree->holder.right, NULL);
+    tree->changed = changed;
+}
+
+static inline OAvlNode* oavlRoot(OAvlTree* tree) {
+    return atomic_load(&tree->holder.right);
+}
+
+// Waits out a rotation in progress at node: spin briefly, then block on the
+// node's lock, which the rotating writer holds until it is done
+static inline void oavlWaitUntilNotChanging(OAvlNode* node) {
+    for (int i = 0; i < OAVL_SPINS; i++) {
+        if (!(atomic_load(&node->version) & OAVL_SHRINKING)) {
+            return;
+        }
+    }
+    oavlLock(node);
+    oavlUnlock(node);
+}
+
+// ---- Reads ----
+
+// Looks for key below node's child in direction dir, given that node's
+// version was nodeV when we arrived. Returns 1, 0, or OAVL_RETRY if node
+// changed and the caller must re-read its own child.
+static inline int oavlAttemptGet(int key, OAvlNode* node, int dir, long nodeV) {
+    while (1) {
+        OAvlNode* child = oavlChild(node, dir);
+        if (atomic_load(&node->version) != nodeV) {
+            return OAVL_RETRY;
+        }
+        if (child == NULL) {
+            return 0;
+        }
+        int nextDir = oavlCompare(key, child->key);
+        if (nextDir == 0) {
+            return atomic_load(&child->present);
+        }
+        long childV = atomic_load(&child->version);
+        if (childV & OAVL_SHRINKING) {
+            oavlWaitUntilNotChanging(child);
+        } else if (!(childV & OAVL_UNLINKED) && child == oavlChild(node, dir)) {
+            if (atomic_load(&node->version) != nodeV) {
+                return OAVL_RETRY;
+            }
+            int result = oavlAttemptGet(key, child, nextDir, childV);
+            if (result != OAVL_RETRY) {
+                return result;
+            }
+        }
+    }
+}
+
+static inline int oavlSearch(OAvlTree* tree, int key) {
+    ebrEnter();
+    int found = oavlAttemptGet(key, &tree->holder, 1, 0);
+    ebrExit();
+    return found;
+}
+
+// ---- Rebalancing (the _nl helpers run with the relevant locks held) ----
+
+#define OAVL_UNLINK_REQUIRED -1
+#define OAVL_REBALANCE_REQUIRED -2
+#define OAVL_NOTHING_REQUIRED -3
+
+static inline long oavlBeginChange(long version) {
+    return version | OAVL_SHRINKING;
+}
+
+static inline long oavlEndChange(long version) {
+    return (version & ~OAVL_SHRINKING) + OAVL_SHRINK_INCR;
+}
+
+static inline int oavlOutOfBalance(int balance) {
+    return balance < -1 || balance > 1;
+}
+
+// A routing node left with fewer than two children must be unlinked. A
+// rotation can cause this, so it reports such a node as the next one to fix.
+static inline int oavlIsDamaged(OAvlNode* node) {
+    return (atomic_load(&node->left) == NULL || atomic_load(&node->right) == NULL) && !atomic_load(&node->present);
+}
+
+// What node needs: unlinking, a rotation, nothing, or a new height (>= 0)
+static inline int oavlNodeCondition(OAvlNode* node) {
+    OAvlNode* left = atomic_load(&node->left);
+    OAvlNode* right = atomic_load(&node->right);
+    if (oavlIsDamaged(node)) {
+        return OAVL_UNLINK_REQUIRED;
+    }
+    int heightL = oavlHeight(left);
+    int heightR = oavlHeight(right);
+    if (oavlOutOfBalance(heightL - heightR)) {
+        return OAVL_REBALANCE_REQUIRED;
+    }
+    int repaired = 1 + oavlMax(heightL, heightR);
+    return atomic_load(&node->height) != repaired ? repaired : OAVL_NOTHING_REQUIRED;
+}
+
+// Returns the next node needing work, or NULL
+static inline OAvlNode* oavlFixHeight_nl(OAvlNode* node) {
+    int condition = oavlNodeCondition(node);
+    if (condition == OAVL_REBALANCE_REQUIRED || condition == OAVL_UNLINK_REQUIRED) {
+        return node;
+    }
+    if (condition == OAVL_NOTHING_REQUIRED) {
+        return NULL;
+    }
+    atomic_store(&node->height, condition);
+    return atomic_load(&node->parent);
+}
+
+static inline int oavlAttemptUnlink_nl(OAvlNode* parent, OAvlNode* node) {
+    OAvlNode* parentL = atomic_load(&parent->left);
+    OAvlNode* parentR = atomic_load(&parent->right);
+    if (parentL != node && parentR != node) {
+        return 0;
+    }
+    OAvlNode* left = atomic_load(&node->left);
+    OAvlNode* right = atomic_load(&node->right);
+    if (left != NULL && right != NULL) {
+        return 0;
+    }
+    OAvlNode* splice = left != NULL ? left : right;
+    if (parentL == node) {
+        atomic_store(&parent->left, splice);
+    } else {
+        atomic_store(&parent->right, splice);
+    }
+    if (splice != NULL) {
+        atomic_store(&splice->parent, parent);
+    }
+    atomic_store(&node->version, OAVL_UNLINKED);
+    atomic_store(&node->present, 0);
+    ebrRetire(node, sizeof(OAvlNode), oavlFreeNode);
+    return 1;
+}
+
+// Splices out node (a child of parent) if a rotation left it a routing node
+// with at most one child. Doing it here, with the locks still held, keeps
+// the heights the rotation stores above it exact. Returns the height of
+// whatever now sits in node's place.
+static inline int oavlUnlinkDamaged_nl(OAvlNode* parent, OAvlNode* node, int height) {
+    if (!oavlIsDamaged(node) || !oavlAttemptUnlink_nl(parent, node)) {
+        return height;
+    }
+    OAvlNode* left = atomic_load(&node->left);
+    return oavlHeight(left != NULL ? left : atomic_load(&node->right));
+}
+
+static inline int oavlIsUnlinked(OAvlNode* node) {
+    return (atomic_load(&node->version) & OAVL_UNLINKED) != 0;
+}
+
+static inline OAvlNode* oavlRotateRight_nl(OAvlNode* parent, OAvlNode* n, OAvlNode* nL, int hR, int hLL,
+                                           OAvlNode* nLR, int hLR) {
+    long version = atomic_load(&n->version);
+    OAvlNode* parentL = atomic_load(&parent->left);
+    atomic_store(&n->version, oavlBeginChange(version));
+
+    atomic_store(&n->left, nLR);
+    if (nLR != NULL) {
+        atomic_store(&nLR->parent, n);
+    }
+    atomic_store(&nL->right, n);
+    atomic_store(&n->parent, nL);
+    if (parentL == n) {
+        atomic_store(&parent->left, nL);
+    } else {
+        atomic_store(&parent->right, nL);
+    }
+    atomic_store(&nL->parent, parent);
+    atomic_store(&n->version, oavlEndChange(version));
+
+    int hNRepl = 1 + oavlMax(hLR, hR);
+    atomic_store(&n->height, hNRepl);
+    hNRepl = oavlUnlinkDamaged_nl(nL, n, hNRepl);
+    int hLRepl = 1 + oavlMax(hLL, hNRepl);
+    atomic_store(&nL->height, hLRepl);
+    oavlUnlinkDamaged_nl(parent, nL, hLRepl);
+
+    if (!oavlIsUnlinked(n) && oavlOutOfBalance(hLR - hR)) {
+        return n;
+    }
+    if (!oavlIsUnlinked(nL) && oavlOutOfBalance(hLL - hNRepl)) {
+        return nL;
+    }
+    return oavlFixHeight_nl(parent);
+}
+
+static inline OAvlNode* oavlRotateLeft_nl(OAvlNode* parent, OAvlNode* n, int hL, OAvlNode* nR, OAvlNode* nRL,
+                                          int hRL, int hRR) {
+    long version = atomic_load(&n->version);
+    OAvlNode* parentL = atomic_load(&parent->left);
+    atomic_store(&n->version, oavlBeginChange(version));
+
+    atomic_store(&n->right, nRL);
+    if (nRL != NULL) {
+        atomic_store(&nRL->parent, n);
+    }
+    atomic_store(&nR->left, n);
+    atomic_store(&n->parent, nR);
+    if (parentL == n) {
+        atomic_store(&parent->left, nR);
+    } else {
+        atomic_store(&parent->right, nR);
+    }
+    atomic_store(&nR->parent, parent);
+    atomic_store(&n->version, oavlEndChange(version));
+
+    int hNRepl = 1 + oavlMax(hL, hRL);
+    atomic_store(&n->height, hNRepl);
+    hNRepl = oavlUnlinkDamaged_nl(nR, n, hNRepl);
+    int hRRepl = 1 + oavlMax(hNRepl, hRR);
+    atomic_store(&nR->height, hRRepl);
+    oavlUnlinkDamaged_nl(parent, nR, hRRepl);
+
+    if (!oavlIsUnlinked(n) && oavlOutOfBalance(hRL - hL)) {
+        return n;
+    }
+    if (!oavlIsUnlinked(nR) && oavlOutOfBalance(hRR - hNRepl)) {
+        return nR;
+    }
+    return oavlFixHeight_nl(parent);
+}
+
+static inline OAvlNode* oavlRotateRightOverLeft_nl(OAvlNode* parent, OAvlNode* n, OAvlNode* nL, int hR, int hLL,
+                                                   OAvlNode* nLR, int hLRL) {
+    long version = atomic_load(&n->version);
+    long leftVersion = atomic_load(&nL->version);
+    OAvlNode* parentL = atomic_load(&parent->left);
+    OAvlNode* nLRL = atomic_load(&nLR->left);
+    OAvlNode* nLRR = atomic_load(&nLR->right);
+    int hLRR = oavlHeight(nLRR);
+    atomic_store(&n->version, oavlBeginChange(version));
+    atomic_store(&nL->version, oavlBeginChange(leftVersion));
+
+    atomic_store(&n->left, nLRR);
+    if (nLRR != NULL) {
+        atomic_store(&nLRR->parent, n);
+    }
+    atomic_store(&nL->right, nLRL);
+    if (nLRL != NULL) {
+        atomic_store(&nLRL->parent, nL);
+    }
+    atomic_store(&nLR->left, nL);
+    atomic_store(&nL->parent, nLR);
+    atomic_store(&nLR->right, n);
+    atomic_store(&n->parent, nLR);
+    if (parentL == n) {
+        atomic_store(&parent->left, nLR);
+    } else {
+        atomic_store(&parent->right, nLR);
+    }
+    atomic_store(&nLR->parent, parent);
+    atomic_store(&n->version, oavlEndChange(version));
+    atomic_store(&nL->version, oavlEndChange(leftVersion));
+
+    int hNRepl = 1 + oavlMax(hLRR, hR);
+    int hLRepl = 1 + oavlMax(hLL, hLRL);
+    atomic_store(&n->height, hNRepl);
+    atomic_store(&nL->height, hLRepl);
+    hNRepl = oavlUnlinkDamaged_nl(nLR, n, hNRepl);
+    hLRepl = oavlUnlinkDamaged_nl(nLR, nL, hLRepl);
+    int hLRRepl = 1 + oavlMax(hLRepl, hNRepl);
+    atomic_store(&nLR->height, hLRRepl);
+    oavlUnlinkDamaged_nl(parent, nLR, hLRRepl);
+
+    if (!oavlIsUnlinked(n) && oavlOutOfBalance(hLRR - hR)) {
+        return n;
+    }
+    if (!oavlIsUnlinked(nLR) && oavlOutOfBalance(hLRepl - hNRepl)) {
+        return nLR;
+    }
+    return oavlFixHeight_nl(parent);
+}
+
+static inline OAvlNode* oavlRotateLeftOverRight_nl(OAvlNode* parent, OAvlNode* n, int hL, OAvlNode* nR,
+                                                   OAvlNode* nRL, int hRR, int hRLR) {
+    long version = atomic_load(&n->version);
+    long rightVersion = atomic_load(&nR->version);
+    OAvlNode* parentL = atomic_load(&parent->left);
+    OAvlNode* nRLL = atomic_load(&nRL->left);
+    OAvlNode* nRLR = atomic_load(&nRL->right);
+    int hRLL = oavlHeight(nRLL);
+    atomic_store(&n->version, oavlBeginChange(version));
+    atomic_store(&nR->version, oavlBeginChange(rightVersion));
+
+    atomic_store(&n->right, nRLL);
+    if (nRLL != NULL) {
+        atomic_store(&nRLL->parent, n);
+    }
+    atomic_store(&nR->left, nRLR);
+    if (nRLR != NULL) {
+        atomic_store(&nRLR->parent, nR);
+    }
+    atomic_store(&nRL->right, nR);
+    atomic_store(&nR->parent, nRL);
+    atomic_store(&nRL->left, n);
+    atomic_store(&n->parent, nRL);
+    if (parentL == n) {
+        atomic_store(&parent->left, nRL);
+    } else {
+        atomic_store(&parent->right, nRL);
+    }
+    atomic_store(&nRL->parent, parent);
+    atomic_store(&n->version, oavlEndChange(version));
+    atomic_store(&nR->version, oavlEndChange(rightVersion));
+
+    int hNRepl = 1 + oavlMax(hL, hRLL);
+    int hRRepl = 1 + oavlMax(hRLR, hRR);
+    atomic_store(&n->height, hNRepl);
+    atomic_store(&nR->height, hRRepl);
+    hNRepl = oavlUnlinkDamaged_nl(nRL, n, hNRepl);
+    hRRepl = oavlUnlinkDamaged_nl(nRL, nR, hRRepl);
+    int hRLRepl = 1 + oavlMax(hNRepl, hRRepl);
+    atomic_store(&nRL->height, hRLRepl);
+    oavlUnlinkDamaged_nl(parent, nRL, hRLRepl);
+
+    if (!oavlIsUnlinked(n) && oavlOutOfBalance(hRLL - hL)) {
+        return n;
+    }
+    if (!oavlIsUnlinked(nRL) && oavlOutOfBalance(hRRepl - hNRepl)) {
+        return nRL;
+    }
+    return oavlFixHeight_nl(parent);
+}
+
+static inline OAvlNode* oavlRebalanceToLeft_nl(OAvlNode* parent, OAvlNode* n, OAvlNode* nR, int hL0);
+
+static inline OAvlNode* oavlRebalanceToRight_nl(OAvlNode* parent, OAvlNode* n, OAvlNode* nL, int hR0) {
+    OAvlNode* result;
+    oavlLock(nL);
+    int hL = atomic_load(&nL->height);
+    if (hL - hR0 <= 1) {
+        oavlUnlock(nL);
+        return n; // Retry
+    }
+
+    OAvlNode* nLR = atomic_load(&nL->right);
+    int hLL0 = oavlHeight(atomic_load(&nL->left));
+    int hLR0 = oavlHeight(nLR);
+    if (hLL0 >= hLR0) {
+        result = oavlRotateRight_nl(parent, n, nL, hR0, hLL0, nLR, hLR0);
+        oavlUnlock(nL);
+        return result;
+    }
+
+    oavlLock(nLR);
+    int hLR = atomic_load(&nLR->height);
+    if (hLL0 >= hLR) {
+        result = oavlRotateRight_nl(parent, n, nL, hR0, hLL0, nLR, hLR);
+        oavlUnlock(nLR);
+        oavlUnlock(nL);
+        return result;
+    }
+    int hLRL = oavlHeight(atomic_load(&nLR->left));
+    int balance = hLL0 - hLRL;
+    if (!oavlOutOfBalance(balance)) {
+        result = oavlRotateRightOverLeft_nl(parent, n, nL, hR0, hLL0, nLR, hLRL);
+        oavlUnlock(nLR);
+        oavlUnlock(nL);
+        return result;
+    }
+    oavlUnlock(nLR);
+
+    // A double rotation would leave nL unbalanced; fix nL's side first
+    result = oavlRebalanceToLeft_nl(n, nL, nLR, hLL0);
+    oavlUnlock(nL);
+    return result;
+}
+
+static inline OAvlNode* oavlRebalanceToLeft_nl(OAvlNode* parent, OAvlNode* n, OAvlNode* nR, int hL0) {
+    OAvlNode* result;
+    oavlLock(nR);
+    int hR = atomic_load(&nR->height);
+    if (hL0 - hR >= -1) {
+        oavlUnlock(nR);
+        return n; // Retry
+    }
+
+    OAvlNode* nRL = atomic_load(&nR->left);
+    int hRL0 = oavlHeight(nRL);
+    int hRR0 = oavlHeight(atomic_load(&nR->right));
+    if (hRR0 >= hRL0) {
+        result = oavlRotateLeft_nl(parent, n, hL0, nR, nRL, hRL0, hRR0);
+        oavlUnlock(nR);
+        return result;
+    }
+
+    oavlLock(nRL);
+    int hRL = atomic_load(&nRL->height);
+    if (hRR0 >= hRL) {
+        result = oavlRotateLeft_nl(parent, n, hL0, nR, nRL, hRL, hRR0);
+        oavlUnlock(nRL);
+        oavlUnlock(nR);
+        return result;
+    }
+    int hRLR = oavlHeight(atomic_load(&nRL->right));
+    int balance = hRR0 - hRLR;
+    if (!oavlOutOfBalance(balance)) {
+        result = oavlRotateLeftOverRight_nl(parent, n, hL0, nR, nRL, hRR0, hRLR);
+        oavlUnlock(nRL);
+        oavlUnlock(nR);
+        return result;
+    }
+    oavlUnlock(nRL);
+
+    result = oavlRebalanceToRight_nl(n, nR, nRL, hRR0);
+    oavlUnlock(nR);
+    return result;
+}
+
+static inline OAvlNode* oavlRebalance_nl(OAvlNode* parent, OAvlNode* n) {
+    OAvlNode* nL = atomic_load(&n->left);
+    OAvlNode* nR = atomic_load(&n->right);
+    if (oavlIsDamaged(n)) {
+        return oavlAttemptUnlink_nl(parent, n) ? oavlFixHeight_nl(parent) : n;
+    }
+
+    int hN = atomic_load(&n->height);
+    int hL0 = oavlHeight(nL);
+    int hR0 = oavlHeight(nR);
+    int hNRepl = 1 + oavlMax(hL0, hR0);
+    int balance = hL0 - hR0;
+    if (balance > 1) {
+        return oavlRebalanceToRight_nl(parent, n, nL, hR0);
+    } else if (balance < -1) {
+        return oavlRebalanceToLeft_nl(parent, n, nR, hL0);
+    } else if (hNRepl != hN) {
+        atomic_store(&n->height, hNRepl);
+        return oavlFixHeight_nl(parent);
+    }
+    return NULL;
+}
+
+// Walks up from node repairing heights, rotating and unlinking routing
+// nodes until nothing more is needed
+static inline void oavlFixHeightAndRebalance(OAvlNode* node) {
+    while (node != NULL && atomic_load(&node->parent) != NULL) {
+        int condition = oavlNodeCondition(node);
+        if (condition == OAVL_NOTHING_REQUIRED || (atomic_load(&node->version) & OAVL_UNLINKED)) {
+            return;
+        }
+
+        if (condition != OAVL_UNLINK_REQUIRED && condition != OAVL_REBALANCE_REQUIRED) {
+            oavlLock(node);
+            OAvlNode* next = oavlFixHeight_nl(node);
+            oavlUnlock(node);
+            node = next;
+        } else {
+            OAvlNode* parent = atomic_load(&node->parent);
+            oavlLock(parent);
+            if (!(atomic_load(&parent->version) & OAVL_UNLINKED) && atomic_load(&node->parent) == parent) {
+                oavlLock(node);
+                OAvlNode* next = oavlRebalance_nl(parent, node);
+                oavlUnlock(node);
+                oavlUnlock(parent);
+                node = next;
+            } else {
+                oavlUnlock(parent); // Parent changed under us; look again
+            }
+        }
+    }
+}
+
+// ---- Updates ----
+
+static inline int oavlAttemptInsert(OAvlTree* tree, int key, OAvlNode* node, int dir, long nodeV) {
+    oavlLock(node);
+    if (atomic_load(&node->version) != nodeV || oavlChild(node, dir) != NULL) {
+        oavlUnlock(node);
+        return OAVL_RETRY;
+    }
+    oavlSetChild(node, dir, oavlNewNode(key, 1, node));
+    if (tree->changed != NULL) {
+        tree->changed(1, key);
+    }
+    oavlUnlock(node);
+
+    oavlFixHeightAndRebalance(node);
+    return 1;
+}
+
+// Marks an existing (possibly routing) node present
+static inline int oavlAttemptRevive(OAvlTree* tree, OAvlNode* node) {
+    oavlLock(node);
+    if (atomic_load(&node->version) & OAVL_UNLINKED) {
+        oavlUnlock(node);
+        return OAVL_RETRY;
+    }
+    int added = !atomic_load(&node->present);
+    if (added) {
+        atomic_store(&node->present, 1);
+        if (tree->changed != NULL) {
+            tree->changed(1, node->key);
+        }
+    }
+    oavlUnlock(node);
+    return added;
+}
+
+static inline int oavlAttemptPut(OAvlTree* tree, int key, OAvlNode* node, int dir, long nodeV) {
+    int result = OAVL_RETRY;
+    do {
+        OAvlNode* child = oavlChild(node, dir);
+        if (atomic_load(&node->version) != nodeV) {
+            return OAVL_RETRY;
+        }
+        if (child == NULL) {
+            result = oavlAttemptInsert(tree, key, node, dir, nodeV);
+        } else {
+            int nextDir = oavlCompare(key, child->key);
+            if (nextDir == 0) {
+                result = oavlAttemptRevive(tree, child);
+            } else {
+                long childV = atomic_load(&child->version);
+                if (childV & OAVL_SHRINKING) {
+                    oavlWaitUntilNotChanging(child);
+                } else if (!(childV & OAVL_UNLINKED) && child == oavlChild(node, dir)) {
+                    if (atomic_load(&node->version) != nodeV) {
+                        return OAVL_RETRY;
+                    }
+                    result = oavlAttemptPut(tree, key, child, nextDir, childV);
+                }
+            }
+        }
+    } while (result == OAVL_RETRY);
+    return result;
+}
+
+// Returns 1 if key was added, 0 if it was already present
+static inline int oavlInsert(OAvlTree* tree, int key) {
+    ebrEnter();
+    int inserted = oavlAttemptPut(tree, key, &tree->holder, 1, 0);
+    ebrExit();
+    return inserted;
+}
+
+static inline int oavlCanUnlink(OAvlNode* node) {
+    return atomic_load(&node->left) == NULL || atomic_load(&node->right) == NULL;
+}
+
+// Removes the key held by node, a child of parent. A node with two
+// children just becomes a routing node; otherwise it is spliced out.
+static inline int oavlAttemptRemoveNode(OAvlTree* tree, OAvlNode* parent, OAvlNode* node) {
+    if (!atomic_load(&node->present)) {
+        return 0;
+    }
+
+    if (!oavlCanUnlink(node)) {
+        oavlLock(node);
+        if ((atomic_load(&node->version) & OAVL_UNLINKED) || oavlCanUnlink(node)) {
+            oavlUnlock(node);
+            return OAVL_RETRY;
+        }
+        int removed = atomic_exchange(&node->present, 0);
+        if (removed && tree->changed != NULL) {
+            tree->changed(0, node->key);
+        }
+        oavlUnlock(node);
+        return removed;
+    }
+
+    oavlLock(parent);
+    if ((atomic_load(&parent->version) & OAVL_UNLINKED) || atomic_load(&node->parent) != parent) {
+        oavlUnlock(parent);
+        return OAVL_RETRY;
+    }
+    oavlLock(node);
+    if (atomic_load(&node->version) & OAVL_UNLINKED) {
+        oavlUnlock(node);
+        oavlUnlock(parent);
+        return OAVL_RETRY;
+    }
+    int removed = atomic_load(&node->present);
+    if (removed) {
+        if (oavlCanUnlink(node)) {
+            oavlAttemptUnlink_nl(parent, node);
+        } else {
+            atomic_store(&node->present, 0); // Gained a child meanwhile
+        }
+        if (tree->changed != NULL) {
+            tree->changed(0, node->key);
+        }
+    }
+    oavlUnlock(node);
+    oavlUnlock(parent);
+
+    if (removed) {
+        oavlFixHeightAndRebalance(parent);
+    }
+    return removed;
+}
+
+static inline int oavlAttemptRemove(OAvlTree* tree, int key, OAvlNode* node, int dir, long nodeV) {
+    int result = OAVL_RETRY;
+    do {
+        OAvlNode* child = oavlChild(node, dir);
+        if (atomic_load(&node->version) != nodeV) {
+            return OAVL_RETRY;
+        }
+        if (child == NULL) {
+            return 0;
+        }
+        int nextDir = oavlCompare(key, child->key);
+        if (nextDir == 0) {
+            result = oavlAttemptRemoveNode(tree, node, child);
+        } else {
+            long childV = atomic_load(&child->version);
+            if (childV & OAVL_SHRINKING) {
+                oavlWaitUntilNotChanging(child);
+            } else if (!(childV & OAVL_UNLINKED) && child == oavlChild(node, dir)) {
+                if (atomic_load(&node->version) != nodeV) {
+                    return OAVL_RETRY;
+                }
+                result = oavlAttemptRemove(tree, key, child, nextDir, childV);
+            }
+        }
+    } while (result == OAVL_RETRY);
+    return result;
+}
+
+// Returns 1 if key was removed, 0 if it was not present
+static inline int oavlRemove(OAvlTree* tree, int key) {
+    ebrEnter();
+    int removed = oavlAttemptRemove(tree, key, &tree->holder, 1, 0);
+    ebrExit();
+    return removed;
+}
+
+// ---- Ordered scans ----
+
+// Pushes the path below node's child in direction dir down to the smallest
+// key >= from, recording each pushed node's version. node's version must
+// still be nodeV. Like a search, each step re-reads the parent's version
+// after reading the child's, so a child's recorded version is one it had
+// while still in place. Keys on the path must also stay below the nearest
+// node already on the stack; one that doesn't was rotated up past it.
+// Returns the new depth, or -1 if something moved and the scan must restart.
+static inline int oavlRangeDescend(OAvlNode* node, long nodeV, int dir, long long from, OAvlNode** stack,
+                                   long* versions, int depth) {
+    while (1) {
+        OAvlNode* child = oavlChild(node, dir);
+        if (atomic_load(&node->version) != nodeV) {
+            return -1;
+        }
+        if (child == NULL) {
+            return depth;
+        }
+        long childV = atomic_load(&child->version);
+        if (childV & (OAVL_SHRINKING | OAVL_UNLINKED)) {
+            oavlWaitUntilNotChanging(child);
+            return -1;
+        }
+        if (child != oavlChild(node, dir) || atomic_load(&node->version) != nodeV) {
+            return -1;
+        }
+        if (depth > 0 && child->key >= stack[depth - 1]->key) {
+            return -1;
+        }
+        if (child->key >= from) {
+            if (depth == OAVL_MAX_DEPTH) {
+                return -1; // Only during heavy transient imbalance
+            }
+            stack[depth] = child;
+            versions[depth++] = childV;
+            dir = -1;
+        } else {
+            dir = 1;
+        }
+        node = child;
+        nodeV = childV;
+    }
+}
+
+// Copies up to max present keys in [lo, hi] into keys in ascending order.
+// Walks with an explicit stack of the nodes it turned left at, checking
+// each one's version again when it is popped and after reading its right
+// child. A rotation or unlink at one of them means the rest of the path
+// may be stale, so the walk restarts from just past the last key it
+// returned. Concurrent updates may or may not be seen, but no key is
+// returned twice or out of order.
+static inline int oavlScan(OAvlTree* tree, int lo, int hi, int* keys, int max) {
+    OAvlNode* stack[OAVL_MAX_DEPTH];
+    long versions[OAVL_MAX_DEPTH];
+    long long from = lo;
+    int n = 0;
+
+restart:
+    while (n < max && from <= hi) {
+        int depth = oavlRangeDescend(&tree->holder, 0, 1, from, stack, versions, 0);
+        if (depth < 0) {
+            goto restart;
+        }
+
+        while (depth > 0) {
+            OAvlNode* node = stack[--depth];
+            if (atomic_load(&node->version) != versions[depth]) {
+                goto restart; // Rotated down or unlinked since we passed it
+            }
+            if (node->key > hi) {
+                return n;
+            }
+            if (atomic_load(&node->present)) {
+                keys[n++] = node->key;
+            }
+            from = (long long)node->key + 1;
+            if (n == max) {
+                return n;
+            }
+
+            depth = oavlRangeDescend(node, versions[depth], 1, from, stack, versions, depth);
+            if (depth < 0) {
+                goto restart;
+            }
+        }
+        return n; // Ran off the end of the tree
+    }
+    return n;
+}
+
+static inline int oavlRange(OAvlTree* tree, int lo, int hi, int* keys, int max) {
+    ebrEnter();
+    int n = oavlScan(tree, lo, hi, keys, max);
+    ebrExit();
+    return n;
+}
+
+#endif
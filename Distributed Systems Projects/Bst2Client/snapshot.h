@@ -0,0 +1,201 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Checkpoint file holding every key of a tree, sorted and densely packed so
+// a loader can map it and build a balanced tree in one linear pass.
+//
+//   offset 0   8 bytes  magic "BSTSNAP1"
+//   offset 8   u32      checksum of everything from offset 16 to the end
+//   offset 12  u32      reserved (0)
+//   offset 16  u64      key count
+//   offset 24  u64      WAL offset the checkpoint covers (replay resumes here)
+//   offset 32  int32[]  keys in strictly ascending order
+//
+// All integers are little-endian. A checkpoint is written to a temporary
+// file and renamed into place, so readers see either the old or the new one.
+
+#define SNAPSHOT_MAGIC "BSTSNAP1"
+#define SNAPSHOT_HEADER_SIZE 32
+
+typedef struct Snapshot {
+    void* map;
+    size_t mapSize;
+    uint64_t count;
+    uint64_t walOffset;
+    const unsigned char* keys; // count little-endian int32s
+} Snapshot;
+
+static inline uint32_t snapshotChecksum(uint32_t hash, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u; // FNV-1a
+    }
+    return hash;
+}
+
+static inline void snapshotPut32(unsigned char* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline void snapshotPut64(unsigned char* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint64_t snapshotGet(const unsigned char* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline int32_t snapshotKey(const Snapshot* snapshot, uint64_t i) {
+    return (int32_t)snapshotGet(snapshot->keys + i * sizeof(int32_t), 4);
+}
+
+static inline int snapshotWriteAll(int fd, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Writes count sorted keys as a checkpoint covering the WAL up to walOffset.
+// Returns 0 on success or -1 with errno set.
+static inline int snapshotWrite(const char* path, const int* keys, uint64_t count, uint64_t walOffset) {
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, SNAPSHOT_MAGIC, 8);
+    snapshotPut64(header + 16, count);
+    snapshotPut64(header + 24, walOffset);
+    uint32_t sum = snapshotChecksum(2166136261u, header + 16, 16);
+
+    // Leave room for the header, then stream the keys out in large blocks
+    unsigned char block[64 * 1024];
+    size_t used = 0;
+    int result = lseek(fd, SNAPSHOT_HEADER_SIZE, SEEK_SET) < 0 ? -1 : 0;
+    for (uint64_t i = 0; i < count && result == 0; i++) {
+        snapshotPut32(block + used, (uint32_t)keys[i]);
+        used += sizeof(int32_t);
+        if (used == sizeof(block) || i + 1 == count) {
+            sum = snapshotChecksum(sum, block, used);
+            result = snapshotWriteAll(fd, block, used);
+            used = 0;
+        }
+    }
+
+    snapshotPut32(header + 8, sum);
+    if (result == 0 && (pwrite(fd, header, sizeof(header), 0) != sizeof(header) || fdatasync(fd) < 0)) {
+        result = -1;
+    }
+    if (close(fd) < 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = rename(tmpPath, path);
+    }
+    if (result < 0) {
+        int error = errno;
+        unlink(tmpPath);
+        errno = error;
+        return -1;
+    }
+
+    // Make the rename itself durable
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        slash[slash == dir ? 1 : 0] = '\0';
+    }
+    int dirFd = open(dir, O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return 0;
+}
+
+// Maps and validates a checkpoint. Returns 0 on success, 1 if the file does
+// not exist, and -1 if it is unreadable or damaged.
+static inline int snapshotOpen(const char* path, Snapshot* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 1 : -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const unsigned char* data = (const unsigned char*)map;
+    snapshot->map = map;
+    snapshot->mapSize = st.st_size;
+    snapshot->count = snapshotGet(data + 16, 8);
+    snapshot->walOffset = snapshotGet(data + 24, 8);
+    snapshot->keys = data + SNAPSHOT_HEADER_SIZE;
+
+    int valid = memcmp(data, SNAPSHOT_MAGIC, 8) == 0 &&
+                snapshot->count == (st.st_size - SNAPSHOT_HEADER_SIZE) / sizeof(int32_t) &&
+                (st.st_size - SNAPSHOT_HEADER_SIZE) % sizeof(int32_t) == 0 &&
+                snapshotGet(data + 8, 4) == snapshotChecksum(2166136261u, data + 16, st.st_size - 16);
+    for (uint64_t i = 1; valid && i < snapshot->count; i++) {
+        valid = snapshotKey(snapshot, i - 1) < snapshotKey(snapshot, i);
+    }
+    if (!valid) {
+        munmap(map, st.st_size);
+        memset(snapshot, 0, sizeof(*snapshot));
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void snapshotClose(Snapshot* snapshot) {
+    if (snapshot->map != NULL) {
+        munmap(snapshot->map, snapshot->mapSize);
+    }
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "jobQueue.h"
+
+// Helper threads that share out the iterations of a loop.
+//
+// taskPoolFor splits [0, n) into chunks of `grain` iterations. The calling
+// thread and every helper that picks the loop up claim chunks from one
+// shared counter until none are left, so the work balances itself and the
+// caller never sits idle waiting for a helper to start. Before returning,
+// the caller only waits for helpers still finishing a chunk they claimed
+// (or about to notice there is none left).
+//
+// Several threads may run loops on the same pool at once; helpers take
+// them in turn from a shared queue. A loop body may itself run loops on the
+// pool (fork-join recursion): a caller waiting for its helpers takes queued
+// handoffs meanwhile, so no handoff is ever stuck behind busy threads.
+
+#define TASK_POOL_QUEUE 256 // Loop handoffs that may wait for a helper at once
+
+typedef struct TaskLoop {
+    void (*body)(void* ctx, size_t from, size_t to);
+    void* ctx;
+    size_t n;
+    size_t grain;
+    _Atomic size_t next;  // First iteration no one has claimed yet
+    _Atomic int helpers;  // Handoffs to helpers that haven't finished with the loop
+} TaskLoop;
+
+typedef struct TaskPool {
+    JobQueue queue;
+    sem_t available;
+    int threads;
+} TaskPool;
+
+static inline void taskLoopRun(TaskLoop* loop) {
+    size_t from;
+    while ((from = atomic_fetch_add(&loop->next, loop->grain)) < loop->n) {
+        size_t to = loop->n - from > loop->grain ? from + loop->grain : loop->n;
+        loop->body(loop->ctx, from, to);
+    }
+}
+
+// Takes one handoff off the queue, once its semaphore post is consumed
+static inline void taskPoolRunHandoff(TaskPool* pool) {
+    TaskLoop* loop;
+    while ((loop = (TaskLoop*)jobQueuePop(&pool->queue)) == NULL) {
+        sched_yield(); // Posted before the push became visible
+    }
+    taskLoopRun(loop);
+    atomic_fetch_sub_explicit(&loop->helpers, 1, memory_order_release);
+}
+
+static inline void* taskPoolThread(void* arg) {
+    TaskPool* pool = (TaskPool*)arg;
+    while (1) {
+        if (sem_wait(&pool->available) == 0) {
+            taskPoolRunHandoff(pool);
+        }
+    }
+    return NULL;
+}
+
+// Starts threads helper threads. Returns the number started, or -1 if the
+// queue could not be allocated.
+static inline int taskPoolInit(TaskPool* pool, int threads) {
+    pool->threads = 0;
+    if (jobQueueInit(&pool->queue, TASK_POOL_QUEUE) < 0) {
+        return -1;
+    }
+    sem_init(&pool->available, 0, 0);
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, taskPoolThread, pool) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool->threads++;
+    }
+    return pool->threads;
+}
+
+// Calls body(ctx, from, to) over consecutive chunks covering [0, n) and
+// returns once all of them are done. Chunks may run on any thread in any
+// order. Without a pool (or helpers) the caller runs the whole range.
+static inline void taskPoolFor(TaskPool* pool, size_t n, size_t grain, void (*body)(void* ctx, size_t from, size_t to),
+                               void* ctx) {
+    size_t chunks = grain > 0 ? (n + grain - 1) / grain : 1;
+    if (pool == NULL || pool->threads == 0 || chunks <= 1) {
+        if (n > 0) {
+            body(ctx, 0, n);
+        }
+        return;
+    }
+
+    TaskLoop loop = {body, ctx, n, grain, 0, 0};
+    int handoffs = chunks - 1 < (size_t)pool->threads ? (int)(chunks - 1) : pool->threads;
+    atomic_store(&loop.helpers, handoffs);
+    for (int i = 0; i < handoffs; i++) {
+        if (jobQueuePush(&pool->queue, &loop) < 0) {
+            atomic_fetch_sub(&loop.helpers, handoffs - i); // Queue full: do the rest here
+            break;
+        }
+        sem_post(&pool->available);
+    }
+
+    taskLoopRun(&loop);
+    while (atomic_load_explicit(&loop.helpers, memory_order_acquire) > 0) {
+        if (sem_trywait(&pool->available) == 0) {
+            taskPoolRunHandoff(pool); // Possibly one of ours: it finds nothing left
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+#endif
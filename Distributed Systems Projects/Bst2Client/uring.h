@@ -0,0 +1,272 @@
+#ifndef URING_H
+#define URING_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on top of the raw syscalls (no liburing needed):
+// ring setup and teardown, SQE allocation, batched submit-and-wait, CQE
+// iteration, and provided-buffer rings for multishot recv.
+
+typedef struct Uring {
+    int fd;
+    unsigned flags;
+
+    // Submission queue
+    _Atomic unsigned* sqHead;
+    _Atomic unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned sqLocalTail;  // SQEs handed out but not yet published
+
+    // Completion queue
+    _Atomic unsigned* cqHead;
+    _Atomic unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} Uring;
+
+// Ring of buffers the kernel picks from for IOSQE_BUFFER_SELECT reads
+typedef struct UringBufferRing {
+    struct io_uring_buf_ring* ring;
+    size_t ringSize;
+    char* buffers;
+    unsigned entries;
+    unsigned bufferSize;
+    unsigned short groupId;
+    unsigned short localTail;
+} UringBufferRing;
+
+static inline int uringSetupSyscall(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int uringEnterSyscall(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static inline int uringRegisterSyscall(int fd, unsigned opcode, void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void uringDestroy(Uring* ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// Returns 0 on success or a negative errno
+static int uringInit(Uring* ring, unsigned entries, unsigned flags) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+
+    ring->fd = uringSetupSyscall(entries, &params);
+    if (ring->fd < 0) {
+        return -errno;
+    }
+    ring->flags = params.flags;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        int error = -errno;
+        uringDestroy(ring);
+        return error;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            int error = -errno;
+            uringDestroy(ring);
+            return error;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        int error = -errno;
+        uringDestroy(ring);
+        return error;
+    }
+
+    char* sq = (char*)ring->sqRing;
+    ring->sqHead = (_Atomic unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (_Atomic unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqLocalTail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+
+    char* cq = (char*)ring->cqRing;
+    ring->cqHead = (_Atomic unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (_Atomic unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Publishes queued SQEs, submits them and optionally waits for completions.
+// Returns the number submitted or a negative errno.
+static int uringSubmitAndWait(Uring* ring, unsigned waitFor) {
+    unsigned tail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    unsigned toSubmit = ring->sqLocalTail - tail;
+    atomic_store_explicit(ring->sqTail, ring->sqLocalTail, memory_order_release);
+
+    if (toSubmit == 0 && waitFor == 0) {
+        return 0;
+    }
+
+    int result;
+    do {
+        result = uringEnterSyscall(ring->fd, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+    } while (result < 0 && errno == EINTR);
+    return result < 0 ? -errno : result;
+}
+
+// Returns a zeroed SQE, submitting queued ones first if the ring is full
+static struct io_uring_sqe* uringGetSqe(Uring* ring) {
+    while (1) {
+        unsigned head = atomic_load_explicit(ring->sqHead, memory_order_acquire);
+        if (ring->sqLocalTail - head < ring->sqEntries) {
+            break;
+        }
+        if (uringSubmitAndWait(ring, 0) < 0) {
+            return NULL;
+        }
+    }
+
+    unsigned index = ring->sqLocalTail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+// Next completion, or NULL if none is ready. Call uringCqeSeen() after use.
+static struct io_uring_cqe* uringPeekCqe(Uring* ring) {
+    unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(ring->cqTail, memory_order_acquire);
+    return head == tail ? NULL : &ring->cqes[head & ring->cqMask];
+}
+
+static void uringCqeSeen(Uring* ring) {
+    unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+    atomic_store_explicit(ring->cqHead, head + 1, memory_order_release);
+}
+
+// Hands buffer `id` back to the kernel (visible after uringBufferRingPublish)
+static void uringBufferRingAdd(UringBufferRing* buffers, unsigned short id) {
+    struct io_uring_buf* buf = &buffers->ring->bufs[buffers->localTail & (buffers->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(buffers->buffers + (size_t)id * buffers->bufferSize);
+    buf->len = buffers->bufferSize;
+    buf->bid = id;
+    buffers->localTail++;
+}
+
+static void uringBufferRingPublish(UringBufferRing* buffers) {
+    atomic_store_explicit((_Atomic unsigned short*)&buffers->ring->tail, buffers->localTail, memory_order_release);
+}
+
+static char* uringBuffer(UringBufferRing* buffers, unsigned short id) {
+    return buffers->buffers + (size_t)id * buffers->bufferSize;
+}
+
+// Registers `entries` (a power of two) buffers of bufferSize bytes as group
+// groupId. Returns 0 or a negative errno (-EINVAL before Linux 5.19).
+static int uringBufferRingInit(Uring* ring, UringBufferRing* buffers, unsigned entries,
+                               unsigned bufferSize, unsigned short groupId) {
+    memset(buffers, 0, sizeof(*buffers));
+    buffers->entries = entries;
+    buffers->bufferSize = bufferSize;
+    buffers->groupId = groupId;
+
+    buffers->ringSize = entries * sizeof(struct io_uring_buf);
+    buffers->ring = (struct io_uring_buf_ring*)mmap(NULL, buffers->ringSize, PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED) {
+        return -errno;
+    }
+    buffers->buffers = (char*)malloc((size_t)entries * bufferSize);
+    if (buffers->buffers == NULL) {
+        munmap(buffers->ring, buffers->ringSize);
+        return -ENOMEM;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buffers->ring;
+    reg.ring_entries = entries;
+    reg.bgid = groupId;
+    if (uringRegisterSyscall(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int error = -errno;
+        munmap(buffers->ring, buffers->ringSize);
+        free(buffers->buffers);
+        return error;
+    }
+
+    for (unsigned i = 0; i < entries; i++) {
+        uringBufferRingAdd(buffers, (unsigned short)i);
+    }
+    uringBufferRingPublish(buffers);
+    return 0;
+}
+
+// Multishot recv needs Linux 6.0; older kernels fail it with -EINVAL, which
+// is too late to fall back gracefully, so check the version up front.
+static int uringKernelSupportsMultishotRecv() {
+    struct utsname name;
+    int major = 0;
+    if (uname(&name) < 0 || sscanf(name.release, "%d", &major) != 1) {
+        return 0;
+    }
+    return major >= 6;
+}
+
+#endif
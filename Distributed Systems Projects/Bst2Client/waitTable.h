@@ -0,0 +1,323 @@
+#ifndef WAIT_TABLE_H
+#define WAIT_TABLE_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+// Threads and connections waiting for a key to be inserted.
+//
+// Waiters hang off a hash table keyed by the key they want, so an insert
+// wakes exactly the waiters for its key with one bucket lookup, and a
+// waiter costs nothing while it sleeps: a blocked thread sits on its own
+// condition variable, and an event-loop connection is just a list entry.
+// Inserters call waitTableNotify after the key is visible to lookups; when
+// nobody waits at all that is a single atomic load.
+//
+// A waiter registers itself before it checks whether the key is already
+// present, both under its bucket lock, so an insert that lands in between
+// still finds it. The table calls back into the index (`present`) with the
+// bucket lock held; inserters must not hold index locks while notifying.
+//
+// A waiter ends with WAIT_PRESENT, WAIT_TIMED_OUT once its deadline passes,
+// or WAIT_CANCELLED when the CancelToken it was given fires (shutdown).
+
+#define WAIT_BUCKETS 1024
+
+#define WAIT_PRESENT 1
+#define WAIT_TIMED_OUT 0
+#define WAIT_CANCELLED -1
+
+typedef struct CancelToken {
+    _Atomic int cancelled;
+} CancelToken;
+
+typedef struct KeyWaiter {
+    int key;
+    long long deadline;    // CLOCK_MONOTONIC nanoseconds, LLONG_MAX for none
+    CancelToken* token;    // May be NULL
+    void (*wake)(struct KeyWaiter* waiter); // Runs with the bucket lock held; NULL in waitForKey
+    void* ctx;             // For wake
+    int result;
+    int done;
+    pthread_cond_t* cond;  // waitForKey's, signalled on completion
+    struct KeyWaiter* prev;
+    struct KeyWaiter* next;
+} KeyWaiter;
+
+typedef struct WaitBucket {
+    pthread_mutex_t lock;
+    KeyWaiter* waiters;
+} WaitBucket;
+
+typedef struct WaitTable {
+    WaitBucket buckets[WAIT_BUCKETS];
+    _Atomic long waiting;  // Registered waiters, for the notify fast path
+    int (*present)(void* ctx, int key);
+    void* ctx;
+    // Deadlines of callback waiters are enforced by waitTableTimerThread
+    pthread_mutex_t timerLock;
+    pthread_cond_t timerWake;
+    long long nextDeadline;
+} WaitTable;
+
+static inline long long waitClockNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Deadline timeoutNanos from now; a negative timeout means none
+static inline long long waitDeadline(long long timeoutNanos) {
+    return timeoutNanos < 0 ? LLONG_MAX : waitClockNanos() + timeoutNanos;
+}
+
+static inline void waitCondInit(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static inline struct timespec waitTimespec(long long nanos) {
+    struct timespec ts = {nanos / 1000000000LL, nanos % 1000000000LL};
+    return ts;
+}
+
+// present(ctx, key) must return 1 once key is in the index
+static inline void waitTableInit(WaitTable* table, int (*present)(void* ctx, int key), void* ctx) {
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        pthread_mutex_init(&table->buckets[i].lock, NULL);
+        table->buckets[i].waiters = NULL;
+    }
+    atomic_store(&table->waiting, 0);
+    table->present = present;
+    table->ctx = ctx;
+    pthread_mutex_init(&table->timerLock, NULL);
+    waitCondInit(&table->timerWake);
+    table->nextDeadline = LLONG_MAX;
+}
+
+static inline WaitBucket* waitBucket(WaitTable* table, int key) {
+    return &table->buckets[((uint32_t)key * 2654435769u) >> 22]; // Top 10 bits
+}
+
+static inline void waitLink(WaitTable* table, WaitBucket* bucket, KeyWaiter* waiter) {
+    waiter->prev = NULL;
+    waiter->next = bucket->waiters;
+    if (bucket->waiters != NULL) {
+        bucket->waiters->prev = waiter;
+    }
+    bucket->waiters = waiter;
+    // Ordered before the presence check, against an inserter's store and load
+    atomic_fetch_add(&table->waiting, 1);
+}
+
+static inline void waitUnlink(WaitTable* table, WaitBucket* bucket, KeyWaiter* waiter) {
+    if (waiter->prev != NULL) {
+        waiter->prev->next = waiter->next;
+    } else {
+        bucket->waiters = waiter->next;
+    }
+    if (waiter->next != NULL) {
+        waiter->next->prev = waiter->prev;
+    }
+    atomic_fetch_sub(&table->waiting, 1);
+}
+
+// Unlinks a registered waiter and hands it its result. Bucket lock held.
+static inline void waitComplete(WaitTable* table, WaitBucket* bucket, KeyWaiter* waiter, int result) {
+    waitUnlink(table, bucket, waiter);
+    waiter->result = result;
+    waiter->done = 1;
+    if (waiter->wake != NULL) {
+        waiter->wake(waiter);
+    } else {
+        pthread_cond_signal(waiter->cond);
+    }
+}
+
+static inline int cancelTokenFired(const CancelToken* token) {
+    return token != NULL && atomic_load(&token->cancelled);
+}
+
+// Blocks the calling thread until key is present, the deadline (from
+// waitDeadline) passes or token fires. Returns the WAIT_ result.
+static inline int waitForKey(WaitTable* table, int key, long long deadline, CancelToken* token) {
+    WaitBucket* bucket = waitBucket(table, key);
+    pthread_cond_t cond;
+    waitCondInit(&cond);
+    KeyWaiter waiter = {key, deadline, token, NULL, NULL, WAIT_TIMED_OUT, 0, &cond, NULL, NULL};
+
+    pthread_mutex_lock(&bucket->lock);
+    waitLink(table, bucket, &waiter);
+    if (cancelTokenFired(token)) {
+        waitComplete(table, bucket, &waiter, WAIT_CANCELLED);
+    } else if (table->present(table->ctx, key)) {
+        waitComplete(table, bucket, &waiter, WAIT_PRESENT);
+    }
+    while (!waiter.done) {
+        if (deadline == LLONG_MAX) {
+            pthread_cond_wait(&cond, &bucket->lock);
+        } else {
+            struct timespec until = waitTimespec(deadline);
+            if (pthread_cond_timedwait(&cond, &bucket->lock, &until) == ETIMEDOUT && !waiter.done) {
+                waitComplete(table, bucket, &waiter, WAIT_TIMED_OUT);
+            }
+        }
+    }
+    pthread_mutex_unlock(&bucket->lock);
+
+    pthread_cond_destroy(&cond);
+    return waiter.result;
+}
+
+// Registers a waiter whose wake callback runs (from whichever thread
+// completes it, with the bucket lock held) once the key is present, the
+// deadline passes or the token fires. The callback must only queue the
+// waiter for its owner. Returns 0 once registered, or WAIT_PRESENT or
+// WAIT_CANCELLED (with no callback) when the wait is already over. Fill in
+// key, deadline, token, wake and ctx first; the waiter must stay put until
+// it completes or waitTableCancel takes it back.
+static inline int waitTableWatch(WaitTable* table, KeyWaiter* waiter) {
+    WaitBucket* bucket = waitBucket(table, waiter->key);
+    long long deadline = waiter->deadline; // The callback may run before we're done
+    int result = 0;
+    waiter->done = 0;
+
+    pthread_mutex_lock(&bucket->lock);
+    waitLink(table, bucket, waiter);
+    if (cancelTokenFired(waiter->token)) {
+        result = WAIT_CANCELLED;
+    } else if (table->present(table->ctx, waiter->key)) {
+        result = WAIT_PRESENT;
+    }
+    if (result != 0) {
+        waitUnlink(table, bucket, waiter);
+        waiter->result = result;
+        waiter->done = 1;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+
+    if (result == 0 && deadline != LLONG_MAX) {
+        pthread_mutex_lock(&table->timerLock);
+        if (deadline < table->nextDeadline) {
+            table->nextDeadline = deadline;
+            pthread_cond_signal(&table->timerWake);
+        }
+        pthread_mutex_unlock(&table->timerLock);
+    }
+    return result;
+}
+
+// Takes back a waitTableWatch waiter that is no longer wanted. Returns 1 if
+// it was still waiting (its callback will never run), 0 if it has already
+// completed and its callback has run.
+static inline int waitTableCancel(WaitTable* table, KeyWaiter* waiter) {
+    WaitBucket* bucket = waitBucket(table, waiter->key);
+    pthread_mutex_lock(&bucket->lock);
+    int waiting = !waiter->done;
+    if (waiting) {
+        waitUnlink(table, bucket, waiter);
+        waiter->done = 1;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    return waiting;
+}
+
+// Wakes everyone waiting for key. Call after the insert is visible to
+// present(), with no index lock held.
+static inline void waitTableNotify(WaitTable* table, int key) {
+    atomic_thread_fence(memory_order_seq_cst); // Pairs with waitLink's increment
+    if (atomic_load_explicit(&table->waiting, memory_order_relaxed) == 0) {
+        return;
+    }
+    WaitBucket* bucket = waitBucket(table, key);
+    pthread_mutex_lock(&bucket->lock);
+    KeyWaiter* waiter = bucket->waiters;
+    while (waiter != NULL) {
+        KeyWaiter* next = waiter->next;
+        if (waiter->key == key) {
+            waitComplete(table, bucket, waiter, WAIT_PRESENT);
+        }
+        waiter = next;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+// Fires token: every waiter holding it, now or later, ends with
+// WAIT_CANCELLED
+static inline void cancelTokenFire(WaitTable* table, CancelToken* token) {
+    atomic_store(&token->cancelled, 1);
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        WaitBucket* bucket = &table->buckets[i];
+        pthread_mutex_lock(&bucket->lock);
+        KeyWaiter* waiter = bucket->waiters;
+        while (waiter != NULL) {
+            KeyWaiter* next = waiter->next;
+            if (waiter->token == token) {
+                waitComplete(table, bucket, waiter, WAIT_CANCELLED);
+            }
+            waiter = next;
+        }
+        pthread_mutex_unlock(&bucket->lock);
+    }
+}
+
+// Times out the callback waiters whose deadline is at or before now.
+// Returns the earliest deadline still pending.
+static inline long long waitTableExpire(WaitTable* table, long long now) {
+    long long next = LLONG_MAX;
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        WaitBucket* bucket = &table->buckets[i];
+        pthread_mutex_lock(&bucket->lock);
+        KeyWaiter* waiter = bucket->waiters;
+        while (waiter != NULL) {
+            KeyWaiter* following = waiter->next;
+            if (waiter->wake != NULL) {
+                if (waiter->deadline <= now) {
+                    waitComplete(table, bucket, waiter, WAIT_TIMED_OUT);
+                } else if (waiter->deadline < next) {
+                    next = waiter->deadline;
+                }
+            }
+            waiter = following;
+        }
+        pthread_mutex_unlock(&bucket->lock);
+    }
+    return next;
+}
+
+// Enforces the deadlines of waitTableWatch waiters. It sleeps until the
+// earliest one, then sweeps the table; start one per table that has them.
+static inline void* waitTableTimerThread(void* arg) {
+    WaitTable* table = (WaitTable*)arg;
+    pthread_mutex_lock(&table->timerLock);
+    while (1) {
+        long long now = waitClockNanos();
+        if (table->nextDeadline == LLONG_MAX) {
+            pthread_cond_wait(&table->timerWake, &table->timerLock);
+            continue;
+        }
+        if (now < table->nextDeadline) {
+            struct timespec until = waitTimespec(table->nextDeadline);
+            pthread_cond_timedwait(&table->timerWake, &table->timerLock, &until);
+            continue;
+        }
+
+        table->nextDeadline = LLONG_MAX;
+        pthread_mutex_unlock(&table->timerLock);
+        long long next = waitTableExpire(table, now);
+        pthread_mutex_lock(&table->timerLock);
+        if (next < table->nextDeadline) {
+            table->nextDeadline = next;
+        }
+    }
+    return NULL;
+}
+
+#endif
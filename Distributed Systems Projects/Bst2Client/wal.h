@@ -0,0 +1,284 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Append-only write-ahead log of tree mutations.
+//
+// Each record is 12 bytes: u8 op, three zero bytes, little-endian int32 key
+// and a checksum of the first 8 bytes. Replay stops at the first record that
+// is short or fails its checksum (a write torn by a crash) and truncates the
+// file there. A record's log sequence number (LSN) is the file offset just
+// past it.
+//
+// Writers append records to an in-memory batch and then wait for their LSN.
+// Whoever finds no flush running becomes the leader: it takes the whole
+// batch, writes it with one write() and (if required) one fdatasync(), and
+// wakes everyone it covered. Writers that arrive meanwhile form the next
+// batch, so the number of syncs tracks disk latency, not the request rate.
+
+#define WAL_RECORD_SIZE 12
+
+// Durability modes
+#define WAL_DURABILITY_ALWAYS 0   // fdatasync before acknowledging a write
+#define WAL_DURABILITY_INTERVAL 1 // fdatasync every intervalMs in the background
+#define WAL_DURABILITY_OS 2       // write() only; the OS decides when to sync
+
+typedef struct Wal {
+    int fd;
+    int durability;
+    int intervalMs;
+    pthread_mutex_t lock;
+    pthread_cond_t flushed;
+    char* pending;       // Records appended but not yet written
+    size_t pendingLen;
+    size_t pendingCap;
+    char* writing;       // Batch owned by the current leader
+    size_t writingCap;
+    uint64_t appended;   // LSN of the last appended record
+    uint64_t durable;    // Everything below this LSN is written (and synced)
+    int flushing;
+    uint64_t batches;    // Statistics: write() calls and records written
+    uint64_t records;
+    pthread_t flusher;
+} Wal;
+
+static inline uint32_t walChecksum(const unsigned char* data, size_t len) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline void walEncode(unsigned char* out, int op, int32_t key) {
+    uint32_t value = (uint32_t)key;
+    memset(out, 0, WAL_RECORD_SIZE);
+    out[0] = (unsigned char)op;
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (unsigned char)(value >> (8 * i));
+    }
+    uint32_t sum = walChecksum(out, 8);
+    for (int i = 0; i < 4; i++) {
+        out[8 + i] = (unsigned char)(sum >> (8 * i));
+    }
+}
+
+// Returns 1 and fills op/key if the record is intact
+static inline int walDecode(const unsigned char* in, int* op, int32_t* key) {
+    uint32_t value = 0, sum = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)in[4 + i] << (8 * i);
+        sum |= (uint32_t)in[8 + i] << (8 * i);
+    }
+    if (sum != walChecksum(in, 8) || in[0] == 0 || in[1] || in[2] || in[3]) {
+        return 0;
+    }
+    *op = in[0];
+    *key = (int32_t)value;
+    return 1;
+}
+
+// Writes the whole pending batch as the leader. Called and returns with
+// wal->lock held; drops it around the I/O.
+static void walLeadFlush(Wal* wal, int sync) {
+    char* batch = wal->pending;
+    size_t batchCap = wal->pendingCap;
+    size_t len = wal->pendingLen;
+    uint64_t end = wal->appended;
+    wal->pending = wal->writing;
+    wal->pendingCap = wal->writingCap;
+    wal->pendingLen = 0;
+    wal->writing = batch;
+    wal->writingCap = batchCap;
+    wal->flushing = 1;
+    pthread_mutex_unlock(&wal->lock);
+
+    size_t pos = 0;
+    while (pos < len) {
+        ssize_t n = write(wal->fd, batch + pos, len - pos);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            // Acknowledged writes would silently become volatile; stop instead
+            perror("WAL write error");
+            exit(1);
+        }
+        pos += n;
+    }
+    if (sync && fdatasync(wal->fd) < 0) {
+        perror("WAL sync error");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->flushing = 0;
+    if (end > wal->durable) {
+        wal->durable = end;
+    }
+    if (len > 0) {
+        wal->batches++;
+        wal->records += len / WAL_RECORD_SIZE;
+    }
+    pthread_cond_broadcast(&wal->flushed);
+}
+
+// Appends one record and returns its LSN. Call it while holding whatever
+// lock orders the mutation itself, so the log order matches the tree's.
+static uint64_t walAppend(Wal* wal, int op, int32_t key) {
+    pthread_mutex_lock(&wal->lock);
+    if (wal->pendingLen + WAL_RECORD_SIZE > wal->pendingCap) {
+        size_t cap = wal->pendingCap ? wal->pendingCap * 2 : 64 * WAL_RECORD_SIZE;
+        wal->pending = (char*)realloc(wal->pending, cap);
+        wal->pendingCap = cap;
+    }
+    walEncode((unsigned char*)wal->pending + wal->pendingLen, op, key);
+    wal->pendingLen += WAL_RECORD_SIZE;
+    wal->appended += WAL_RECORD_SIZE;
+    uint64_t lsn = wal->appended;
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+// Waits until the record at lsn is as durable as the mode promises. With
+// WAL_DURABILITY_INTERVAL this returns at once; the flusher thread syncs.
+static void walCommit(Wal* wal, uint64_t lsn) {
+    if (wal->durability == WAL_DURABILITY_INTERVAL) {
+        return;
+    }
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable < lsn) {
+        if (wal->flushing) {
+            pthread_cond_wait(&wal->flushed, &wal->lock);
+        } else {
+            walLeadFlush(wal, wal->durability == WAL_DURABILITY_ALWAYS);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+// Writes and syncs everything appended so far
+static void walSync(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t lsn = wal->appended;
+    while (wal->durable < lsn) {
+        if (wal->flushing) {
+            pthread_cond_wait(&wal->flushed, &wal->lock);
+        } else {
+            walLeadFlush(wal, 1);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+static void* walFlusherThread(void* arg) {
+    Wal* wal = (Wal*)arg;
+    struct timespec delay = {wal->intervalMs / 1000, (wal->intervalMs % 1000) * 1000000L};
+    while (1) {
+        nanosleep(&delay, NULL);
+        walSync(wal);
+    }
+    return NULL;
+}
+
+// Opens (or creates) the log at path and replays every intact record from
+// byte offset `from` (the end of what a checkpoint already covers) through
+// apply(). Returns the number of records replayed, or -1 on error.
+static long walOpen(Wal* wal, const char* path, int durability, int intervalMs, uint64_t from,
+                    void (*apply)(int op, int32_t key)) {
+    memset(wal, 0, sizeof(*wal));
+    wal->durability = durability;
+    wal->intervalMs = intervalMs > 0 ? intervalMs : 1;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->flushed, NULL);
+
+    wal->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (wal->fd < 0) {
+        perror("WAL open error");
+        return -1;
+    }
+
+    // Replay in large reads; a record may straddle two of them
+    size_t chunk = 4096 * WAL_RECORD_SIZE;
+    unsigned char* buffer = (unsigned char*)malloc(chunk);
+    uint64_t offset = from;
+    size_t buffered = 0;
+    long replayed = 0;
+    int torn = 0;
+    while (!torn) {
+        ssize_t n = pread(wal->fd, buffer + buffered, chunk - buffered, offset + buffered);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("WAL read error");
+            free(buffer);
+            close(wal->fd);
+            return -1;
+        }
+        buffered += n;
+
+        size_t pos = 0;
+        while (buffered - pos >= WAL_RECORD_SIZE) {
+            int op;
+            int32_t key;
+            if (!walDecode(buffer + pos, &op, &key)) {
+                torn = 1;
+                break;
+            }
+            apply(op, key);
+            replayed++;
+            pos += WAL_RECORD_SIZE;
+        }
+        offset += pos;
+        memmove(buffer, buffer + pos, buffered - pos);
+        buffered -= pos;
+        if (n == 0) {
+            break; // End of file; anything still buffered is a partial record
+        }
+    }
+    free(buffer);
+
+    // Drop a torn tail so new records don't land after garbage
+    off_t size = lseek(wal->fd, 0, SEEK_END);
+    if (size < 0) {
+        perror("WAL seek error");
+        close(wal->fd);
+        return -1;
+    }
+    if ((uint64_t)size < from) {
+        fprintf(stderr, "WAL is shorter than the checkpoint expects\n");
+        close(wal->fd);
+        return -1;
+    }
+    if ((uint64_t)size != offset) {
+        fprintf(stderr, "WAL: discarding %lld damaged byte(s) at offset %llu\n",
+                (long long)(size - offset), (unsigned long long)offset);
+        if (ftruncate(wal->fd, offset) < 0 || fdatasync(wal->fd) < 0) {
+            perror("WAL truncate error");
+            close(wal->fd);
+            return -1;
+        }
+    }
+    lseek(wal->fd, offset, SEEK_SET);
+    wal->appended = wal->durable = offset;
+
+    if (durability == WAL_DURABILITY_INTERVAL &&
+        pthread_create(&wal->flusher, NULL, walFlusherThread, wal) != 0) {
+        perror("WAL flusher creation error");
+        close(wal->fd);
+        return -1;
+    }
+    return replayed;
+}
+
+#endif